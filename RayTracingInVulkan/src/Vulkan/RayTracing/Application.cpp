@@ -334,6 +334,8 @@ namespace Vulkan::RayTracing
 		// Hit group 3: proceduralCylinder
 		// Hit group 4: proceduralMandelbulb
 
+		// BLAS of each instance, for the INT TLAS
+		std::vector<uint32_t> blasIndices;
 		uint32_t instanceId = 0;
 
 		printf("RTV: Adding %ld BLAS instances\n", scene.Models().size());
@@ -353,6 +355,7 @@ namespace Vulkan::RayTracing
 
 			instances.push_back(TopLevelAccelerationStructure::CreateInstance(
 				bottomAs_[instanceId], glm::mat4(1), instanceId, hitGroupID));
+			blasIndices.push_back(instanceId);
 
 			/*instances.push_back(TopLevelAccelerationStructure::CreateInstance(
 				bottomAs_[instanceId], glm::mat4(1), instanceId, model.Procedural() ? 1 : 0));*/
@@ -385,6 +388,7 @@ namespace Vulkan::RayTracing
 
 		// Generate the structures.
 		topAs_[0].Generate(commandBuffer, *topScratchBuffer_, 0, *topBuffer_, 0);
+		topAs_[0].create_int_tlas_buffer(CommandPool(), bottomAs_, instances, blasIndices);
 
 		debugUtils.SetObjectName(topAs_[0].Handle(), "TLAS");
 	}
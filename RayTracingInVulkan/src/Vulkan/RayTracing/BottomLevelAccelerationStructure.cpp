@@ -4,11 +4,13 @@
 #include "Assets/Vertex.hpp"
 #include "Utilities/Exception.hpp"
 #include "Vulkan/Buffer.hpp"
-#include "Vulkan/BufferUtil.hpp"
+#include "Vulkan/SingleTimeCommands.hpp"
+#include "cache.hpp"
 
 #include "bvh/traverse.hpp"
 #include "bvh/single_ray_traverser.hpp"
 #include "bvh/primitive_intersectors.hpp"
+#include "tune.hpp"
 
 typedef bvh::SingleRayTraverser<bvh_t> traverser_t;
 typedef bvh::ClosestPrimitiveIntersector<bvh_t, trig_t> primitive_intersector_t;
@@ -73,27 +75,115 @@ namespace Vulkan::RayTracing
 		// Build the bottom - level acceleration structure(BLAS)
 		deviceProcedures_.vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo_, &pBuildOffsetInfo);
 
-		// Build the BVH and convert to VSIM BVH
-		bvh_t bvh = build_bvh(trigs);
-		size_t node_count = bvh.node_count;
-		printf("(ycpin) Build BVH, node_count = %ld\n", node_count);
+		// defaults, or the starting point of tune_costs
+		cost_params_t costs = {0.5f, 1.0f, 1.0f};
 
-		float t_trv_int = 0.5;
-		float t_switch = 1;
-		float t_ist = 1;
+		builder_type_t builder_type = get_builder_type();
 
-		int_bvh_t int_bvh = build_int_bvh(t_trv_int, t_switch, t_ist, trigs, bvh);
-		int_bvh_v2_t int_bvh_v2 = convert_nodes(int_bvh, bvh, trigs);
-		printf("(ycpin) Build INT BVH, Clustering...\n");
+		// Reuse a cached VSIM BVH built from the same triangles and parameters
+		cache_key_t cache_key = get_cache_key(costs.t_trv_int, costs.t_switch, costs.t_ist, trigs, builder_type, ref_depth_limit);
+		std::string cache_path = get_cache_path(cache_key);
 
-		check_correctness(bvh, int_bvh);
-		printf("(ycpin) Check correctness\n");
+#if INT_BVH_WIDTH == 2
+		int_bvh_v2_t int_bvh_v2;
+		if (load_int_bvh(cache_path, cache_key, int_bvh_v2, &costs))
+		{
+			printf("(ycpin) Load INT BVH from %s, %d clusters\n", cache_path.c_str(), int_bvh_v2.num_clusters);
+			if (autotune != autotune_t::OFF)
+				printf("(ycpin) Tuned t_trv_int = %g, t_switch = %g, t_ist = %g (cached)\n", costs.t_trv_int,
+					   costs.t_switch, costs.t_ist);
+		}
+		else
+		{
+			// Build the BVH and convert to VSIM BVH, tune_costs converts the same BVH
+			bvh_t bvh = build_bvh(trigs, builder_type);
+			printf("(ycpin) Build BVH, node_count = %ld\n", bvh.node_count);
+			if (autotune != autotune_t::OFF)
+				costs = tune_costs(
+					costs, trigs, bvh, ref_depth_limit,
+					[&](const cost_params_t &c, const bvh_t &candidate_bvh)
+					{ return build_int_bvh_v2(c.t_trv_int, c.t_switch, c.t_ist, trigs, candidate_bvh, ref_depth_limit); },
+					[&](int_bvh_v2_t &int_bvh, const ray_t &ray, statistics_t &statistics)
+					{ int_traverse_v2(int_bvh, trigs.data(), ray, statistics); });
+			if (optimize_quant_cost)
+				optimize_bvh(costs.t_trv_int, costs.t_switch, costs.t_ist, bvh, ref_depth_limit);
+
+			int_bvh_v2 = build_int_bvh_v2(costs.t_trv_int, costs.t_switch, costs.t_ist, trigs, bvh, ref_depth_limit);
+			printf("(ycpin) Build INT BVH (%d-bit bounds, %d-byte nodes), Clustering...\n", quant_bits, INT_BVH_NODE_length);
+
+			check_correctness(bvh, int_bvh_v2);
+
+			if (save_int_bvh(cache_path, cache_key, int_bvh_v2, &costs))
+				printf("(ycpin) Save INT BVH to %s\n", cache_path.c_str());
+		}
 
-		check_correctness_v2(bvh, int_bvh_v2);
-		printf("(ycpin) Check correctness v2\n");
+		create_int_bvh_buffer(commandPool, int_bvh_v2);
+		printf("(ycpin) Create buffer & device memory for INT BVH\n");
+		int_bvh_ = std::move(int_bvh_v2);
+#else
+		int_bvh_wide_t<INT_BVH_WIDTH> int_bvh_wide;
+		if (load_int_bvh(cache_path, cache_key, int_bvh_wide, &costs))
+		{
+			printf("(ycpin) Load %d-wide INT BVH from %s, %d clusters\n", INT_BVH_WIDTH, cache_path.c_str(),
+				   int_bvh_wide.num_clusters);
+			if (autotune != autotune_t::OFF)
+				printf("(ycpin) Tuned t_trv_int = %g, t_switch = %g, t_ist = %g (cached)\n", costs.t_trv_int,
+					   costs.t_switch, costs.t_ist);
+		}
+		else
+		{
+			// Build the BVH and convert to VSIM BVH, tune_costs converts the same BVH
+			bvh_t bvh = build_bvh(trigs, builder_type);
+			printf("(ycpin) Build BVH, node_count = %ld\n", bvh.node_count);
+			if (autotune != autotune_t::OFF)
+				costs = tune_costs(
+					costs, trigs, bvh, ref_depth_limit,
+					[&](const cost_params_t &c, const bvh_t &candidate_bvh)
+					{ return build_int_bvh_wide<INT_BVH_WIDTH>(c.t_trv_int, c.t_switch, c.t_ist, trigs, candidate_bvh, ref_depth_limit); },
+					[&](int_bvh_wide_t<INT_BVH_WIDTH> &int_bvh, const ray_t &ray, statistics_t &statistics)
+					{ int_traverse_wide(int_bvh, trigs.data(), ray, statistics); });
+			if (optimize_quant_cost)
+				optimize_bvh(costs.t_trv_int, costs.t_switch, costs.t_ist, bvh, ref_depth_limit);
+
+			int_bvh_wide = build_int_bvh_wide<INT_BVH_WIDTH>(costs.t_trv_int, costs.t_switch, costs.t_ist, trigs, bvh, ref_depth_limit);
+			printf("(ycpin) Build %d-wide INT BVH (%d-bit bounds, %d-byte nodes), Clustering...\n", INT_BVH_WIDTH, quant_bits,
+				   INT_BVH_NODE_length);
+
+			check_correctness(bvh, int_bvh_wide);
+
+			if (save_int_bvh(cache_path, cache_key, int_bvh_wide, &costs))
+				printf("(ycpin) Save INT BVH to %s\n", cache_path.c_str());
+		}
 
-		create_int_bvh_buffer(commandPool, bvh, int_bvh_v2);
+		create_int_bvh_buffer(commandPool, int_bvh_wide);
 		printf("(ycpin) Create buffer & device memory for INT BVH\n");
+		int_bvh_ = std::move(int_bvh_wide);
+#endif
+	}
+
+	int_blas_t BottomLevelAccelerationStructure::get_int_blas() const
+	{
+		int_blas_t int_blas = {};
+		if (int_bvh_.num_trigs == 0)
+			return int_blas;
+
+		int_blas.clusters_addr = int_bvh_clusters_Buffer_->GetDeviceAddress();
+		int_blas.trigs_addr = int_bvh_trigs_Buffer_->GetDeviceAddress();
+		int_blas.nodes_addr = int_bvh_nodes_Buffer_->GetDeviceAddress();
+		int_blas.primitive_indices_addr = int_bvh_primitive_indices_Buffer_->GetDeviceAddress();
+		if (int_bvh_qtrigs_Buffer_)
+			int_blas.qtrigs_addr = int_bvh_qtrigs_Buffer_->GetDeviceAddress();
+		int_blas.num_clusters = static_cast<uint32_t>(int_bvh_.num_clusters);
+		int_blas.num_nodes = static_cast<uint32_t>(int_bvh_.num_nodes);
+		int_blas.num_trigs = static_cast<uint32_t>(int_bvh_.num_trigs);
+		return int_blas;
+	}
+
+	bbox_t BottomLevelAccelerationStructure::get_int_bvh_bbox() const
+	{
+		if (int_bvh_.num_trigs == 0)
+			return bbox_t::empty();
+		return get_ref_bbox(int_bvh_.clusters[0]);
 	}
 
 	void BottomLevelAccelerationStructure::retrieve_triangles()
@@ -103,10 +193,12 @@ namespace Vulkan::RayTracing
 
 		printf("(ycpin) Geometries size: %ld\n", geometries.size());
 
+		// First pass: find the supported geometries and where their triangles go in trigs
+		std::vector<size_t> trig_offsets(geometries.size() + 1, 0);
 		for (size_t i = 0; i < geometries.size(); ++i)
 		{
 			const auto &geometry = geometries[i];
-			const auto &buildOffsetInfo = buildOffsetInfos[i];
+			trig_offsets[i + 1] = trig_offsets[i];
 
 			// Check if the geometry is a triangle
 			if (geometry.geometryType != VK_GEOMETRY_TYPE_TRIANGLES_KHR)
@@ -115,141 +207,132 @@ namespace Vulkan::RayTracing
 				continue;
 			}
 
-			const auto &triangleData = geometry.geometry.triangles;
-
-			const float *vertexData = reinterpret_cast<const float *>(triangleData.vertexData.deviceAddress);
-			VkDeviceSize vertexStride = triangleData.vertexStride;
-
-			const void *indexData = reinterpret_cast<const void *>(triangleData.indexData.deviceAddress);
-			VkIndexType indexType = triangleData.indexType;
-
 			// Currently, only handle UINT32 index type
-			if (indexType != VK_INDEX_TYPE_UINT32)
+			if (geometry.geometry.triangles.indexType != VK_INDEX_TYPE_UINT32)
 			{
 				printf("(ycpin) Unsupported index type!\n");
 				continue;
 			}
 
-			const uint32_t *indices = reinterpret_cast<const uint32_t *>(indexData);
+			trig_offsets[i + 1] += buildOffsetInfos[i].primitiveCount;
+		}
 
-			for (uint32_t j = 0; j < buildOffsetInfo.primitiveCount; ++j)
-			{
-				std::array<vector_t, 3> triangleVertices;
+		size_t first_trig = trigs.size();
+		trigs.resize(first_trig + trig_offsets.back());
 
-				// Fetch triangle vertices
-				// printf("Triangle %d:\n", j);
+		// Second pass: fetch the triangle vertices, every triangle is written to its own slot
+		for (size_t i = 0; i < geometries.size(); ++i)
+		{
+			if (trig_offsets[i + 1] == trig_offsets[i])
+				continue;
+
+			const auto &triangleData = geometries[i].geometry.triangles;
+
+			const char *vertexData = reinterpret_cast<const char *>(triangleData.vertexData.deviceAddress);
+			VkDeviceSize vertexStride = triangleData.vertexStride;
+			const uint32_t *indices = reinterpret_cast<const uint32_t *>(triangleData.indexData.deviceAddress);
+			trig_t *geometry_trigs = trigs.data() + first_trig + trig_offsets[i];
+			int64_t primitiveCount = static_cast<int64_t>(trig_offsets[i + 1] - trig_offsets[i]);
 
+#pragma omp parallel for
+			for (int64_t j = 0; j < primitiveCount; ++j)
+			{
+				std::array<vector_t, 3> triangleVertices;
 				for (uint32_t k = 0; k < 3; ++k)
 				{
 					uint32_t index = indices[j * 3 + k];
-					const float *vertex = reinterpret_cast<const float *>(
-						reinterpret_cast<const char *>(vertexData) + index * vertexStride);
-
+					const float *vertex = reinterpret_cast<const float *>(vertexData + index * vertexStride);
 					triangleVertices[k] = vector_t(vertex[0], vertex[1], vertex[2]);
-
-					// Print the triangle vertex information
-					// printf("  Vertex %d: (%f, %f, %f)\n", k, vertex[0], vertex[1], vertex[2]);
 				}
 
-				// Add the triangle to the list
-				trigs.emplace_back(triangleVertices[0], triangleVertices[1], triangleVertices[2]);
+				geometry_trigs[j] = trig_t(triangleVertices[0], triangleVertices[1], triangleVertices[2]);
 			}
 		}
 	}
 
-	void BottomLevelAccelerationStructure::check_correctness(bvh::Bvh<float> &bvh, int_bvh_t &int_bvh)
-	{
-		intmax_t correct_rays = 0;
-		intmax_t total_rays = 0;
-
-		traverser_t full_traverser(bvh);
-		primitive_intersector_t primitive_intersector(bvh, trigs.data());
-		traverser_t::Statistics full_statistics;
-		statistics_t int_statistics;
-		std::ifstream ray_fs("../../../assets/ray/kitchen.ray");
+	// rays traced together, one packet of int_traverse_v2_packet
+	constexpr size_t check_block_size = std::max<size_t>(packet_size, 1);
 
-		for (float r[7]; ray_fs.read((char *)r, 7 * sizeof(float)); total_rays++)
+	template <typename int_bvh_T>
+	void BottomLevelAccelerationStructure::check_correctness(bvh::Bvh<float> &bvh, int_bvh_T &int_bvh)
+	{
+		std::string ray_file = get_ray_file();
+		if (ray_file.empty())
 		{
-			ray_t ray(
-				vector_t(r[0], r[1], r[2]),
-				vector_t(r[3], r[4], r[5]),
-				0.f,
-				r[6]);
-
-			auto full_result = full_traverser.traverse(ray, primitive_intersector, full_statistics);
-			auto int_result = int_traverse(int_bvh, trigs.data(), ray, int_statistics);
-
-			if (full_result.has_value())
-			{
-				if (int_result.has_value() &&
-					int_result->t == full_result->intersection.t &&
-					int_result->u == full_result->intersection.u &&
-					int_result->v == full_result->intersection.v)
-					correct_rays++;
-			}
-			else if (!int_result.has_value())
-			{
-				correct_rays++;
-			}
+			printf("(ycpin) Skip correctness check, INT_BVH_RAY_FILE is empty\n");
+			return;
 		}
 
-		std::cout << "  (vanilla)" << std::endl;
-		std::cout << "    traversal_steps: " << full_statistics.traversal_steps << std::endl;
-		std::cout << "    both_intersected: " << full_statistics.both_intersected << std::endl;
-		std::cout << "    intersections_a: " << full_statistics.intersections_a << std::endl;
-		std::cout << "    intersections_b: " << full_statistics.intersections_b << std::endl;
-		std::cout << "    finalize: " << full_statistics.finalize << std::endl;
-
-		std::cout << "  (quantized)" << std::endl;
-		std::cout << "    intersect_bbox: " << int_statistics.intersect_bbox << std::endl;
-		std::cout << "    push_cluster: " << int_statistics.push_cluster << std::endl;
-		std::cout << "    recompute_qymax: " << int_statistics.recompute_qymax << std::endl;
-		std::cout << "    traversal_steps: " << int_statistics.traversal_steps << std::endl;
-		std::cout << "    both_intersected: " << int_statistics.both_intersected << std::endl;
-		std::cout << "    intersections_a: " << int_statistics.bvh_statistics.intersections_a << std::endl;
-		std::cout << "    intersections_b: " << int_statistics.bvh_statistics.intersections_b << std::endl;
-		std::cout << "    finalize: " << int_statistics.finalize << std::endl;
+		std::vector<ray_t> rays = load_rays(ray_file);
+		if (rays.empty())
+		{
+			printf("(ycpin) Skip correctness check, no rays in %s\n", ray_file.c_str());
+			return;
+		}
 
-		std::cout << "  total_rays: " << total_rays << std::endl;
-		std::cout << "  correct_rays: " << correct_rays << std::endl;
-	}
+		// the counts do not depend on the order the rays are traced in
+		if (ray_order == ray_order_t::MORTON)
+		{
+			std::vector<size_t> order;
+			rays = sort_rays(rays, order);
+		}
 
-	void BottomLevelAccelerationStructure::check_correctness_v2(bvh::Bvh<float> &bvh, int_bvh_v2_t &int_bvh_v2)
-	{
+		auto start = std::chrono::steady_clock::now();
 		intmax_t correct_rays = 0;
-		intmax_t total_rays = 0;
+		intmax_t total_rays = static_cast<intmax_t>(rays.size());
+		int64_t num_blocks = static_cast<int64_t>((rays.size() + check_block_size - 1) / check_block_size);
 
 		traverser_t full_traverser(bvh);
 		primitive_intersector_t primitive_intersector(bvh, trigs.data());
 		traverser_t::Statistics full_statistics;
 		statistics_t int_statistics;
-		std::ifstream ray_fs("../../../assets/ray/kitchen.ray");
 
-		for (float r[7]; ray_fs.read((char *)r, 7 * sizeof(float)); total_rays++)
+		// every thread counts into its own statistics, they are summed once at the end
+#pragma omp parallel
 		{
-			ray_t ray(
-				vector_t(r[0], r[1], r[2]),
-				vector_t(r[3], r[4], r[5]),
-				0.f,
-				r[6]);
-
-			auto full_result = full_traverser.traverse(ray, primitive_intersector, full_statistics);
-			auto int_result = int_traverse_v2(int_bvh_v2, trigs.data(), ray, int_statistics);
+			traverser_t::Statistics local_full_statistics;
+			statistics_t local_int_statistics;
+			std::optional<intersection_t> int_results[check_block_size];
 
-			if (full_result.has_value())
+#pragma omp for schedule(dynamic, 64) reduction(+ : correct_rays)
+			for (int64_t block = 0; block < num_blocks; block++)
 			{
-				if (int_result.has_value() &&
-					int_result->t == full_result->intersection.t &&
-					int_result->u == full_result->intersection.u &&
-					int_result->v == full_result->intersection.v)
-					correct_rays++;
+				size_t first = static_cast<size_t>(block) * check_block_size;
+				size_t count = std::min(check_block_size, rays.size() - first);
+				int_traverse_rays(int_bvh, trigs.data(), &rays[first], count, int_results, local_int_statistics);
+
+				for (size_t i = 0; i < count; i++)
+				{
+					auto full_result = full_traverser.traverse(rays[first + i], primitive_intersector, local_full_statistics);
+					const auto &int_result = int_results[i];
+
+					if (full_result.has_value())
+					{
+						if (int_result.has_value() && is_same_hit(*int_result, full_result->intersection))
+							correct_rays++;
+					}
+					else if (!int_result.has_value())
+					{
+						correct_rays++;
+					}
+				}
 			}
-			else if (!int_result.has_value())
+
+#pragma omp critical
 			{
-				correct_rays++;
+				full_statistics.traversal_steps += local_full_statistics.traversal_steps;
+				full_statistics.both_intersected += local_full_statistics.both_intersected;
+				full_statistics.intersections_a += local_full_statistics.intersections_a;
+				full_statistics.intersections_b += local_full_statistics.intersections_b;
+				full_statistics.finalize += local_full_statistics.finalize;
+				int_statistics += local_int_statistics;
 			}
 		}
 
+		auto end = std::chrono::steady_clock::now();
+		printf("(ycpin) Check correctness on %s, %jd rays, %lld ms\n", ray_file.c_str(), total_rays,
+			   static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()));
+
 		std::cout << "  (vanilla)" << std::endl;
 		std::cout << "    traversal_steps: " << full_statistics.traversal_steps << std::endl;
 		std::cout << "    both_intersected: " << full_statistics.both_intersected << std::endl;
@@ -262,16 +345,25 @@ namespace Vulkan::RayTracing
 		std::cout << "    push_cluster: " << int_statistics.push_cluster << std::endl;
 		std::cout << "    recompute_qymax: " << int_statistics.recompute_qymax << std::endl;
 		std::cout << "    traversal_steps: " << int_statistics.traversal_steps << std::endl;
+		std::cout << "    same_line_steps: " << int_statistics.same_line_steps << std::endl;
+		std::cout << "    straddling_node_fetches: " << int_statistics.straddling_node_fetches << std::endl;
+		std::cout << "    straddling_trig_fetches: " << int_statistics.straddling_trig_fetches << std::endl;
 		std::cout << "    both_intersected: " << int_statistics.both_intersected << std::endl;
 		std::cout << "    intersections_a: " << int_statistics.bvh_statistics.intersections_a << std::endl;
 		std::cout << "    intersections_b: " << int_statistics.bvh_statistics.intersections_b << std::endl;
 		std::cout << "    finalize: " << int_statistics.finalize << std::endl;
+		if (trig_quant_bits != 0)
+		{
+			std::cout << "    qtrig_tests: " << int_statistics.qtrig_tests << std::endl;
+			std::cout << "    qtrig_candidates: " << int_statistics.qtrig_candidates << std::endl;
+		}
 
 		std::cout << "  total_rays: " << total_rays << std::endl;
 		std::cout << "  correct_rays: " << correct_rays << std::endl;
 	}
 
-	void BottomLevelAccelerationStructure::create_int_bvh_buffer(CommandPool &commandPool, bvh::Bvh<float> &bvh, int_bvh_v2_t &int_bvh)
+	template <typename int_bvh_T>
+	void BottomLevelAccelerationStructure::create_int_bvh_buffer(CommandPool &commandPool, int_bvh_T &int_bvh)
 	{
 		int_bvh_clusters_Buffer_.reset();
 		int_bvh_clusters_BufferMemory_.reset();
@@ -281,104 +373,135 @@ namespace Vulkan::RayTracing
 		int_bvh_nodes_BufferMemory_.reset();
 		int_bvh_primitive_indices_Buffer_.reset();
 		int_bvh_primitive_indices_BufferMemory_.reset();
+		int_bvh_qtrigs_Buffer_.reset();
+		int_bvh_qtrigs_BufferMemory_.reset();
+
+		// Vulkan buffers cannot be empty, a BLAS without triangles has no int_bvh buffers
+		if (int_bvh.num_trigs == 0)
+			return;
+
+		std::cout << "(ycpin) Size of int_bvh_clusters: " << int_bvh.num_clusters << std::endl;
+		std::cout << "(ycpin) Size of int_bvh_trigs: " << int_bvh.num_trigs << " (" << get_trig_format_name(trig_format) << ", "
+				  << INT_BVH_TRIG_length << " bytes each)" << std::endl;
+		std::cout << "(ycpin) Size of int_bvh_nodes: " << int_bvh.num_nodes << " (" << int_nodes_t<int_bvh_T>::width << "-wide)" << std::endl;
+		std::cout << "(ycpin) Size of int_bvh_primitive_indices: " << int_bvh.num_trigs << std::endl;
+		if (int_bvh.qtrigs)
+			std::cout << "(ycpin) Size of int_bvh_qtrigs: " << int_bvh.num_trigs << " (" << trig_quant_bits << "-bit)" << std::endl;
+
+		upload_int_bvh_buffer(commandPool, int_bvh);
+	}
 
-		constexpr auto flags = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
-							   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	template <typename int_bvh_T>
+	void BottomLevelAccelerationStructure::upload_int_bvh_buffer(CommandPool &commandPool, int_bvh_T &int_bvh)
+	{
+		typedef typename int_nodes_t<int_bvh_T>::type int_node_T;
 
-		// Create buffer for clusters
-		if (int_bvh.clusters)
+		struct section_t
 		{
-			std::cout << "(ycpin) Size of int_bvh_clusters: " << int_bvh.num_clusters << std::endl;
-			std::vector<int_cluster_t> clustersVector;
+			const char *name;
+			VkDeviceSize size;
+			std::unique_ptr<Buffer> &buffer;
+			std::unique_ptr<DeviceMemory> &memory;
+			VkDeviceSize offset;
+		};
+
+		section_t sections[] = {
+			{"int_bvh_clusters", int_bvh.num_clusters * sizeof(int_cluster_t),
+			 int_bvh_clusters_Buffer_, int_bvh_clusters_BufferMemory_, 0},
+			{"int_bvh_trigs", int_bvh.num_trigs * INT_BVH_TRIG_length,
+			 int_bvh_trigs_Buffer_, int_bvh_trigs_BufferMemory_, 0},
+			{"int_bvh_nodes", int_bvh.num_nodes * sizeof(int_node_T),
+			 int_bvh_nodes_Buffer_, int_bvh_nodes_BufferMemory_, 0},
+			{"int_bvh_primitive_indices", int_bvh.num_trigs * sizeof(uint32_t),
+			 int_bvh_primitive_indices_Buffer_, int_bvh_primitive_indices_BufferMemory_, 0},
+			{"int_bvh_qtrigs", int_bvh.qtrigs ? int_bvh.num_trigs * sizeof(int_qtrig_t) : 0,
+			 int_bvh_qtrigs_Buffer_, int_bvh_qtrigs_BufferMemory_, 0}};
+
+		VkDeviceSize stagingSize = 0;
+		for (auto &section : sections)
+		{
+			stagingSize = (stagingSize + INT_BVH_ALIGNMENT - 1) & ~VkDeviceSize{INT_BVH_ALIGNMENT - 1};
+			section.offset = stagingSize;
+			stagingSize += section.size;
+		}
 
-			for (size_t i = 0; i < int_bvh.num_clusters; ++i)
-			{
-				auto &item = int_bvh.clusters[i];
-				clustersVector.emplace_back(item);
-			}
+		const auto &device = commandPool.Device();
+		auto stagingBuffer = std::make_unique<Buffer>(device, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+		auto stagingBufferMemory = stagingBuffer->AllocateMemory(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-			Vulkan::BufferUtil::CreateDeviceBuffer(
-				commandPool,
-				"int_bvh_clusters",
-				flags,
-				clustersVector,
-				int_bvh_clusters_Buffer_,
-				int_bvh_clusters_BufferMemory_);
-		}
+		// the builders keep their host arrays for the CPU traversal and the cache, so this is one more pass
+		// over them: clusters, nodes and qtrigs are copied as is, trig_t and the primitive indices are still
+		// converted element by element, but straight into the staging buffer without temporary vectors
+		const auto data = static_cast<uint8_t *>(stagingBufferMemory.Map(0, stagingSize));
 
-		// Create buffer for trigs
-		if (int_bvh.trigs)
-		{
-			std::cout << "(ycpin) Size of int_bvh_trigs: " << trigs.size() << std::endl;
-			std::vector<triangle_t> trigsVector;
+		std::memcpy(data + sections[0].offset, int_bvh.clusters.get(), sections[0].size);
 
-			for (size_t i = 0; i < trigs.size(); ++i)
+		if (int_bvh.xforms)
+		{
+			std::memcpy(data + sections[1].offset, int_bvh.xforms.get(), sections[1].size);
+		}
+		else
+		{
+			const auto triangles = reinterpret_cast<triangle_t *>(data + sections[1].offset);
+			for (size_t i = 0; i < int_bvh.num_trigs; ++i)
 			{
-				auto &item = int_bvh.trigs[i];
-				triangle_t triangle;
-
-				triangle.v[0][0] = item.p0[0];
-				triangle.v[0][1] = item.p0[1];
-				triangle.v[0][2] = item.p0[2];
-				triangle.v[1][0] = item.p1()[0];
-				triangle.v[1][1] = item.p1()[1];
-				triangle.v[1][2] = item.p1()[2];
-				triangle.v[2][0] = item.p2()[0];
-				triangle.v[2][1] = item.p2()[1];
-				triangle.v[2][2] = item.p2()[2];
-
-				trigsVector.emplace_back(triangle);
+				const trig_t &trig = int_bvh.trigs[i];
+				const vector_t p1 = trig.p1();
+				const vector_t p2 = trig.p2();
+				for (int j = 0; j < 3; j++)
+				{
+					triangles[i].v[0][j] = trig.p0[j];
+					triangles[i].v[1][j] = p1[j];
+					triangles[i].v[2][j] = p2[j];
+				}
 			}
-
-			Vulkan::BufferUtil::CreateDeviceBuffer(
-				commandPool,
-				"int_bvh_trigs",
-				flags,
-				trigsVector,
-				int_bvh_trigs_Buffer_,
-				int_bvh_trigs_BufferMemory_);
 		}
 
-		// Create buffer for nodes
-		if (int_bvh.nodes_v2)
+		std::memcpy(data + sections[2].offset, int_nodes_t<int_bvh_T>::get(int_bvh), sections[2].size);
+
+		const auto primitiveIndices = reinterpret_cast<uint32_t *>(data + sections[3].offset);
+		for (size_t i = 0; i < int_bvh.num_trigs; ++i)
+			primitiveIndices[i] = static_cast<uint32_t>(int_bvh.primitive_indices[i]);
+
+		if (sections[4].size != 0)
+			std::memcpy(data + sections[4].offset, int_bvh.qtrigs.get(), sections[4].size);
+
+		stagingBufferMemory.Unmap();
+
+		const auto &debugUtils = device.DebugUtils();
+		constexpr auto flags = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+							   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+		for (auto &section : sections)
 		{
-			std::cout << "(ycpin) Size of int_bvh_nodes: " << bvh.node_count << std::endl;
-			std::vector<int_node_v2_t> nodesVector;
+			if (section.size == 0)
+				continue;
 
-			for (size_t i = 0; i < bvh.node_count; ++i)
-			{
-				auto &item = int_bvh.nodes_v2[i];
-				nodesVector.emplace_back(item);
-			}
+			printf("RTV: Creating device buffer %s of size %ld\n", section.name, section.size);
+			section.buffer.reset(new Buffer(device, section.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | flags));
+			section.memory.reset(new DeviceMemory(section.buffer->AllocateMemory(VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)));
 
-			Vulkan::BufferUtil::CreateDeviceBuffer(
-				commandPool,
-				"int_bvh_nodes",
-				flags,
-				nodesVector,
-				int_bvh_nodes_Buffer_,
-				int_bvh_nodes_BufferMemory_);
+			debugUtils.SetObjectName(section.buffer->Handle(), (section.name + std::string(" Buffer")).c_str());
+			debugUtils.SetObjectName(section.memory->Handle(), (section.name + std::string(" Memory")).c_str());
 		}
 
-		// Create buffer for primitive indices
-		if (int_bvh.primitive_indices)
+		// one transfer for all arrays
+		SingleTimeCommands::Submit(commandPool, [&](VkCommandBuffer commandBuffer)
+								   {
+		for (const auto &section : sections)
 		{
-			std::cout << "(ycpin) Size of int_bvh_primitive_indices: " << trigs.size() << std::endl;
-			std::vector<uint32_t> primitiveIndicesVector;
+			if (section.size == 0)
+				continue;
 
-			for (size_t i = 0; i < trigs.size(); ++i)
-			{
-				auto &item = int_bvh.primitive_indices[i];
-				primitiveIndicesVector.emplace_back((uint32_t)item);
-			}
+			VkBufferCopy copyRegion = {};
+			copyRegion.srcOffset = section.offset;
+			copyRegion.dstOffset = 0;
+			copyRegion.size = section.size;
 
-			Vulkan::BufferUtil::CreateDeviceBuffer(
-				commandPool,
-				"int_bvh_primitive_indices",
-				flags,
-				primitiveIndicesVector,
-				int_bvh_primitive_indices_Buffer_,
-				int_bvh_primitive_indices_BufferMemory_);
-		}
+			vkCmdCopyBuffer(commandBuffer, stagingBuffer->Handle(), section.buffer->Handle(), 1, &copyRegion);
+		} });
+
+		// Delete the buffer before the memory
+		stagingBuffer.reset();
 	}
 }
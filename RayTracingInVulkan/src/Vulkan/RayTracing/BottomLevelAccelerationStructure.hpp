@@ -46,18 +46,37 @@ namespace Vulkan::RayTracing
 			size_t geometry_id);
 
 		void retrieve_triangles();
-		void check_correctness(bvh::Bvh<float> &bvh, int_bvh_t &int_bvh);
-		void check_correctness_v2(bvh::Bvh<float> &bvh, int_bvh_v2_t &int_bvh_v2);
-		void create_int_bvh_buffer(CommandPool &commandPool, bvh::Bvh<float> &bvh, int_bvh_v2_t &int_bvh);
+		// Compares the int_bvh against the float BVH it was built from on the rays of get_ray_file, in parallel
+		// with per-thread statistics, and prints the statistics of both. Skipped if the ray file is empty.
+		template <typename int_bvh_T>
+		void check_correctness(bvh::Bvh<float> &bvh, int_bvh_T &int_bvh);
+		template <typename int_bvh_T>
+		void create_int_bvh_buffer(CommandPool &commandPool, int_bvh_T &int_bvh);
+
+		// device addresses and sizes of the int_bvh buffers for the BLAS table, zero without triangles
+		int_blas_t get_int_blas() const;
+		// object space bounds of the int_bvh, empty without triangles
+		bbox_t get_int_bvh_bbox() const;
 
 		const Vulkan::Buffer &int_bvh_ClustersBuffer() const { return *int_bvh_clusters_Buffer_; }
 		const Vulkan::Buffer &int_bvh_TrigsBuffer() const { return *int_bvh_trigs_Buffer_; }
 		const Vulkan::Buffer &int_bvh_NodeBuffer() const { return *int_bvh_nodes_Buffer_; }
 		const Vulkan::Buffer &int_bvh_PrimitiveIndicesBuffer() const { return *int_bvh_primitive_indices_Buffer_; }
+		const Vulkan::Buffer &int_bvh_QTrigsBuffer() const { return *int_bvh_qtrigs_Buffer_; }
 
 	private:
+		// converts every int_bvh array from its host layout into one mapped staging buffer and copies them
+		// into new device buffers with a single transfer
+		template <typename int_bvh_T>
+		void upload_int_bvh_buffer(CommandPool &commandPool, int_bvh_T &int_bvh);
+
 		BottomLevelGeometry geometries_;
 		std::vector<trig_t> trigs;
+#if INT_BVH_WIDTH == 2
+		int_bvh_v2_t int_bvh_;
+#else
+		int_bvh_wide_t<INT_BVH_WIDTH> int_bvh_;
+#endif
 
 		// Declare buffer & device memory for INT BVH
 		std::unique_ptr<Buffer> int_bvh_clusters_Buffer_;
@@ -68,5 +87,7 @@ namespace Vulkan::RayTracing
 		std::unique_ptr<DeviceMemory> int_bvh_nodes_BufferMemory_;
 		std::unique_ptr<Buffer> int_bvh_primitive_indices_Buffer_;
 		std::unique_ptr<DeviceMemory> int_bvh_primitive_indices_BufferMemory_;
+		std::unique_ptr<Buffer> int_bvh_qtrigs_Buffer_;
+		std::unique_ptr<DeviceMemory> int_bvh_qtrigs_BufferMemory_;
 	};
 }
@@ -31,7 +31,7 @@ namespace Vulkan::RayTracing
 	{
 		// Create descriptor pool/sets.
 		const auto &device = swapChain.Device();
-		const std::vector<DescriptorBinding> descriptorBindings =
+		std::vector<DescriptorBinding> descriptorBindings =
 			{
 				// Top level acceleration structure.
 				{0, 1, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
@@ -73,10 +73,26 @@ namespace Vulkan::RayTracing
 				// int_bvh_primitive_indices buffer
 				{15, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
 
+				// int_bvh_blas_table buffer
+				{16, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+
+				// int_tlas_cluster buffer
+				{17, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+
+				// int_tlas_nodes buffer
+				{18, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+
+				// int_tlas_instances buffer
+				{19, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+
 				// Mandelbulb Procedural buffer.
 				// {12, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR}
 			};
 
+		// int_bvh_qtrigs buffer, only built with quantized triangles
+		if (trig_quant_bits != 0)
+			descriptorBindings.push_back({20, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR});
+
 		descriptorSetManager_.reset(new DescriptorSetManager(device, descriptorBindings, uniformBuffers.size()));
 
 		auto &descriptorSets = descriptorSetManager_->DescriptorSets();
@@ -208,6 +224,39 @@ namespace Vulkan::RayTracing
 			int_bvh_primitive_indices_Buffer.range = VK_WHOLE_SIZE;
 			descriptorWrites.push_back(descriptorSets.Bind(i, 15, int_bvh_primitive_indices_Buffer));
 
+			// bvh_blas_table buffer
+			VkDescriptorBufferInfo int_bvh_blas_table_Buffer = {};
+			int_bvh_blas_table_Buffer.buffer = accelerationStructure.int_bvh_BlasTableBuffer().Handle();
+			int_bvh_blas_table_Buffer.range = VK_WHOLE_SIZE;
+			descriptorWrites.push_back(descriptorSets.Bind(i, 16, int_bvh_blas_table_Buffer));
+
+			// tlas_cluster buffer
+			VkDescriptorBufferInfo int_tlas_cluster_Buffer = {};
+			int_tlas_cluster_Buffer.buffer = accelerationStructure.int_tlas_ClusterBuffer().Handle();
+			int_tlas_cluster_Buffer.range = VK_WHOLE_SIZE;
+			descriptorWrites.push_back(descriptorSets.Bind(i, 17, int_tlas_cluster_Buffer));
+
+			// tlas_nodes buffer
+			VkDescriptorBufferInfo int_tlas_nodes_Buffer = {};
+			int_tlas_nodes_Buffer.buffer = accelerationStructure.int_tlas_NodeBuffer().Handle();
+			int_tlas_nodes_Buffer.range = VK_WHOLE_SIZE;
+			descriptorWrites.push_back(descriptorSets.Bind(i, 18, int_tlas_nodes_Buffer));
+
+			// tlas_instances buffer
+			VkDescriptorBufferInfo int_tlas_instances_Buffer = {};
+			int_tlas_instances_Buffer.buffer = accelerationStructure.int_tlas_InstancesBuffer().Handle();
+			int_tlas_instances_Buffer.range = VK_WHOLE_SIZE;
+			descriptorWrites.push_back(descriptorSets.Bind(i, 19, int_tlas_instances_Buffer));
+
+			// bvh_qtrigs buffer
+			VkDescriptorBufferInfo int_bvh_qtrigs_Buffer = {};
+			if (trig_quant_bits != 0)
+			{
+				int_bvh_qtrigs_Buffer.buffer = bottomAccelerationStructure.int_bvh_QTrigsBuffer().Handle();
+				int_bvh_qtrigs_Buffer.range = VK_WHOLE_SIZE;
+				descriptorWrites.push_back(descriptorSets.Bind(i, 20, int_bvh_qtrigs_Buffer));
+			}
+
 			// Procedural Mandelbulb buffer (optional)
 			// VkDescriptorBufferInfo proceduralMandelbulbBufferInfo = {};
 
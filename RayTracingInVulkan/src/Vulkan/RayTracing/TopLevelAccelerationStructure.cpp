@@ -3,6 +3,7 @@
 #include "DeviceProcedures.hpp"
 #include "Utilities/Exception.hpp"
 #include "Vulkan/Buffer.hpp"
+#include "Vulkan/BufferUtil.hpp"
 #include "Vulkan/Device.hpp"
 #include <cstring>
 
@@ -40,7 +41,15 @@ TopLevelAccelerationStructure::TopLevelAccelerationStructure(
 
 TopLevelAccelerationStructure::TopLevelAccelerationStructure(TopLevelAccelerationStructure&& other) noexcept :
 	AccelerationStructure(std::move(other)),
-	instancesCount_(other.instancesCount_)
+	instancesCount_(other.instancesCount_),
+	int_bvh_blas_table_Buffer_(std::move(other.int_bvh_blas_table_Buffer_)),
+	int_bvh_blas_table_BufferMemory_(std::move(other.int_bvh_blas_table_BufferMemory_)),
+	int_tlas_cluster_Buffer_(std::move(other.int_tlas_cluster_Buffer_)),
+	int_tlas_cluster_BufferMemory_(std::move(other.int_tlas_cluster_BufferMemory_)),
+	int_tlas_nodes_Buffer_(std::move(other.int_tlas_nodes_Buffer_)),
+	int_tlas_nodes_BufferMemory_(std::move(other.int_tlas_nodes_BufferMemory_)),
+	int_tlas_instances_Buffer_(std::move(other.int_tlas_instances_Buffer_)),
+	int_tlas_instances_BufferMemory_(std::move(other.int_tlas_instances_BufferMemory_))
 {
 }
 
@@ -94,12 +103,92 @@ VkAccelerationStructureInstanceKHR TopLevelAccelerationStructure::CreateInstance
 	instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR; // Disable culling - more fine control could be provided by the application
 	instance.accelerationStructureReference = address;
 
-	// The instance.transform value only contains 12 values, corresponding to a 4x3 matrix,
+	// The instance.transform value only contains 12 values, corresponding to a 3x4 matrix,
 	// hence saving the last row that is anyway always (0,0,0,1).
-	// Since the matrix is row-major, we simply copy the first 12 values of the original 4x4 matrix
-	std::memcpy(&instance.transform, &transform, sizeof(instance.transform));
+	// VkTransformMatrixKHR is row-major while glm is column-major, so copy the first 12 values of the transpose
+	const glm::mat4 rowMajorTransform = glm::transpose(transform);
+	std::memcpy(&instance.transform, &rowMajorTransform, sizeof(instance.transform));
 
 	return instance;
 }
 
+void TopLevelAccelerationStructure::create_int_tlas_buffer(
+	CommandPool& commandPool,
+	const std::vector<BottomLevelAccelerationStructure>& bottomAs,
+	const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+	const std::vector<uint32_t>& blasIndices)
+{
+	int_bvh_blas_table_Buffer_.reset();
+	int_bvh_blas_table_BufferMemory_.reset();
+	int_tlas_cluster_Buffer_.reset();
+	int_tlas_cluster_BufferMemory_.reset();
+	int_tlas_nodes_Buffer_.reset();
+	int_tlas_nodes_BufferMemory_.reset();
+	int_tlas_instances_Buffer_.reset();
+	int_tlas_instances_BufferMemory_.reset();
+
+	std::vector<int_blas_t> blasTable;
+	std::vector<bbox_t> blasBboxes;
+	for (const auto& blas : bottomAs)
+	{
+		blasTable.push_back(blas.get_int_blas());
+		blasBboxes.push_back(blas.get_int_bvh_bbox());
+	}
+
+	std::vector<int_instance_t> intInstances;
+	for (size_t i = 0; i != instances.size(); ++i)
+	{
+		const auto& instance = instances[i];
+		if (blasTable[blasIndices[i]].num_trigs == 0)
+			continue;
+
+		int_instance_t intInstance = {};
+		std::memcpy(intInstance.object_to_world, &instance.transform, sizeof(intInstance.object_to_world));
+
+		glm::mat4 objectToWorld(1);
+		for (int row = 0; row < 3; row++)
+			for (int col = 0; col < 4; col++)
+				objectToWorld[col][row] = instance.transform.matrix[row][col];
+		const glm::mat4 worldToObject = glm::inverse(objectToWorld);
+		for (int row = 0; row < 3; row++)
+			for (int col = 0; col < 4; col++)
+				intInstance.world_to_object[row][col] = worldToObject[col][row];
+
+		intInstance.blas_idx = blasIndices[i];
+		intInstance.instance_idx = static_cast<uint32_t>(i);
+		intInstance.custom_index_mask = instance.instanceCustomIndex | (static_cast<uint32_t>(instance.mask) << 24);
+		intInstance.sbt_offset = instance.instanceShaderBindingTableRecordOffset;
+		intInstances.push_back(intInstance);
+	}
+
+	int_tlas_t int_tlas = build_int_tlas(intInstances, blasBboxes);
+
+	// Vulkan buffers cannot be empty, a TLAS without instances keeps one node with EMPTY children
+	std::vector<int_node_wide_t<INT_BVH_WIDTH>> nodesVector(int_tlas.nodes.get(), int_tlas.nodes.get() + int_tlas.num_nodes);
+	if (nodesVector.empty())
+	{
+		nodesVector.emplace_back();
+		for (auto& child : nodesVector.back().children)
+			child.data = empty_child_data;
+	}
+	if (int_tlas.instances.empty())
+		int_tlas.instances.emplace_back();
+	std::vector<int_cluster_t> clusterVector = {int_tlas.cluster};
+
+	constexpr auto flags = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+						   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	std::cout << "(ycpin) Size of int_bvh_blas_table: " << blasTable.size() << std::endl;
+	Vulkan::BufferUtil::CreateDeviceBuffer(commandPool, "int_bvh_blas_table", flags, blasTable,
+										   int_bvh_blas_table_Buffer_, int_bvh_blas_table_BufferMemory_);
+	Vulkan::BufferUtil::CreateDeviceBuffer(commandPool, "int_tlas_cluster", flags, clusterVector,
+										   int_tlas_cluster_Buffer_, int_tlas_cluster_BufferMemory_);
+	std::cout << "(ycpin) Size of int_tlas_nodes: " << nodesVector.size() << std::endl;
+	Vulkan::BufferUtil::CreateDeviceBuffer(commandPool, "int_tlas_nodes", flags, nodesVector,
+										   int_tlas_nodes_Buffer_, int_tlas_nodes_BufferMemory_);
+	std::cout << "(ycpin) Size of int_tlas_instances: " << int_tlas.instances.size() << std::endl;
+	Vulkan::BufferUtil::CreateDeviceBuffer(commandPool, "int_tlas_instances", flags, int_tlas.instances,
+										   int_tlas_instances_Buffer_, int_tlas_instances_BufferMemory_);
+}
+
 }
@@ -4,6 +4,13 @@
 #include "Utilities/Glm.hpp"
 #include <vector>
 
+#include "build.hpp"
+
+namespace Vulkan
+{
+	class CommandPool;
+}
+
 namespace Vulkan::RayTracing
 {
 	class BottomLevelAccelerationStructure;
@@ -37,11 +44,34 @@ namespace Vulkan::RayTracing
 			uint32_t instanceId,
 			uint32_t hitGroupId);
 
+		// Builds the INT TLAS over the instances (instance i uses bottomAs[blasIndices[i]]) and the BLAS table
+		// with the int_bvh buffer addresses of every BLAS. Instances of BLASes without triangles are left out.
+		void create_int_tlas_buffer(
+			CommandPool& commandPool,
+			const std::vector<BottomLevelAccelerationStructure>& bottomAs,
+			const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+			const std::vector<uint32_t>& blasIndices);
+
+		const Vulkan::Buffer& int_bvh_BlasTableBuffer() const { return *int_bvh_blas_table_Buffer_; }
+		const Vulkan::Buffer& int_tlas_ClusterBuffer() const { return *int_tlas_cluster_Buffer_; }
+		const Vulkan::Buffer& int_tlas_NodeBuffer() const { return *int_tlas_nodes_Buffer_; }
+		const Vulkan::Buffer& int_tlas_InstancesBuffer() const { return *int_tlas_instances_Buffer_; }
+
 	private:
 
 		uint32_t instancesCount_;
 		VkAccelerationStructureGeometryInstancesDataKHR instancesVk_{};
 		VkAccelerationStructureGeometryKHR topASGeometry_{};
+
+		// Declare buffer & device memory for INT TLAS
+		std::unique_ptr<Buffer> int_bvh_blas_table_Buffer_;
+		std::unique_ptr<DeviceMemory> int_bvh_blas_table_BufferMemory_;
+		std::unique_ptr<Buffer> int_tlas_cluster_Buffer_;
+		std::unique_ptr<DeviceMemory> int_tlas_cluster_BufferMemory_;
+		std::unique_ptr<Buffer> int_tlas_nodes_Buffer_;
+		std::unique_ptr<DeviceMemory> int_tlas_nodes_BufferMemory_;
+		std::unique_ptr<Buffer> int_tlas_instances_Buffer_;
+		std::unique_ptr<DeviceMemory> int_tlas_instances_BufferMemory_;
 	};
 
 }
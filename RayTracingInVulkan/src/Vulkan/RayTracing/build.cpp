@@ -22,10 +22,39 @@ namespace bvh_quantize
         return (int)ceilf(x);
     }
 
+    int_dist_t floor_to_int_dist(int_dist_float_t x)
+    {
+        assert(!std::isnan(x));
+        if (quant_bits <= 8)
+            return floor_to_int32(x);
+
+        if (x < static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::min()))
+            return std::numeric_limits<int_dist_t>::min();
+        if (x >= static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::max()))
+            return std::numeric_limits<int_dist_t>::max();
+        return static_cast<int_dist_t>(std::floor(x));
+    }
+
+    int_dist_t ceil_to_int_dist(int_dist_float_t x)
+    {
+        assert(!std::isnan(x));
+        if (quant_bits <= 8)
+            return ceil_to_int32(x);
+
+        if (x < static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::min()))
+            return std::numeric_limits<int_dist_t>::min();
+        if (x >= static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::max()))
+            return std::numeric_limits<int_dist_t>::max();
+        return static_cast<int_dist_t>(std::ceil(x));
+    }
+
     float get_scaling_factor(const bvh_t &bvh, size_t ref_idx)
     {
-        bbox_t ref_bbox = bvh.nodes[ref_idx].bounding_box_proxy().to_bounding_box();
+        return get_scaling_factor(bvh.nodes[ref_idx].bounding_box_proxy().to_bounding_box());
+    }
 
+    float get_scaling_factor(const bbox_t &ref_bbox)
+    {
         float max_len = 0.0f;
         for (int i = 0; i < 3; i++)
             max_len = std::max(max_len, ref_bbox.max[i] - ref_bbox.min[i]);
@@ -36,12 +65,15 @@ namespace bvh_quantize
     }
 
     // return: [qxmin, qxmax, qymin, qymax, qzmin, qzmax]
-    std::array<uint8_t, 6> get_int_bounds(const bvh_t &bvh, size_t node_idx, size_t ref_idx, float scaling_factor)
+    int_bounds_t get_int_bounds(const bvh_t &bvh, size_t node_idx, size_t ref_idx, float scaling_factor)
     {
-        bbox_t node_bbox = bvh.nodes[node_idx].bounding_box_proxy().to_bounding_box();
-        bbox_t ref_bbox = bvh.nodes[ref_idx].bounding_box_proxy().to_bounding_box();
+        return get_int_bounds(bvh.nodes[node_idx].bounding_box_proxy().to_bounding_box(),
+                              bvh.nodes[ref_idx].bounding_box_proxy().to_bounding_box(), scaling_factor);
+    }
 
-        std::array<uint8_t, 6> ret{};
+    int_bounds_t get_int_bounds(const bbox_t &node_bbox, const bbox_t &ref_bbox, float scaling_factor)
+    {
+        int_bounds_t ret{};
         for (int i = 0; i < 3; i++)
         {
             int min = floor_to_int32((node_bbox.min[i] - ref_bbox.min[i]) / scaling_factor);
@@ -62,7 +94,7 @@ namespace bvh_quantize
     bbox_t get_quant_bbox(const bvh_t &bvh, size_t node_idx, size_t ref_idx, float scaling_factor)
     {
         bbox_t ref_bbox = bvh.nodes[ref_idx].bounding_box_proxy().to_bounding_box();
-        std::array<uint8_t, 6> int_bounds = get_int_bounds(bvh, node_idx, ref_idx, scaling_factor);
+        int_bounds_t int_bounds = get_int_bounds(bvh, node_idx, ref_idx, scaling_factor);
 
         bbox_t ret;
         for (int i = 0; i < 3; i++)
@@ -103,7 +135,80 @@ namespace bvh_quantize
         return arg;
     }
 
-    bvh_t build_bvh(const std::vector<trig_t> &trigs)
+    const char *get_builder_name(builder_type_t builder_type)
+    {
+        switch (builder_type)
+        {
+        case builder_type_t::SWEEP_SAH:
+            return "sweep_sah";
+        case builder_type_t::BINNED_SAH:
+            return "binned_sah";
+        case builder_type_t::PLOC:
+            return "ploc";
+        case builder_type_t::LBVH:
+            return "lbvh";
+        case builder_type_t::SBVH:
+            return "sbvh";
+        case builder_type_t::PRESPLIT:
+            return "presplit";
+        default:
+            assert(false);
+            return "";
+        }
+    }
+
+    const char *get_node_order_name(node_order_t order)
+    {
+        switch (order)
+        {
+        case node_order_t::HEAT:
+            return "heat";
+        case node_order_t::DFS:
+            return "dfs";
+        case node_order_t::VEB:
+            return "veb";
+        default:
+            assert(false);
+            return "";
+        }
+    }
+
+    const char *get_trig_format_name(trig_format_t format)
+    {
+        switch (format)
+        {
+        case trig_format_t::VERTICES:
+            return "vertices";
+        case trig_format_t::XFORM:
+            return "xform";
+        default:
+            assert(false);
+            return "";
+        }
+    }
+
+    builder_type_t get_builder_type()
+    {
+        const char *env = std::getenv("INT_BVH_BUILDER");
+        std::string name = env ? env : INT_BVH_STRINGIFY(INT_BVH_BUILDER);
+        for (builder_type_t builder_type : {builder_type_t::SWEEP_SAH, builder_type_t::BINNED_SAH, builder_type_t::PLOC,
+                                            builder_type_t::LBVH, builder_type_t::SBVH, builder_type_t::PRESPLIT})
+        {
+            if (name == get_builder_name(builder_type))
+                return builder_type;
+        }
+
+        std::cerr << "unknown BVH builder " << name << " (sweep_sah, binned_sah, ploc, lbvh, sbvh or presplit)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::string get_ray_file()
+    {
+        const char *env = std::getenv("INT_BVH_RAY_FILE");
+        return env ? env : INT_BVH_RAY_FILE;
+    }
+
+    bvh_t build_bvh(const std::vector<trig_t> &trigs, builder_type_t builder_type)
     {
         auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(trigs.data(), trigs.size());
         auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), trigs.size());
@@ -112,407 +217,1990 @@ namespace bvh_quantize
                   << global_bbox.max[0] << ", " << global_bbox.max[1] << ", " << global_bbox.max[2] << ")" << std::endl;
 
         // Building the BVH tree
+        auto start = std::chrono::steady_clock::now();
         bvh_t bvh;
-        builder_t builder(bvh);
-        builder.max_leaf_size = max_trig_in_leaf_size;
-        builder.build(global_bbox, bboxes.get(), centers.get(), trigs.size());
+        switch (builder_type)
+        {
+        case builder_type_t::SWEEP_SAH:
+        {
+            builder_t builder(bvh);
+            builder.max_leaf_size = max_trig_in_leaf_size;
+            builder.build(global_bbox, bboxes.get(), centers.get(), trigs.size());
+            break;
+        }
+        case builder_type_t::BINNED_SAH:
+        {
+            binned_sah_builder_t builder(bvh);
+            builder.max_leaf_size = max_trig_in_leaf_size;
+            builder.build(global_bbox, bboxes.get(), centers.get(), trigs.size());
+            break;
+        }
+        case builder_type_t::PLOC:
+        {
+            ploc_builder_t builder(bvh);
+            builder.build(global_bbox, bboxes.get(), centers.get(), trigs.size());
+            break;
+        }
+        case builder_type_t::LBVH:
+        {
+            lbvh_builder_t builder(bvh);
+            builder.build(global_bbox, bboxes.get(), centers.get(), trigs.size());
+            break;
+        }
+        case builder_type_t::SBVH:
+        {
+            sbvh_builder_t builder(bvh);
+            builder.max_leaf_size = max_trig_in_leaf_size;
+            size_t reference_count = builder.build(global_bbox, trigs.data(), bboxes.get(), centers.get(), trigs.size());
+            std::cout << "references = " << reference_count << " (" << trigs.size() << " triangles)" << std::endl;
+            break;
+        }
+        case builder_type_t::PRESPLIT:
+        {
+            primitive_splitter_t splitter;
+            auto [reference_count, split_bboxes, split_centers] = splitter.split(global_bbox, trigs.data(), trigs.size());
+            builder_t builder(bvh);
+            builder.max_leaf_size = max_trig_in_leaf_size;
+            builder.build(global_bbox, split_bboxes.get(), split_centers.get(), reference_count);
+            // maps references back to triangles, a leaf keeps one reference per triangle
+            splitter.repair_bvh_leaves(bvh);
+            std::cout << "references = " << reference_count << " (" << trigs.size() << " triangles)" << std::endl;
+            break;
+        }
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "builder = " << get_builder_name(builder_type) << ", " << elapsed.count() << " ms" << std::endl;
 
         return bvh;
     }
 
-    std::vector<policy_t> get_policy(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh)
+    // Solves the STAY/SWITCH cost table bottom-up. A node is evaluated as soon as both of
+    // its children are done, so independent subtrees are solved concurrently.
+    // With max_ref_depth != 0, only the closest max_ref_depth ancestors are candidate reference
+    // nodes, so the table holds at most node_count * max_ref_depth entries instead of
+    // node_count * depth, and a cluster never spans more than max_ref_depth levels.
+    // Nodes set in forced_switches never STAY, see limit_cluster_bytes.
+    class policy_solver_t : public bvh::BottomUpAlgorithm<const bvh_t>
     {
-        // stk_1: fill t_buf_size, t_buf_idx_map
-        int t_buf_size = 0;
-        std::vector<int> t_buf_idx_map(bvh.node_count);
-        std::stack<std::pair<size_t, int>> stk_1;
-        node_t &root_node = bvh.nodes[0];
-        size_t root_left_node_idx = root_node.first_child_or_primitive;
-        size_t root_right_node_idx = root_left_node_idx + 1;
-        stk_1.emplace(root_right_node_idx, 1);
-        stk_1.emplace(root_left_node_idx, 1);
-        while (!stk_1.empty())
-        {
-            auto [curr_node_idx, depth] = stk_1.top();
-            node_t &curr_node = bvh.nodes[curr_node_idx];
-            stk_1.pop();
+        using BottomUpAlgorithm<const bvh_t>::bvh;
+        using BottomUpAlgorithm<const bvh_t>::parents;
+        using BottomUpAlgorithm<const bvh_t>::traverse_in_parallel;
 
-            t_buf_idx_map[curr_node_idx] = t_buf_size;
-            t_buf_size += depth;
+        float t_trv_int;
+        float t_switch;
+        float t_ist;
+        size_t max_ref_depth;
+        const std::vector<bool> *forced_switches;
+        size_t peak_bytes = 0;
 
-            if (!curr_node.is_leaf())
-            {
-                size_t left_node_idx = curr_node.first_child_or_primitive;
-                size_t right_node_idx = left_node_idx + 1;
-                stk_1.emplace(right_node_idx, depth + 1);
-                stk_1.emplace(left_node_idx, depth + 1);
-            }
+        std::vector<float> scaling_factors;
+        std::vector<size_t> t_buf_idx_map;
+        std::vector<float> t_buf;
+        std::vector<policy_t> t_policy;
+
+        // t_buf[t_buf_idx_map[node_idx] + i] is the cost of the subtree rooted at node_idx
+        // when its reference node is its (i + 1)-th ancestor
+        size_t window_size(size_t depth) const
+        {
+            return max_ref_depth == unbounded_ref_depth ? depth : std::min(depth, max_ref_depth);
         }
 
-        // stk_2: fill parent, t_buf, t_policy
-        std::vector<size_t> parent(bvh.node_count);
-        parent[root_left_node_idx] = 0;
-        parent[root_right_node_idx] = 0;
-        std::vector<float> t_buf(t_buf_size);
-        std::vector<policy_t> t_policy(t_buf_size);
-        std::stack<std::pair<size_t, bool>> stk_2;
-        stk_2.emplace(root_right_node_idx, true);
-        stk_2.emplace(root_left_node_idx, true);
-        while (!stk_2.empty())
+        void solve_node(size_t curr_node_idx)
         {
-            auto [curr_node_idx, first] = stk_2.top();
-            node_t &curr_node = bvh.nodes[curr_node_idx];
-            stk_2.pop();
+            if (curr_node_idx == 0)
+                return;
 
+            const node_t &curr_node = bvh.nodes[curr_node_idx];
             size_t left_node_idx = curr_node.first_child_or_primitive;
             size_t right_node_idx = left_node_idx + 1;
 
-            if (first)
+            size_t ref_idx = parents[curr_node_idx];
+            size_t window = t_buf_idx_map[curr_node_idx + 1] - t_buf_idx_map[curr_node_idx];
+            for (size_t i = 0; i < window; i++)
             {
-                stk_2.emplace(curr_node_idx, false);
-                if (!curr_node.is_leaf())
+                bbox_t quant_bbox = get_quant_bbox(bvh, curr_node_idx, ref_idx, scaling_factors[ref_idx]);
+                float half_area = quant_bbox.half_area();
+
+                float &curr_t_buf = t_buf[t_buf_idx_map[curr_node_idx] + i];
+                policy_t &curr_t_policy = t_policy[t_buf_idx_map[curr_node_idx] + i];
+                if (curr_node.is_leaf())
                 {
-                    stk_2.emplace(right_node_idx, true);
-                    stk_2.emplace(left_node_idx, true);
-                    parent[left_node_idx] = curr_node_idx;
-                    parent[right_node_idx] = curr_node_idx;
+                    curr_t_buf = t_ist * (float)curr_node.primitive_count * half_area;
                 }
-            }
-            else
-            {
-                size_t ref_idx = parent[curr_node_idx];
-                for (int i = 0;; i++)
+                else
                 {
-                    float scaling_factor = get_scaling_factor(bvh, ref_idx);
-                    bbox_t quant_bbox = get_quant_bbox(bvh, curr_node_idx, ref_idx, scaling_factor);
-                    float half_area = quant_bbox.half_area();
+                    float left_switch_t = t_buf[t_buf_idx_map[left_node_idx]];
+                    float right_switch_t = t_buf[t_buf_idx_map[right_node_idx]];
+                    float curr_switch_t = (t_trv_int * 2 + t_switch) * half_area + left_switch_t + right_switch_t;
+                    assert(std::isfinite(curr_switch_t));
 
-                    float &curr_t_buf = t_buf[t_buf_idx_map[curr_node_idx] + i];
-                    policy_t &curr_t_policy = t_policy[t_buf_idx_map[curr_node_idx] + i];
-                    if (curr_node.is_leaf())
-                    {
-                        curr_t_buf = t_ist * (float)curr_node.primitive_count * half_area;
-                    }
-                    else
+                    // staying would move the children's reference node out of their window
+                    bool can_stay = (max_ref_depth == unbounded_ref_depth || i + 1 < max_ref_depth) &&
+                                    !(forced_switches && (*forced_switches)[curr_node_idx]);
+                    float curr_stay_t = std::numeric_limits<float>::infinity();
+                    if (can_stay)
                     {
                         float left_stay_t = t_buf[t_buf_idx_map[left_node_idx] + 1 + i];
                         float right_stay_t = t_buf[t_buf_idx_map[right_node_idx] + 1 + i];
-
-                        float left_switch_t = t_buf[t_buf_idx_map[left_node_idx]];
-                        float right_switch_t = t_buf[t_buf_idx_map[right_node_idx]];
-
-                        float curr_stay_t = t_trv_int * 2 * half_area + left_stay_t + right_stay_t;
-                        float curr_switch_t = (t_trv_int * 2 + t_switch) * half_area + left_switch_t + right_switch_t;
-
+                        curr_stay_t = t_trv_int * 2 * half_area + left_stay_t + right_stay_t;
                         assert(std::isfinite(curr_stay_t));
-                        assert(std::isfinite(curr_switch_t));
-
-                        if (curr_switch_t < curr_stay_t)
-                        {
-                            curr_t_buf = curr_switch_t;
-                            curr_t_policy = policy_t::SWITCH;
-                        }
-                        else
-                        {
-                            curr_t_buf = curr_stay_t;
-                            curr_t_policy = policy_t::STAY;
-                        }
                     }
 
-                    if (ref_idx == 0)
-                        break;
+                    if (curr_switch_t < curr_stay_t)
+                    {
+                        curr_t_buf = curr_switch_t;
+                        curr_t_policy = policy_t::SWITCH;
+                    }
                     else
-                        ref_idx = parent[ref_idx];
+                    {
+                        curr_t_buf = curr_stay_t;
+                        curr_t_policy = policy_t::STAY;
+                    }
                 }
+
+                ref_idx = parents[ref_idx];
             }
         }
 
-        // stk_3: fill policy
-        std::vector<policy_t> policy(bvh.node_count);
-        std::stack<std::pair<size_t, int>> stk_3;
-        policy[0] = policy_t::SWITCH;
-        stk_3.emplace(root_right_node_idx, 0);
-        stk_3.emplace(root_left_node_idx, 0);
-        while (!stk_3.empty())
+    public:
+        policy_solver_t(const bvh_t &bvh, float t_trv_int, float t_switch, float t_ist, size_t max_ref_depth,
+                        const std::vector<bool> *forced_switches = nullptr)
+            : BottomUpAlgorithm<const bvh_t>(bvh), t_trv_int(t_trv_int), t_switch(t_switch), t_ist(t_ist),
+              max_ref_depth(max_ref_depth), forced_switches(forced_switches)
         {
-            auto [curr_node_idx, curr_offset] = stk_3.top();
-            node_t &curr_node = bvh.nodes[curr_node_idx];
-            stk_3.pop();
+        }
 
-            if (curr_node.is_leaf())
-                continue;
+        // peak number of bytes held by the solver during the last call to solve()
+        size_t get_peak_bytes() const { return peak_bytes; }
 
-            size_t left_node_idx = curr_node.first_child_or_primitive;
-            size_t right_node_idx = left_node_idx + 1;
+        // cost of the whole tree under the policy of the last call to solve(), relative to the
+        // surface area of the root (which is fetched as a SWITCH into the root cluster)
+        float get_cost() const
+        {
+            const node_t &root = bvh.nodes[0];
+            if (root.is_leaf())
+                return t_ist * (float)root.primitive_count;
 
-            switch (t_policy[t_buf_idx_map[curr_node_idx] + curr_offset])
+            size_t left_node_idx = root.first_child_or_primitive;
+            float half_area = root.bounding_box_proxy().half_area();
+            return ((t_trv_int * 2 + t_switch) * half_area + t_buf[t_buf_idx_map[left_node_idx]] +
+                    t_buf[t_buf_idx_map[left_node_idx + 1]]) /
+                   half_area;
+        }
+
+        std::vector<policy_t> solve()
+        {
+            std::vector<policy_t> policy(bvh.node_count);
+            policy[0] = policy_t::SWITCH;
+            if (bvh.nodes[0].is_leaf())
+                return policy;
+
+            // fill t_buf_idx_map: children are always stored after their parent, so a single
+            // forward pass sees the depth of the parent before the depth of its children.
+            // The extra trailing entry gives the window size of the last node.
+            size_t t_buf_size = 0;
+            t_buf_idx_map.resize(bvh.node_count + 1);
             {
-            case policy_t::STAY:
-                policy[curr_node_idx] = policy_t::STAY;
-                stk_3.emplace(right_node_idx, 1 + curr_offset);
-                stk_3.emplace(left_node_idx, 1 + curr_offset);
-                break;
-            case policy_t::SWITCH:
-                policy[curr_node_idx] = policy_t::SWITCH;
-                stk_3.emplace(right_node_idx, 0);
-                stk_3.emplace(left_node_idx, 0);
-                break;
+                std::vector<size_t> depth(bvh.node_count);
+                for (size_t i = 1; i < bvh.node_count; i++)
+                {
+                    assert(parents[i] < i);
+                    depth[i] = depth[parents[i]] + 1;
+                    t_buf_idx_map[i] = t_buf_size;
+                    t_buf_size += window_size(depth[i]);
+                }
+                t_buf_idx_map[bvh.node_count] = t_buf_size;
+            }
+
+            scaling_factors.resize(bvh.node_count);
+            t_buf.resize(t_buf_size);
+            t_policy.resize(t_buf_size);
+
+#pragma omp parallel
+            {
+                // only internal nodes can be reference nodes
+#pragma omp for
+                for (size_t i = 0; i < bvh.node_count; i++)
+                {
+                    if (!bvh.nodes[i].is_leaf())
+                        scaling_factors[i] = get_scaling_factor(bvh, i);
+                }
+
+                traverse_in_parallel(
+                    [&](size_t i)
+                    { solve_node(i); },
+                    [&](size_t i)
+                    { solve_node(i); });
+            }
+
+            // fill policy, again relying on parents being stored before their children
+            std::vector<size_t> offset(bvh.node_count);
+            // everything is still alive at this point: parents and flags of the bottom-up
+            // traversal, the output policy, and the cost table with its index map
+            peak_bytes = bvh.node_count * (sizeof(size_t) + sizeof(int) + sizeof(policy_t)) +
+                         offset.size() * sizeof(size_t) +
+                         t_buf_idx_map.size() * sizeof(size_t) +
+                         scaling_factors.size() * sizeof(float) +
+                         t_buf_size * (sizeof(float) + sizeof(policy_t));
+
+            for (size_t i = 0; i < bvh.node_count; i++)
+            {
+                const node_t &curr_node = bvh.nodes[i];
+                if (curr_node.is_leaf())
+                    continue;
+
+                if (i != 0)
+                    policy[i] = t_policy[t_buf_idx_map[i] + offset[i]];
+
+                size_t left_node_idx = curr_node.first_child_or_primitive;
+                size_t right_node_idx = left_node_idx + 1;
+                size_t child_offset = policy[i] == policy_t::STAY ? offset[i] + 1 : 0;
+                offset[left_node_idx] = child_offset;
+                offset[right_node_idx] = child_offset;
             }
+
+            return policy;
         }
+    };
 
+    std::vector<policy_t> get_policy(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh,
+                                     size_t max_ref_depth)
+    {
+        policy_solver_t solver(bvh, t_trv_int, t_switch, t_ist, max_ref_depth);
+        std::vector<policy_t> policy = solver.solve();
+        std::cout << "policy peak memory = " << solver.get_peak_bytes() << " bytes (max_ref_depth = ";
+        if (max_ref_depth == unbounded_ref_depth)
+            std::cout << "unbounded)" << std::endl;
+        else
+            std::cout << max_ref_depth << ")" << std::endl;
         return policy;
     }
 
-    int_bvh_t build_int_bvh(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
-                            const bvh_t &bvh)
+    static float get_quant_cost(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh, size_t max_ref_depth,
+                                std::vector<policy_t> *policy = nullptr)
     {
-        // arg.t_trv_int    = 0.5
-        // arg.t_switch     = 1
-        // arg.t_ist        = 1
+        policy_solver_t solver(bvh, t_trv_int, t_switch, t_ist, max_ref_depth);
+        std::vector<policy_t> solved_policy = solver.solve();
+        if (policy)
+            *policy = std::move(solved_policy);
+        return solver.get_cost();
+    }
 
-        // fill policy
-        std::vector<policy_t> policy = get_policy(t_trv_int, t_switch, t_ist, bvh);
+    // Copies the tree reachable from the root in breadth-first order, so that parents precede their
+    // children and siblings stay adjacent. Nodes marked in collapse become leaves referencing every
+    // triangle of their subtree (once, even if spatial splits referenced it from several leaves).
+    static bvh_t compact_bvh(const bvh_t &bvh, const std::vector<bool> &collapse)
+    {
+        bvh_t compact;
+        compact.nodes = std::make_unique<node_t[]>(bvh.node_count);
+        compact.node_count = 1;
+        std::vector<size_t> primitive_indices;
 
-        // que: fill num_clusters, cluster_node_indices, ref_indices, local_node_idx_map
-        int num_clusters = 0;
-        std::vector<std::vector<size_t>> cluster_node_indices;
-        std::vector<size_t> ref_indices;
-        std::vector<size_t> local_node_idx_map(bvh.node_count);
-        std::queue<std::pair<size_t, int>> que;
-        que.emplace(0, -1);
+        std::queue<std::pair<size_t, size_t>> que;
+        que.emplace(0, 0);
         while (!que.empty())
         {
-            auto [curr_node_idx, curr_cluster_idx] = que.front();
-            node_t &curr_node = bvh.nodes[curr_node_idx];
+            auto [node_idx, compact_idx] = que.front();
             que.pop();
+            const node_t &node = bvh.nodes[node_idx];
+            node_t &compact_node = compact.nodes[compact_idx];
+            compact_node = node;
 
-            if (curr_node.is_leaf())
+            if (!node.is_leaf() && (collapse.empty() || !collapse[node_idx]))
+            {
+                compact_node.first_child_or_primitive = static_cast<bvh_t::IndexType>(compact.node_count);
+                que.emplace(node.first_child_or_primitive, compact.node_count);
+                que.emplace(node.first_child_or_primitive + 1, compact.node_count + 1);
+                compact.node_count += 2;
                 continue;
+            }
 
-            int child_cluster_idx = -1;
-            switch (policy[curr_node_idx])
+            size_t first_primitive = primitive_indices.size();
+            std::stack<size_t> stk;
+            stk.push(node_idx);
+            while (!stk.empty())
             {
-            case policy_t::STAY: // 留在當前集群
-                child_cluster_idx = curr_cluster_idx;
-                break;
-            case policy_t::SWITCH: // 切換到新集群
-                child_cluster_idx = num_clusters;
-                num_clusters++;
-                cluster_node_indices.emplace_back();
-                ref_indices.push_back(curr_node_idx);
-                break;
+                const node_t &curr_node = bvh.nodes[stk.top()];
+                stk.pop();
+                if (curr_node.is_leaf())
+                {
+                    for (size_t i = 0; i < curr_node.primitive_count; i++)
+                        primitive_indices.push_back(bvh.primitive_indices[curr_node.first_child_or_primitive + i]);
+                }
+                else
+                {
+                    stk.push(curr_node.first_child_or_primitive + 1);
+                    stk.push(curr_node.first_child_or_primitive);
+                }
             }
-
-            // 遍歷所有節點，根據策略 policy 決定當前節點應該留在當前集群 (STAY) 還是切換到新集群 (SWITCH)。
-            // 更新局部索引映射 local_node_idx_map 和集群節點索引 cluster_node_indices。
-            // 如果節點是內部節點，將其子節點加入隊列 que。
-
-            size_t left_node_idx = curr_node.first_child_or_primitive;
-            size_t right_node_idx = left_node_idx + 1;
-            local_node_idx_map[left_node_idx] = cluster_node_indices[child_cluster_idx].size();
-            cluster_node_indices[child_cluster_idx].push_back(left_node_idx);
-            local_node_idx_map[right_node_idx] = cluster_node_indices[child_cluster_idx].size();
-            cluster_node_indices[child_cluster_idx].push_back(right_node_idx);
-
-            que.emplace(left_node_idx, child_cluster_idx);
-            que.emplace(right_node_idx, child_cluster_idx);
+            if (!node.is_leaf())
+            {
+                std::sort(primitive_indices.begin() + first_primitive, primitive_indices.end());
+                primitive_indices.erase(std::unique(primitive_indices.begin() + first_primitive, primitive_indices.end()),
+                                        primitive_indices.end());
+            }
+            compact_node.first_child_or_primitive = static_cast<bvh_t::IndexType>(first_primitive);
+            compact_node.primitive_count = static_cast<bvh_t::IndexType>(primitive_indices.size() - first_primitive);
         }
 
-        // fill cluster_idx_map, scaling_factors
-        std::vector<int> cluster_idx_map(bvh.node_count);
-        std::vector<float> scaling_factors(num_clusters);
-        for (int i = 0; i < num_clusters; i++)
+        compact.primitive_indices = std::make_unique<size_t[]>(primitive_indices.size());
+        std::copy(primitive_indices.begin(), primitive_indices.end(), compact.primitive_indices.get());
+        return compact;
+    }
+
+    // Marks the internal nodes worth turning into leaves (at most max_trig_in_leaf_size triangles),
+    // comparing the quantized costs of the subtree and of the leaf against the node's reference node
+    // under policy. Children precede their parents in the reverse index order.
+    static std::vector<bool> get_collapsed_nodes(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh,
+                                                 const std::vector<policy_t> &policy)
+    {
+        std::vector<size_t> ref_indices(bvh.node_count);
+        std::vector<float> scaling_factors(bvh.node_count);
+        for (size_t i = 0; i < bvh.node_count; i++)
         {
-            for (unsigned int j = 0; j < cluster_node_indices[i].size(); j++)
-                cluster_idx_map[cluster_node_indices[i][j]] = i;
-            scaling_factors[i] = get_scaling_factor(bvh, ref_indices[i]);
+            const node_t &node = bvh.nodes[i];
+            if (node.is_leaf())
+                continue;
 
-            // 初始化 cluster_idx_map 和 scaling_factors。
-            // 對於每個集群，更新節點索引映射 cluster_idx_map 和計算縮放因子 scaling_factors。
+            scaling_factors[i] = get_scaling_factor(bvh, i);
+            for (size_t j = 0; j < 2; j++)
+                ref_indices[node.first_child_or_primitive + j] = policy[i] == policy_t::SWITCH ? i : ref_indices[i];
         }
 
-        // fill int_bvh, local_trig_idx_map
-        int_bvh_t int_bvh;
-        int_bvh.num_clusters = num_clusters;
-        int_bvh.clusters = std::make_unique<int_cluster_t[]>(num_clusters);
-        int_bvh.trigs = std::make_unique<trig_t[]>(trigs.size());
-        int_bvh.nodes = std::make_unique<int_node_t[]>(bvh.node_count);
-        int_bvh.nodes_v2 = std::make_unique<int_node_v2_t[]>(bvh.node_count);
-        int_bvh.primitive_indices = std::make_unique<size_t[]>(trigs.size());
-
-        std::vector<size_t> local_trig_idx_map(bvh.node_count);
-        size_t tmp_node_offset = 0;
-        size_t tmp_trig_offset = 0;
-        for (int i = 0; i < num_clusters; i++)
+        std::vector<bool> collapse(bvh.node_count);
+        std::vector<float> cost(bvh.node_count);
+        std::vector<size_t> trig_counts(bvh.node_count);
+        for (size_t i = bvh.node_count - 1; i > 0; i--)
         {
-            // fill int_bvh.clusters[i]
-            for (int j = 0; j < 6; j++)
-                int_bvh.clusters[i].ref_bounds[j] = bvh.nodes[ref_indices[i]].bounds[j];
-            int_bvh.clusters[i].inv_sx_inv_sw = inv_sw / scaling_factors[i];
-            int_bvh.clusters[i].node_offset = tmp_node_offset;
-            int_bvh.clusters[i].trig_offset = tmp_trig_offset;
-
-            // fill int_bvh.trigs
-            int tmp_local_trig_offset = 0;
-            for (size_t curr_node_idx : cluster_node_indices[i])
+            const node_t &node = bvh.nodes[i];
+            size_t ref_idx = ref_indices[i];
+            float half_area = get_quant_bbox(bvh, i, ref_idx, scaling_factors[ref_idx]).half_area();
+            if (node.is_leaf())
             {
-                node_t &curr_node = bvh.nodes[curr_node_idx];
-                if (curr_node.is_leaf())
-                {
-                    local_trig_idx_map[curr_node_idx] = tmp_local_trig_offset;
-                    for (unsigned int j = 0; j < curr_node.primitive_count; j++)
-                    {
-                        size_t trig_idx = bvh.primitive_indices[curr_node.first_child_or_primitive + j];
-                        int_bvh.trigs[tmp_trig_offset] = trigs[trig_idx];
-                        int_bvh.primitive_indices[tmp_trig_offset] = trig_idx;
-
-                        tmp_trig_offset++;
-                        tmp_local_trig_offset++;
-                    }
-                }
+                trig_counts[i] = node.primitive_count;
+                cost[i] = t_ist * (float)node.primitive_count * half_area;
+                continue;
             }
 
-            // fill int_bvh.nodes
-            for (size_t curr_node_idx : cluster_node_indices[i])
+            size_t left_node_idx = node.first_child_or_primitive;
+            size_t right_node_idx = left_node_idx + 1;
+            trig_counts[i] = trig_counts[left_node_idx] + trig_counts[right_node_idx];
+            float t_trv = policy[i] == policy_t::SWITCH ? t_trv_int * 2 + t_switch : t_trv_int * 2;
+            cost[i] = t_trv * half_area + cost[left_node_idx] + cost[right_node_idx];
+
+            float leaf_cost = t_ist * (float)trig_counts[i] * half_area;
+            if (trig_counts[i] <= max_trig_in_leaf_size && leaf_cost <= cost[i])
             {
-                node_t &curr_node = bvh.nodes[curr_node_idx];
-                int_node_t &curr_int_node = int_bvh.nodes[tmp_node_offset];
+                collapse[i] = true;
+                cost[i] = leaf_cost;
+            }
+        }
+        return collapse;
+    }
 
-                // fill curr_int_node.bounds
-                std::array<uint8_t, 6> bounds = get_int_bounds(bvh, curr_node_idx, ref_indices[i], scaling_factors[i]);
-                for (int j = 0; j < 6; j++)
-                    curr_int_node.bounds[j] = bounds[j];
+    void optimize_bvh(float t_trv_int, float t_switch, float t_ist, bvh_t &bvh, size_t max_ref_depth)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<policy_t> policy;
+        float cost = get_quant_cost(t_trv_int, t_switch, t_ist, bvh, max_ref_depth, &policy);
+        float initial_cost = cost;
 
-                child_type_t child_type;
-                size_t left_node_idx = curr_node.first_child_or_primitive;
-                size_t right_node_idx = left_node_idx + 1;
-                if (curr_node.is_leaf())
-                {
-                    child_type = child_type_t::LEAF;
-                }
-                else
-                {
-                    int curr_cluster_idx = cluster_idx_map[curr_node_idx];
-                    int left_cluster_idx = cluster_idx_map[left_node_idx];
-                    int right_cluster_idx = cluster_idx_map[right_node_idx];
-                    assert(left_cluster_idx == right_cluster_idx);
+        // reinsertion optimizes the float SAH, the result is only kept if the quantized cost drops
+        {
+            bvh_t candidate = compact_bvh(bvh, {});
+            bvh::ParallelReinsertionOptimizer<bvh_t> optimizer(candidate);
+            optimizer.optimize();
+            candidate = compact_bvh(candidate, {});
 
-                    if (curr_cluster_idx != left_cluster_idx)
-                    {
-                        assert(policy[curr_node_idx] == policy_t::SWITCH);
-                        child_type = child_type_t::SWITCH;
-                    }
-                    else
-                    {
-                        assert(policy[curr_node_idx] == policy_t::STAY);
-                        child_type = child_type_t::INTERNAL;
-                    }
-                }
+            std::vector<policy_t> candidate_policy;
+            float candidate_cost = get_quant_cost(t_trv_int, t_switch, t_ist, candidate, max_ref_depth, &candidate_policy);
+            printf("(ycpin) Reinsertion: quantized cost %.3f -> %.3f%s\n", cost, candidate_cost,
+                   candidate_cost < cost ? "" : " (rejected)");
+            if (candidate_cost < cost)
+            {
+                bvh = std::move(candidate);
+                policy = std::move(candidate_policy);
+                cost = candidate_cost;
+            }
+        }
 
-                // fill curr_int_node.data
-                switch (child_type)
-                {
-                case child_type_t::INTERNAL:
-                {
-                    size_t field_c = local_node_idx_map[left_node_idx];
-                    if (field_c >= max_node_in_cluster_size)
-                    {
-                        std::cerr << "internal node cannot fit!" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    curr_int_node.data = 0x8000 | field_c;
-                    break;
-                }
-                case child_type_t::LEAF:
-                {
-                    size_t field_b = bvh.nodes[curr_node_idx].primitive_count;
-                    size_t field_c = local_trig_idx_map[curr_node_idx];
-                    if (field_b > max_trig_in_leaf_size || field_c >= max_trig_in_cluster_size)
-                    {
-                        std::cerr << "leaf node cannot fit!" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    curr_int_node.data = 0x8000 | (field_b << field_c_bits) | field_c;
-                    break;
-                }
-                case child_type_t::SWITCH:
+        // collapsing changes the best policy, so the new tree is solved again before accepting it
+        {
+            std::vector<bool> collapse = get_collapsed_nodes(t_trv_int, t_switch, t_ist, bvh, policy);
+            size_t num_collapsed = std::count(collapse.begin(), collapse.end(), true);
+            if (num_collapsed != 0)
+            {
+                bvh_t candidate = compact_bvh(bvh, collapse);
+                float candidate_cost = get_quant_cost(t_trv_int, t_switch, t_ist, candidate, max_ref_depth);
+                printf("(ycpin) Leaf collapse: %zu nodes, quantized cost %.3f -> %.3f%s\n", num_collapsed, cost,
+                       candidate_cost, candidate_cost < cost ? "" : " (rejected)");
+                if (candidate_cost < cost)
                 {
-                    size_t field_bc = cluster_idx_map[left_node_idx];
-                    if (field_bc >= max_cluster_size)
-                    {
-                        std::cerr << "switch node cannot fit!" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    curr_int_node.data = field_bc;
-                    break;
+                    bvh = std::move(candidate);
+                    cost = candidate_cost;
                 }
-                }
-                tmp_node_offset++;
             }
         }
 
-        return int_bvh;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        printf("(ycpin) Optimize BVH: quantized cost %.3f -> %.3f, node_count = %zu, %.0f ms\n", initial_cost, cost,
+               bvh.node_count, elapsed.count());
     }
 
-    decoded_data_t decode_data(uint16_t data)
+    size_t count_straddles(size_t slot, size_t count, size_t length, size_t stride)
     {
-        decoded_data_t decoded_data{};
-        if (data & 0x8000)
-        {
-            int field_b = ((data & 0x7fff) >> field_c_bits);
-            int field_c = (data & ((1 << field_c_bits) - 1));
-            if (field_b == 0)
-            {
-                decoded_data.child_type = child_type_t::INTERNAL;
-            }
-            else
-            {
-                decoded_data.child_type = child_type_t::LEAF;
-                decoded_data.num_trigs = field_b;
-            }
-            decoded_data.idx = field_c;
-        }
-        else
+        // buffers start on an INT_BVH_ALIGNMENT boundary
+        size_t straddles = 0;
+        for (size_t k = 0; k < count; k++)
         {
-            decoded_data.child_type = child_type_t::SWITCH;
-            decoded_data.idx = data;
+            if (((slot + k * stride) * length) % INT_BVH_ALIGNMENT + length > INT_BVH_ALIGNMENT)
+                straddles++;
         }
-        return decoded_data;
+        return straddles;
     }
 
-    int_bvh_v2_t convert_nodes(const int_bvh_t &int_bvh, const bvh_t &bvh, const std::vector<trig_t> &trigs)
+    // fewest straddles of count consecutive elements at any position within a line
+    static size_t count_min_straddles(size_t count, size_t length)
     {
-        int_bvh_v2_t int_bvh_v2;
+        size_t min_straddles = count_straddles(0, count, length);
+        for (size_t slot = 1; slot * length % INT_BVH_ALIGNMENT != 0; slot++)
+            min_straddles = std::min(min_straddles, count_straddles(slot, count, length));
+        return min_straddles;
+    }
 
-        int_bvh_v2.num_clusters = int_bvh.num_clusters;
-        int_bvh_v2.clusters = std::make_unique<int_cluster_t[]>(int_bvh.num_clusters);
-        std::copy(int_bvh.clusters.get(), int_bvh.clusters.get() + int_bvh.num_clusters, int_bvh_v2.clusters.get());
-        int_bvh_v2.trigs = std::make_unique<trig_t[]>(trigs.size());
-        std::copy(int_bvh.trigs.get(), int_bvh.trigs.get() + trigs.size(), int_bvh_v2.trigs.get());
-        int_bvh_v2.nodes_v2 = std::make_unique<int_node_v2_t[]>(bvh.node_count);
-        std::copy(int_bvh.nodes_v2.get(), int_bvh.nodes_v2.get() + bvh.node_count, int_bvh_v2.nodes_v2.get());
-        int_bvh_v2.primitive_indices = std::make_unique<size_t[]>(trigs.size());
-        std::copy(int_bvh.primitive_indices.get(), int_bvh.primitive_indices.get() + trigs.size(), int_bvh_v2.primitive_indices.get());
-
-        // Fill new_nodes while updating child indices
-        for (size_t i = 0; i < bvh.node_count; i++)
+    // first slot in [cursor, cursor + max_line_padding] whose element does not straddle, or cursor
+    static size_t pad_to_line(size_t cursor, size_t length)
+    {
+        for (size_t slot = cursor; slot <= cursor + max_line_padding; slot++)
         {
-            int_node_v2_t &curr_node_v2 = int_bvh_v2.nodes_v2[i];
+            if (count_straddles(slot, 1, length) == 0)
+                return slot;
+        }
+        return cursor;
+    }
+
+    // appends the items of the first levels levels below item k to order, see node_order_t::VEB
+    static void append_veb_order(const std::vector<std::vector<size_t>> &children, const std::vector<size_t> &heights,
+                                 size_t k, size_t levels, std::vector<size_t> &order)
+    {
+        if (levels == 1)
+        {
+            order.push_back(k);
+            return;
+        }
+
+        size_t top_levels = levels / 2;
+        append_veb_order(children, heights, k, top_levels, order);
+        std::vector<size_t> frontier = {k};
+        for (size_t d = 0; d < top_levels; d++)
+        {
+            std::vector<size_t> next_frontier;
+            for (size_t f : frontier)
+                next_frontier.insert(next_frontier.end(), children[f].begin(), children[f].end());
+            frontier = std::move(next_frontier);
+        }
+        for (size_t f : frontier)
+            append_veb_order(children, heights, f, std::min(levels - top_levels, heights[f]), order);
+    }
+
+    // Storage order of the items (nodes or sibling pairs) of one cluster for node_order, starting with
+    // item 0, the cluster root. children[k] are the items fetched right after item k, all of them
+    // after k (BFS numbering), heats[k] is the chance of visiting item k.
+    static std::vector<size_t> get_node_order(const std::vector<std::vector<size_t>> &children,
+                                              const std::vector<float> &heats)
+    {
+        std::vector<size_t> order;
+        order.reserve(children.size());
+        if (node_order == node_order_t::HEAT)
+        {
+            // place_in_lines sorts by heat
+            for (size_t k = 0; k < children.size(); k++)
+                order.push_back(k);
+            return order;
+        }
+
+        std::vector<std::vector<size_t>> sorted_children = children;
+        for (std::vector<size_t> &curr_children : sorted_children)
+        {
+            std::stable_sort(curr_children.begin(), curr_children.end(), [&](size_t a, size_t b)
+                             { return heats[a] > heats[b]; });
+        }
+
+        if (node_order == node_order_t::DFS)
+        {
+            std::vector<size_t> stk = {0};
+            while (!stk.empty())
+            {
+                size_t k = stk.back();
+                stk.pop_back();
+                order.push_back(k);
+                stk.insert(stk.end(), sorted_children[k].rbegin(), sorted_children[k].rend());
+            }
+            return order;
+        }
+
+        std::vector<size_t> heights(children.size(), 1);
+        for (size_t k = children.size(); k-- > 0;)
+        {
+            for (size_t child : children[k])
+                heights[k] = std::max(heights[k], heights[child] + 1);
+        }
+        append_veb_order(sorted_children, heights, 0, heights[0], order);
+        return order;
+    }
+
+    // Lays out items of sizes[i] elements (stride slots each) from cursor, in the given order (hottest first
+    // with node_order_t::HEAT) or, with hot (leaves), in an order that fills the positions where the items
+    // with hot[i] straddle the fewest lines with them and the others with the rest: every position takes
+    // the hottest hot item that straddles the fewest lines there, else the other item of the size class
+    // with the least heats[i] * (straddles there - average straddles), the hottest of its class if it
+    // straddles at most the average there and the coldest otherwise. Then padding goes in front of the items, chosen by dynamic programming over the cursor's position
+    // within a line so that the straddling elements weighted by heats[i], plus min_padding_heat per padding
+    // slot, are minimal: up to max_line_padding slots in front of every item, and in front of every item
+    // with hot[i] as many as it takes to start where it straddles the fewest lines its size allows. Where
+    // the items would no longer end before max_cursor, the padding of the other items is dropped first,
+    // then all padding. Returns the slot of every item.
+    static std::vector<size_t> place_in_lines(size_t &cursor, const std::vector<size_t> &sizes, const std::vector<float> &heats,
+                                              size_t length, size_t stride, size_t max_cursor,
+                                              const std::vector<bool> *hot, size_t &padding)
+    {
+        // slots period apart share their position within a line, so straddles only depend on slot % period
+        size_t period = 1;
+        while (period * length % INT_BVH_ALIGNMENT != 0)
+            period++;
+
+        std::vector<size_t> order(sizes.size());
+        size_t rest_slots = 0, max_size = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+            rest_slots += sizes[i] * stride;
+            max_size = std::max(max_size, sizes[i]);
+        }
+        if (hot || node_order == node_order_t::HEAT)
+        {
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                             { return heats[a] > heats[b]; });
+        }
+
+        // average and fewest straddles of an item of size k over the positions within a line
+        std::vector<float> average_straddles(max_size + 1, 0.0f);
+        std::vector<size_t> min_straddles(max_size + 1, std::numeric_limits<size_t>::max());
+        for (size_t k = 0; k <= max_size; k++)
+        {
+            for (size_t p = 0; p < period; p++)
+            {
+                size_t straddles = count_straddles(p, k, length, stride);
+                average_straddles[k] += straddles;
+                min_straddles[k] = std::min(min_straddles[k], straddles);
+            }
+            average_straddles[k] /= period;
+        }
+
+        if (hot)
+        {
+            // classes[c][k]: cold (c = 0) or hot (c = 1) items of size k, hottest first, of which
+            // [first[c][k], last[c][k]) are not placed yet
+            std::vector<std::vector<size_t>> classes[2];
+            std::vector<size_t> first[2], last[2];
+            for (int c = 0; c < 2; c++)
+                classes[c].resize(max_size + 1);
+            for (size_t item : order)
+                classes[(*hot)[item]][sizes[item]].push_back(item);
+            for (int c = 0; c < 2; c++)
+            {
+                for (size_t k = 0; k <= max_size; k++)
+                {
+                    first[c].push_back(0);
+                    last[c].push_back(classes[c][k].size());
+                }
+            }
+
+            size_t slot = cursor;
+            for (size_t t = 0; t < order.size();)
+            {
+                size_t best_c = 0, best_k = 0;
+                bool best_hottest = true;
+                float best_cost = std::numeric_limits<float>::infinity();
+                for (size_t k = 0; k <= max_size; k++)
+                {
+                    if (first[1][k] == last[1][k] || count_straddles(slot, k, length, stride) != min_straddles[k])
+                        continue;
+                    float cost = -heats[classes[1][k][first[1][k]]];
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_c = 1;
+                        best_k = k;
+                    }
+                }
+                for (size_t k = 0; best_c == 0 && k <= max_size; k++)
+                {
+                    if (first[0][k] == last[0][k])
+                        continue;
+                    float straddles = count_straddles(slot, k, length, stride) - average_straddles[k];
+                    bool hottest = straddles <= 0.0f;
+                    float cost = heats[classes[0][k][hottest ? first[0][k] : last[0][k] - 1]] * straddles;
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_k = k;
+                        best_hottest = hottest;
+                    }
+                }
+                // only hot items are left and none of them fits here, skip a slot
+                if (best_cost == std::numeric_limits<float>::infinity())
+                {
+                    slot++;
+                    continue;
+                }
+
+                std::vector<size_t> &curr_class = classes[best_c][best_k];
+                order[t++] = best_hottest ? curr_class[first[best_c][best_k]++] : curr_class[--last[best_c][best_k]];
+                slot += best_k * stride;
+            }
+        }
+
+        // padding in front of every item in order, with up to max_padding slots in front of the other items
+        // and hot items aligned if align_hot; costs[p]: least cost of the items so far, ending at position p,
+        // paddings and previous record the padding in front of item t and the position it started from
+        std::vector<uint8_t> paddings(order.size() * period);
+        std::vector<uint8_t> previous(order.size() * period);
+        auto get_paddings = [&](size_t max_padding, bool align_hot)
+        {
+            std::vector<float> costs(period, std::numeric_limits<float>::infinity());
+            std::vector<float> next_costs(period);
+            costs[cursor % period] = 0.0f;
+            for (size_t t = 0; t < order.size(); t++)
+            {
+                size_t item = order[t];
+                bool aligned = align_hot && hot && (*hot)[item];
+                std::fill(next_costs.begin(), next_costs.end(), std::numeric_limits<float>::infinity());
+                for (size_t p = 0; p < period; p++)
+                {
+                    if (costs[p] == std::numeric_limits<float>::infinity())
+                        continue;
+                    for (size_t d = 0; d <= (aligned ? period - 1 : max_padding); d++)
+                    {
+                        size_t straddles = count_straddles(p + d, sizes[item], length, stride);
+                        if (aligned && straddles != min_straddles[sizes[item]])
+                            continue;
+                        float cost = costs[p] + heats[item] * straddles + min_padding_heat * d;
+                        size_t end = (p + d + sizes[item] * stride) % period;
+                        if (cost < next_costs[end])
+                        {
+                            next_costs[end] = cost;
+                            paddings[t * period + end] = d;
+                            previous[t * period + end] = p;
+                        }
+                    }
+                }
+                costs.swap(next_costs);
+            }
+
+            std::vector<size_t> item_paddings(order.size());
+            size_t end = std::min_element(costs.begin(), costs.end()) - costs.begin();
+            for (size_t t = order.size(); t-- > 0;)
+            {
+                item_paddings[t] = paddings[t * period + end];
+                end = previous[t * period + end];
+            }
+            return item_paddings;
+        };
+        auto fits = [&](const std::vector<size_t> &item_paddings)
+        {
+            size_t total_padding = 0;
+            for (size_t d : item_paddings)
+                total_padding += d;
+            return cursor + rest_slots + total_padding <= max_cursor;
+        };
+        std::vector<size_t> item_paddings = get_paddings(max_line_padding, true);
+        if (!fits(item_paddings))
+            item_paddings = get_paddings(0, true);
+        if (!fits(item_paddings))
+            std::fill(item_paddings.begin(), item_paddings.end(), 0);
+
+        std::vector<size_t> slots(sizes.size());
+        for (size_t t = 0; t < order.size(); t++)
+        {
+            size_t item = order[t];
+            padding += item_paddings[t];
+            cursor += item_paddings[t];
+            slots[item] = cursor;
+            cursor += sizes[item] * stride;
+        }
+        return slots;
+    }
+
+    // line of the element at slot, buffers start on an INT_BVH_ALIGNMENT boundary
+    static size_t get_line(size_t slot, size_t length)
+    {
+        return slot * length / INT_BVH_ALIGNMENT;
+    }
+
+    // least surface area of the hot leaves, the largest leaves that together take hot_leaf_share of the
+    // triangle tests expected by surface area, infinity without hot leaves
+    static float get_hot_leaf_half_area(const bvh_t &bvh)
+    {
+        if (!(hot_leaf_share > 0.0f))
+            return std::numeric_limits<float>::infinity();
+
+        std::vector<std::pair<float, size_t>> leaves;
+        double total_tests = 0.0;
+        for (size_t i = 0; i < bvh.node_count; i++)
+        {
+            const node_t &curr_node = bvh.nodes[i];
+            if (!curr_node.is_leaf())
+                continue;
+            leaves.emplace_back(curr_node.bounding_box_proxy().half_area(), curr_node.primitive_count);
+            total_tests += static_cast<double>(leaves.back().first) * leaves.back().second;
+        }
+        std::sort(leaves.begin(), leaves.end(), std::greater<>());
+
+        double tests = 0.0;
+        for (const auto &[half_area, primitive_count] : leaves)
+        {
+            tests += static_cast<double>(half_area) * primitive_count;
+            if (tests >= hot_leaf_share * total_tests)
+                return half_area;
+        }
+        return 0.0f;
+    }
+
+    // Orders the sibling pairs of every cluster for node_order (see get_node_order), then lays out the
+    // node slots and triangles so that the nodes and leaves most likely to be visited (by surface area
+    // relative to the reference node) do not straddle INT_BVH_ALIGNMENT lines. Nodes are placed for the
+    // int_node_v2_t fetch size, a sibling pair takes two slots and the pair of the cluster root stays at
+    // local index 0 (padding the cluster start instead). Leaves are reordered by heat and the hot leaves
+    // (see get_hot_leaf_half_area) padded to where they straddle the fewest lines, see place_in_lines.
+    static void place_cluster_lines(cluster_layout_t &layout, const bvh_t &bvh)
+    {
+        constexpr size_t node_length = sizeof(int_node_v2_t);
+        // with quantized triangles, traversal fetches int_qtrig_t and only the rare candidates in full
+        constexpr size_t trig_length = trig_quant_bits != 0 ? INT_BVH_QTRIG_length : INT_BVH_TRIG_length;
+        line_stats_t &stats = layout.line_stats;
+        stats = line_stats_t{};
+
+        layout.node_offsets.resize(layout.num_clusters + 1);
+        layout.trig_offsets.resize(layout.num_clusters + 1);
+        layout.local_trig_idx_map.resize(bvh.node_count);
+        size_t node_cursor = 0, unpadded_node_cursor = 0;
+        size_t trig_cursor = 0;
+        float hot_leaf_half_area = get_hot_leaf_half_area(bvh);
+        for (int i = 0; i < layout.num_clusters; i++)
+        {
+            std::vector<size_t> &cluster_node_indices = layout.cluster_node_indices[i];
+            float ref_half_area = bvh.nodes[layout.ref_indices[i]].bounding_box_proxy().half_area();
+            float inv_ref_half_area = ref_half_area > 0.0f ? 1.0f / ref_half_area : 0.0f;
+
+            // pairs in BFS order (local_node_idx_map still holds BFS positions), a pair is visited with its parent
+            size_t num_pairs = cluster_node_indices.size() / 2;
+            std::vector<std::vector<size_t>> pair_children(num_pairs);
+            std::vector<float> pair_heats = {1.0f};
+            for (size_t p = 0; p < num_pairs; p++)
+            {
+                for (size_t j = 2 * p; j < 2 * p + 2; j++)
+                {
+                    const node_t &curr_node = bvh.nodes[cluster_node_indices[j]];
+                    if (!curr_node.is_leaf() && layout.policy[cluster_node_indices[j]] == policy_t::STAY)
+                        pair_children[p].push_back(layout.local_node_idx_map[curr_node.first_child_or_primitive] / 2);
+                }
+                if (p == 0)
+                    continue;
+                bbox_t bbox = bvh.nodes[cluster_node_indices[2 * p]].bounding_box_proxy().to_bounding_box();
+                bbox.extend(bvh.nodes[cluster_node_indices[2 * p + 1]].bounding_box_proxy().to_bounding_box());
+                pair_heats.push_back(bbox.half_area() * inv_ref_half_area);
+            }
+            std::vector<size_t> pair_order = get_node_order(pair_children, pair_heats);
+
+            std::vector<size_t> pair_sizes(num_pairs - 1, 1);
+            std::vector<float> ordered_pair_heats;
+            for (size_t q = 1; q < num_pairs; q++)
+                ordered_pair_heats.push_back(pair_heats[pair_order[q]]);
+
+            size_t node_offset = pad_to_line(node_cursor, node_length);
+            stats.node_padding += node_offset - node_cursor;
+            node_cursor = node_offset + 2;
+            std::vector<size_t> ordered_pair_slots = place_in_lines(node_cursor, pair_sizes, ordered_pair_heats, node_length, 2,
+                                                                    node_offset + max_node_in_cluster_size, nullptr,
+                                                                    stats.node_padding);
+
+            layout.node_offsets[i] = node_offset;
+            std::vector<size_t> pair_slots(num_pairs);
+            std::vector<size_t> ordered_node_indices;
+            ordered_node_indices.reserve(cluster_node_indices.size());
+            for (size_t q = 0; q < num_pairs; q++)
+            {
+                size_t p = pair_order[q];
+                size_t slot = q == 0 ? node_offset : ordered_pair_slots[q - 1];
+                pair_slots[p] = slot;
+                size_t straddles_before = count_straddles(unpadded_node_cursor + 2 * p, 1, node_length);
+                size_t straddles = count_straddles(slot, 1, node_length);
+                stats.node_straddles_before += straddles_before;
+                stats.node_straddles += straddles;
+                stats.node_visit_straddles_before += pair_heats[p] * straddles_before;
+                stats.node_visit_straddles += pair_heats[p] * straddles;
+
+                ordered_node_indices.push_back(cluster_node_indices[2 * p]);
+                ordered_node_indices.push_back(cluster_node_indices[2 * p + 1]);
+            }
+            for (size_t p = 0; p < num_pairs; p++)
+            {
+                for (size_t c : pair_children[p])
+                {
+                    bool shared_before = get_line(unpadded_node_cursor + 2 * c, node_length) ==
+                                         get_line(unpadded_node_cursor + 2 * p, node_length);
+                    bool shared = get_line(pair_slots[c], node_length) == get_line(pair_slots[p], node_length);
+                    stats.node_visit_shared_lines_before += pair_heats[c] * shared_before;
+                    stats.node_visit_shared_lines += pair_heats[c] * shared;
+                }
+            }
+
+            // count straddling triangles of the BFS order before reordering the cluster
+            size_t unpadded_trig_cursor = trig_cursor;
+            for (size_t curr_node_idx : cluster_node_indices)
+            {
+                const node_t &curr_node = bvh.nodes[curr_node_idx];
+                if (!curr_node.is_leaf())
+                    continue;
+                size_t straddles_before = count_straddles(unpadded_trig_cursor, curr_node.primitive_count, trig_length);
+                stats.trig_straddles_before += straddles_before;
+                if (curr_node.bounding_box_proxy().half_area() >= hot_leaf_half_area)
+                {
+                    stats.hot_trigs += curr_node.primitive_count;
+                    stats.hot_trig_straddles_before += straddles_before;
+                    stats.hot_trig_min_straddles += count_min_straddles(curr_node.primitive_count, trig_length);
+                }
+                unpadded_trig_cursor += curr_node.primitive_count;
+            }
+
+            cluster_node_indices = std::move(ordered_node_indices);
+            for (size_t j = 0; j < cluster_node_indices.size(); j += 2)
+            {
+                size_t slot = pair_slots[layout.local_node_idx_map[cluster_node_indices[j]] / 2];
+                layout.local_node_idx_map[cluster_node_indices[j]] = slot - node_offset;
+                layout.local_node_idx_map[cluster_node_indices[j + 1]] = slot - node_offset + 1;
+            }
+            unpadded_node_cursor += cluster_node_indices.size();
+
+            // triangles, every triangle of a leaf is fetched separately
+            std::vector<size_t> leaf_indices, leaf_sizes;
+            std::vector<float> leaf_heats;
+            std::vector<bool> leaf_hot;
+            for (size_t curr_node_idx : cluster_node_indices)
+            {
+                const node_t &curr_node = bvh.nodes[curr_node_idx];
+                if (!curr_node.is_leaf())
+                    continue;
+                leaf_indices.push_back(curr_node_idx);
+                leaf_sizes.push_back(curr_node.primitive_count);
+                leaf_heats.push_back(curr_node.bounding_box_proxy().half_area() * inv_ref_half_area);
+                leaf_hot.push_back(curr_node.bounding_box_proxy().half_area() >= hot_leaf_half_area);
+            }
+
+            size_t trig_offset = trig_cursor;
+            std::vector<size_t> leaf_slots = place_in_lines(trig_cursor, leaf_sizes, leaf_heats, trig_length, 1,
+                                                            trig_offset + max_trig_in_cluster_size, &leaf_hot,
+                                                            stats.trig_padding);
+
+            layout.trig_offsets[i] = trig_offset;
+            for (size_t j = 0; j < leaf_indices.size(); j++)
+            {
+                size_t straddles = count_straddles(leaf_slots[j], leaf_sizes[j], trig_length);
+                stats.trig_straddles += straddles;
+                if (leaf_hot[j])
+                    stats.hot_trig_straddles += straddles;
+
+                layout.local_trig_idx_map[leaf_indices[j]] = leaf_slots[j] - trig_offset;
+            }
+        }
+        layout.node_offsets[layout.num_clusters] = node_cursor;
+        layout.trig_offsets[layout.num_clusters] = trig_cursor;
+    }
+
+    void print_line_stats(const line_stats_t &line_stats)
+    {
+        printf("(ycpin) Line placement: straddling nodes %zu -> %zu (per cluster visit %.2f -> %.2f, %zu padding slots)\n",
+               line_stats.node_straddles_before, line_stats.node_straddles,
+               line_stats.node_visit_straddles_before, line_stats.node_visit_straddles, line_stats.node_padding);
+        printf("(ycpin) Line placement: straddling triangles %zu -> %zu, of the %zu in hot leaves %zu -> %zu (at least %zu), "
+               "%zu padding slots\n",
+               line_stats.trig_straddles_before, line_stats.trig_straddles, line_stats.hot_trigs,
+               line_stats.hot_trig_straddles_before, line_stats.hot_trig_straddles, line_stats.hot_trig_min_straddles,
+               line_stats.trig_padding);
+        printf("(ycpin) Node order %s: child fetches on the parent's line per cluster visit %.2f -> %.2f\n",
+               get_node_order_name(node_order), line_stats.node_visit_shared_lines_before, line_stats.node_visit_shared_lines);
+    }
+
+    // Opens the largest child that stays in the cluster until node_idx holds n children.
+    // Children are kept in left-to-right order.
+    static std::vector<size_t> collapse_children(const bvh_t &bvh, const std::vector<policy_t> &policy, size_t node_idx,
+                                                 int n)
+    {
+        size_t left_node_idx = bvh.nodes[node_idx].first_child_or_primitive;
+        std::vector<size_t> child_indices = {left_node_idx, left_node_idx + 1};
+
+        while ((int)child_indices.size() < n)
+        {
+            int best_j = -1;
+            float best_half_area = -std::numeric_limits<float>::infinity();
+            for (int j = 0; j < (int)child_indices.size(); j++)
+            {
+                const node_t &child = bvh.nodes[child_indices[j]];
+                if (child.is_leaf() || policy[child_indices[j]] != policy_t::STAY)
+                    continue;
+                float half_area = child.bounding_box_proxy().half_area();
+                if (half_area > best_half_area)
+                {
+                    best_half_area = half_area;
+                    best_j = j;
+                }
+            }
+            if (best_j == -1)
+                break;
+
+            size_t grandchild_idx = bvh.nodes[child_indices[best_j]].first_child_or_primitive;
+            child_indices[best_j] = grandchild_idx;
+            child_indices.insert(child_indices.begin() + best_j + 1, grandchild_idx + 1);
+        }
+
+        return child_indices;
+    }
+
+    // Collapses cluster i into n-wide nodes of node_length bytes and places them from node_cursor like
+    // place_cluster_lines places sibling pairs, the cluster root at a line-aligned node_offset.
+    static wide_cluster_t place_wide_cluster(const cluster_layout_t &layout, const bvh_t &bvh, int i, int n,
+                                             size_t node_length, size_t &node_cursor, size_t &padding)
+    {
+        wide_cluster_t wide;
+        wide.node_offset = pad_to_line(node_cursor, node_length);
+        padding += wide.node_offset - node_cursor;
+
+        wide.roots = {layout.ref_indices[i]};
+        for (size_t k = 0; k < wide.roots.size(); k++)
+        {
+            wide.children.push_back(collapse_children(bvh, layout.policy, wide.roots[k], n));
+            wide.child_nodes.emplace_back();
+            for (size_t child_idx : wide.children[k])
+            {
+                if (!bvh.nodes[child_idx].is_leaf() && layout.policy[child_idx] == policy_t::STAY)
+                {
+                    wide.child_nodes[k].push_back(wide.roots.size());
+                    wide.roots.push_back(child_idx);
+                }
+            }
+        }
+
+        // the cluster root stays at local index 0
+        float ref_half_area = bvh.nodes[layout.ref_indices[i]].bounding_box_proxy().half_area();
+        float inv_ref_half_area = ref_half_area > 0.0f ? 1.0f / ref_half_area : 0.0f;
+        wide.heats = {1.0f};
+        for (size_t k = 1; k < wide.roots.size(); k++)
+            wide.heats.push_back(bvh.nodes[wide.roots[k]].bounding_box_proxy().half_area() * inv_ref_half_area);
+        std::vector<size_t> order = get_node_order(wide.child_nodes, wide.heats);
+
+        std::vector<size_t> sizes(wide.roots.size() - 1, 1);
+        std::vector<float> ordered_heats;
+        for (size_t q = 1; q < order.size(); q++)
+            ordered_heats.push_back(wide.heats[order[q]]);
+        node_cursor = wide.node_offset + 1;
+        std::vector<size_t> ordered_slots = place_in_lines(node_cursor, sizes, ordered_heats, node_length, 1,
+                                                           wide.node_offset + max_node_in_cluster_size, nullptr, padding);
+        wide.slots.resize(wide.roots.size());
+        wide.slots[0] = wide.node_offset;
+        for (size_t q = 1; q < order.size(); q++)
+            wide.slots[order[q]] = ordered_slots[q - 1];
+        return wide;
+    }
+
+    // Bytes each cluster takes in the emitted buffers: its node slots up to the next cluster's node_offset
+    // (int_node_v2_t pairs with wide_width 0, collapsed wide_width-wide nodes otherwise, empty children and
+    // line padding included) and its triangle slots with their quantized copies, padding included.
+    static std::vector<size_t> get_cluster_bytes(const cluster_layout_t &layout, const bvh_t &bvh, int wide_width)
+    {
+        std::vector<size_t> node_offsets = layout.node_offsets;
+        size_t node_length = sizeof(int_node_v2_t);
+        if (wide_width != 0)
+        {
+            node_length = wide_width * sizeof(int_node_t);
+            size_t node_cursor = 0, padding = 0;
+            for (int i = 0; i < layout.num_clusters; i++)
+                node_offsets[i] = place_wide_cluster(layout, bvh, i, wide_width, node_length, node_cursor, padding).node_offset;
+            node_offsets[layout.num_clusters] = node_cursor;
+        }
+
+        std::vector<size_t> bytes(layout.num_clusters);
+        for (int i = 0; i < layout.num_clusters; i++)
+            bytes[i] = (node_offsets[i + 1] - node_offsets[i]) * node_length +
+                       (layout.trig_offsets[i + 1] - layout.trig_offsets[i]) * cluster_trig_bytes;
+        return bytes;
+    }
+
+    // Forces one STAY node of every cluster whose emitted bytes (get_cluster_bytes) exceed max_bytes to
+    // SWITCH. subtree_bytes[j] estimates what STAY node j and its STAY descendants add to their cluster,
+    // the node whose subtree_bytes is the smallest one that brings the cluster within max_bytes is
+    // switched, or the one with the largest if none does. The policy has to be solved again with
+    // forced_switches before the layout is rebuilt, and the new layout measured again.
+    // A cluster holding only the children of its SWITCH node may still exceed max_bytes.
+    // return: number of nodes added to forced_switches
+    size_t limit_cluster_bytes(const cluster_layout_t &layout, const bvh_t &bvh, int wide_width, size_t max_bytes,
+                               std::vector<bool> &forced_switches)
+    {
+        // bytes of the nodes a binary internal node adds, a sibling pair of int_node_v2_t slots, or about
+        // 1 / (n - 1) of an n-wide node
+        size_t pair_bytes = wide_width == 0 ? 2 * sizeof(int_node_v2_t) : wide_width * sizeof(int_node_t) / (wide_width - 1);
+        std::vector<size_t> subtree_bytes(bvh.node_count);
+        for (size_t j = bvh.node_count; j-- > 1;)
+        {
+            const node_t &node = bvh.nodes[j];
+            if (node.is_leaf() || layout.policy[j] != policy_t::STAY)
+                continue;
+            subtree_bytes[j] = pair_bytes;
+            for (size_t c = 0; c < 2; c++)
+            {
+                const node_t &child_node = bvh.nodes[node.first_child_or_primitive + c];
+                subtree_bytes[j] += child_node.is_leaf() ? child_node.primitive_count * cluster_trig_bytes
+                                                          : subtree_bytes[node.first_child_or_primitive + c];
+            }
+        }
+
+        size_t num_switches = 0;
+        std::vector<size_t> bytes = get_cluster_bytes(layout, bvh, wide_width);
+        for (int i = 0; i < layout.num_clusters; i++)
+        {
+            if (bytes[i] <= max_bytes)
+                continue;
+
+            size_t excess = bytes[i] - max_bytes;
+            size_t best_node_idx = 0;
+            for (size_t node_idx : layout.cluster_node_indices[i])
+            {
+                if (subtree_bytes[node_idx] == 0)
+                    continue;
+                bool suffices = subtree_bytes[node_idx] >= excess;
+                bool best_suffices = best_node_idx != 0 && subtree_bytes[best_node_idx] >= excess;
+                if (best_node_idx == 0 ||
+                    (suffices && (!best_suffices || subtree_bytes[node_idx] < subtree_bytes[best_node_idx])) ||
+                    (!suffices && !best_suffices && subtree_bytes[node_idx] > subtree_bytes[best_node_idx]))
+                    best_node_idx = node_idx;
+            }
+            if (best_node_idx != 0)
+            {
+                forced_switches[best_node_idx] = true;
+                num_switches++;
+            }
+        }
+        return num_switches;
+    }
+
+    // everything of get_cluster_layout after the policy
+    static void fill_cluster_layout(cluster_layout_t &layout, const bvh_t &bvh)
+    {
+        // que: fill num_clusters, cluster_node_indices, ref_indices, local_node_idx_map
+        layout.local_node_idx_map.resize(bvh.node_count);
+        std::vector<int> parent_cluster_indices;
+        std::vector<size_t> cluster_trig_counts;
+        std::queue<std::pair<size_t, int>> que;
+        que.emplace(0, -1);
+        while (!que.empty())
+        {
+            auto [curr_node_idx, curr_cluster_idx] = que.front();
+            node_t &curr_node = bvh.nodes[curr_node_idx];
+            que.pop();
+
+            if (curr_node.is_leaf())
+                continue;
+
+            size_t child_trig_count = 0;
+            for (size_t j = 0; j < 2; j++)
+            {
+                const node_t &child_node = bvh.nodes[curr_node.first_child_or_primitive + j];
+                if (child_node.is_leaf())
+                    child_trig_count += child_node.primitive_count;
+            }
+
+            // split the cluster where its children would no longer be addressable
+            if (layout.policy[curr_node_idx] == policy_t::STAY && curr_cluster_idx >= 0 &&
+                (layout.cluster_node_indices[curr_cluster_idx].size() + 2 > max_node_in_cluster_size ||
+                 cluster_trig_counts[curr_cluster_idx] + child_trig_count > max_trig_in_cluster_size))
+            {
+                layout.policy[curr_node_idx] = policy_t::SWITCH;
+                layout.num_split_clusters++;
+            }
+
+            int child_cluster_idx = -1;
+            switch (layout.policy[curr_node_idx])
+            {
+            case policy_t::STAY: // 留在當前集群
+                child_cluster_idx = curr_cluster_idx;
+                break;
+            case policy_t::SWITCH: // 切換到新集群
+                child_cluster_idx = layout.num_clusters;
+                layout.num_clusters++;
+                layout.cluster_node_indices.emplace_back();
+                layout.ref_indices.push_back(curr_node_idx);
+                parent_cluster_indices.push_back(curr_cluster_idx);
+                cluster_trig_counts.push_back(0);
+                break;
+            }
+            cluster_trig_counts[child_cluster_idx] += child_trig_count;
+
+            // 遍歷所有節點，根據策略 policy 決定當前節點應該留在當前集群 (STAY) 還是切換到新集群 (SWITCH)。
+            // 更新局部索引映射 local_node_idx_map 和集群節點索引 cluster_node_indices。
+            // 如果節點是內部節點，將其子節點加入隊列 que。
+
+            std::vector<size_t> &child_cluster = layout.cluster_node_indices[child_cluster_idx];
+            size_t left_node_idx = curr_node.first_child_or_primitive;
+            size_t right_node_idx = left_node_idx + 1;
+            layout.local_node_idx_map[left_node_idx] = child_cluster.size();
+            child_cluster.push_back(left_node_idx);
+            layout.local_node_idx_map[right_node_idx] = child_cluster.size();
+            child_cluster.push_back(right_node_idx);
+
+            que.emplace(left_node_idx, child_cluster_idx);
+            que.emplace(right_node_idx, child_cluster_idx);
+        }
+
+        // renumber clusters breadth-first over the cluster tree, so the children of each cluster
+        // are contiguous from child_cluster_offsets[i]
+        {
+            std::vector<std::vector<int>> child_cluster_indices(layout.num_clusters);
+            for (int i = 1; i < layout.num_clusters; i++)
+                child_cluster_indices[parent_cluster_indices[i]].push_back(i);
+
+            std::vector<int> order = {0};
+            layout.child_cluster_offsets.resize(layout.num_clusters);
+            for (size_t k = 0; k < order.size(); k++)
+            {
+                layout.child_cluster_offsets[k] = order.size();
+                order.insert(order.end(), child_cluster_indices[order[k]].begin(), child_cluster_indices[order[k]].end());
+            }
+
+            std::vector<std::vector<size_t>> cluster_node_indices(layout.num_clusters);
+            std::vector<size_t> ref_indices(layout.num_clusters);
+            for (int k = 0; k < layout.num_clusters; k++)
+            {
+                cluster_node_indices[k] = std::move(layout.cluster_node_indices[order[k]]);
+                ref_indices[k] = layout.ref_indices[order[k]];
+            }
+            layout.cluster_node_indices = std::move(cluster_node_indices);
+            layout.ref_indices = std::move(ref_indices);
+        }
+
+        // fill cluster_idx_map, scaling_factors
+        layout.cluster_idx_map.resize(bvh.node_count);
+        layout.scaling_factors.resize(layout.num_clusters);
+        for (int i = 0; i < layout.num_clusters; i++)
+        {
+            for (size_t curr_node_idx : layout.cluster_node_indices[i])
+                layout.cluster_idx_map[curr_node_idx] = i;
+            layout.scaling_factors[i] = get_scaling_factor(bvh, layout.ref_indices[i]);
+
+            // 初始化 cluster_idx_map 和 scaling_factors。
+            // 對於每個集群，更新節點索引映射 cluster_idx_map 和計算縮放因子 scaling_factors。
+        }
+
+        // fill node_offsets, trig_offsets, local_trig_idx_map, and pad local_node_idx_map
+        place_cluster_lines(layout, bvh);
+    }
+
+    cluster_layout_t get_cluster_layout(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh,
+                                        size_t max_ref_depth, int wide_width)
+    {
+        // arg.t_trv_int    = 0.5
+        // arg.t_switch     = 1
+        // arg.t_ist        = 1
+
+        cluster_layout_t layout;
+
+        // fill policy
+        layout.policy = get_policy(t_trv_int, t_switch, t_ist, bvh, max_ref_depth);
+        fill_cluster_layout(layout, bvh);
+
+        // switch nodes of the clusters over budget and solve the rest of the policy again, until every
+        // cluster fits or only consists of the children of its SWITCH node
+        if (max_cluster_bytes != 0)
+        {
+            std::vector<bool> forced_switches(bvh.node_count);
+            size_t num_budget_switches = 0;
+            size_t num_rounds = 0;
+            while (size_t num_switches = limit_cluster_bytes(layout, bvh, wide_width, max_cluster_bytes, forced_switches))
+            {
+                num_budget_switches += num_switches;
+                num_rounds++;
+
+                policy_solver_t solver(bvh, t_trv_int, t_switch, t_ist, max_ref_depth, &forced_switches);
+                layout = cluster_layout_t{};
+                layout.policy = solver.solve();
+                fill_cluster_layout(layout, bvh);
+            }
+            layout.num_budget_switches = num_budget_switches;
+
+            size_t max_bytes = 0;
+            size_t total_bytes = 0;
+            size_t num_over_budget = 0;
+            for (size_t bytes : get_cluster_bytes(layout, bvh, wide_width))
+            {
+                max_bytes = std::max(max_bytes, bytes);
+                total_bytes += bytes;
+                num_over_budget += bytes > max_cluster_bytes;
+            }
+            printf("(ycpin) Cluster budget %zu bytes: %zu switched nodes in %zu rounds, %d clusters, %.1f bytes on average, "
+                   "largest %zu bytes, %zu over budget\n",
+                   max_cluster_bytes, layout.num_budget_switches, num_rounds, layout.num_clusters,
+                   (double)total_bytes / layout.num_clusters, max_bytes, num_over_budget);
+        }
+        if (layout.num_split_clusters != 0)
+            printf("(ycpin) Split %zu oversized clusters\n", layout.num_split_clusters);
+
+        return layout;
+    }
+
+    uint16_t get_child_data(const cluster_layout_t &layout, const bvh_t &bvh, size_t node_idx)
+    {
+        const node_t &curr_node = bvh.nodes[node_idx];
+
+        child_type_t child_type;
+        size_t left_node_idx = curr_node.first_child_or_primitive;
+        size_t right_node_idx = left_node_idx + 1;
+        if (curr_node.is_leaf())
+        {
+            child_type = child_type_t::LEAF;
+        }
+        else
+        {
+            int curr_cluster_idx = layout.cluster_idx_map[node_idx];
+            int left_cluster_idx = layout.cluster_idx_map[left_node_idx];
+            int right_cluster_idx = layout.cluster_idx_map[right_node_idx];
+            assert(left_cluster_idx == right_cluster_idx);
+
+            if (curr_cluster_idx != left_cluster_idx)
+            {
+                assert(layout.policy[node_idx] == policy_t::SWITCH);
+                child_type = child_type_t::SWITCH;
+            }
+            else
+            {
+                assert(layout.policy[node_idx] == policy_t::STAY);
+                child_type = child_type_t::INTERNAL;
+            }
+        }
+
+        switch (child_type)
+        {
+        case child_type_t::INTERNAL:
+        {
+            size_t field_c = layout.local_node_idx_map[left_node_idx];
+            if (field_c >= max_node_in_cluster_size)
+            {
+                std::cerr << "internal node cannot fit!" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            return 0x8000 | field_c;
+        }
+        case child_type_t::LEAF:
+        {
+            size_t field_b = curr_node.primitive_count;
+            size_t field_c = layout.local_trig_idx_map[node_idx];
+            if (field_b > max_trig_in_leaf_size || field_c >= max_trig_in_cluster_size)
+            {
+                std::cerr << "leaf node cannot fit!" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            return 0x8000 | (field_b << field_c_bits) | field_c;
+        }
+        case child_type_t::SWITCH:
+        {
+            size_t field_bc = layout.cluster_idx_map[left_node_idx] - layout.child_cluster_offsets[layout.cluster_idx_map[node_idx]];
+            if (field_bc >= max_cluster_size)
+            {
+                std::cerr << "switch node cannot fit!" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            return field_bc;
+        }
+        case child_type_t::EMPTY:
+            // get_child_data is only called on real children, padding slots are filled with empty_child_data directly
+            assert(false);
+            return empty_child_data;
+        }
+        return 0;
+    }
+
+    // fill clusters[i], and the triangles of its leaves at layout.trig_offsets[i]
+    static void fill_cluster(const cluster_layout_t &layout, const bvh_t &bvh, const std::vector<trig_t> &trigs, int i,
+                             size_t node_offset, int_cluster_t *clusters, trig_t *int_trigs, size_t *primitive_indices)
+    {
+        for (int j = 0; j < 6; j++)
+            clusters[i].ref_bounds[j] = bvh.nodes[layout.ref_indices[i]].bounds[j];
+        clusters[i].inv_sx_inv_sw = inv_sw / layout.scaling_factors[i];
+        clusters[i].node_offset = node_offset;
+        clusters[i].trig_offset = layout.trig_offsets[i];
+        clusters[i].child_cluster_offset = layout.child_cluster_offsets[i];
+
+        for (size_t curr_node_idx : layout.cluster_node_indices[i])
+        {
+            const node_t &curr_node = bvh.nodes[curr_node_idx];
+            if (!curr_node.is_leaf())
+                continue;
+
+            size_t trig_offset = layout.trig_offsets[i] + layout.local_trig_idx_map[curr_node_idx];
+            for (unsigned int j = 0; j < curr_node.primitive_count; j++)
+            {
+                size_t trig_idx = bvh.primitive_indices[curr_node.first_child_or_primitive + j];
+                int_trigs[trig_offset + j] = trigs[trig_idx];
+                primitive_indices[trig_offset + j] = trig_idx;
+            }
+        }
+    }
+
+    int_bvh_t build_int_bvh(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
+                            const bvh_t &bvh, size_t max_ref_depth)
+    {
+        cluster_layout_t layout = get_cluster_layout(t_trv_int, t_switch, t_ist, bvh, max_ref_depth);
+
+        // fill int_bvh
+        int_bvh_t int_bvh;
+        int_bvh.num_clusters = layout.num_clusters;
+        int_bvh.num_nodes = layout.node_offsets[layout.num_clusters];
+        int_bvh.num_trigs = layout.trig_offsets[layout.num_clusters];
+        int_bvh.clusters = std::make_unique<int_cluster_t[]>(layout.num_clusters);
+        int_bvh.trigs = std::make_unique<trig_t[]>(int_bvh.num_trigs);
+        int_bvh.nodes = std::make_unique<int_node_t[]>(int_bvh.num_nodes);
+        int_bvh.primitive_indices = std::make_unique<size_t[]>(int_bvh.num_trigs);
+
+        for (int i = 0; i < layout.num_clusters; i++)
+        {
+            fill_cluster(layout, bvh, trigs, i, layout.node_offsets[i],
+                         int_bvh.clusters.get(), int_bvh.trigs.get(), int_bvh.primitive_indices.get());
+
+            // fill int_bvh.nodes
+            for (size_t curr_node_idx : layout.cluster_node_indices[i])
+            {
+                int_node_t &curr_int_node = int_bvh.nodes[layout.node_offsets[i] + layout.local_node_idx_map[curr_node_idx]];
+
+                int_bounds_t bounds = get_int_bounds(bvh, curr_node_idx, layout.ref_indices[i],
+                                                     layout.scaling_factors[i]);
+                set_int_bounds(curr_int_node.bounds, bounds);
+                curr_int_node.data = get_child_data(layout, bvh, curr_node_idx);
+            }
+        }
+        if (trig_quant_bits != 0)
+            int_bvh.qtrigs = quantize_trigs(int_bvh.num_clusters, int_bvh.clusters.get(), int_bvh.num_trigs, int_bvh.trigs.get());
+        if (trig_format == trig_format_t::XFORM)
+            int_bvh.xforms = transform_trigs(int_bvh.num_trigs, int_bvh.trigs.get());
+        print_line_stats(layout.line_stats);
+
+        return int_bvh;
+    }
+
+    int_bvh_v2_t build_int_bvh_v2(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
+                                  const bvh_t &bvh, size_t max_ref_depth)
+    {
+        cluster_layout_t layout = get_cluster_layout(t_trv_int, t_switch, t_ist, bvh, max_ref_depth);
+
+        // fill int_bvh_v2, one paired node at the local index of each left child
+        int_bvh_v2_t int_bvh_v2;
+        int_bvh_v2.num_clusters = layout.num_clusters;
+        int_bvh_v2.num_nodes = layout.node_offsets[layout.num_clusters];
+        int_bvh_v2.num_trigs = layout.trig_offsets[layout.num_clusters];
+        int_bvh_v2.clusters = std::make_unique<int_cluster_t[]>(layout.num_clusters);
+        int_bvh_v2.trigs = std::make_unique<trig_t[]>(int_bvh_v2.num_trigs);
+        int_bvh_v2.nodes_v2 = std::make_unique<int_node_v2_t[]>(int_bvh_v2.num_nodes);
+        int_bvh_v2.primitive_indices = std::make_unique<size_t[]>(int_bvh_v2.num_trigs);
+
+        for (int i = 0; i < layout.num_clusters; i++)
+        {
+            fill_cluster(layout, bvh, trigs, i, layout.node_offsets[i],
+                         int_bvh_v2.clusters.get(), int_bvh_v2.trigs.get(), int_bvh_v2.primitive_indices.get());
+
+            // siblings are always pushed together, so even positions hold left children
+            const std::vector<size_t> &cluster_node_indices = layout.cluster_node_indices[i];
+            for (size_t j = 0; j < cluster_node_indices.size(); j += 2)
+            {
+                size_t left_node_idx = cluster_node_indices[j];
+                size_t right_node_idx = cluster_node_indices[j + 1];
+                int_node_v2_t &curr_node_v2 = int_bvh_v2.nodes_v2[layout.node_offsets[i] + layout.local_node_idx_map[left_node_idx]];
+
+                int_bounds_t left_bounds = get_int_bounds(bvh, left_node_idx, layout.ref_indices[i],
+                                                          layout.scaling_factors[i]);
+                int_bounds_t right_bounds = get_int_bounds(bvh, right_node_idx, layout.ref_indices[i],
+                                                           layout.scaling_factors[i]);
+                set_int_bounds(curr_node_v2.left_bounds, left_bounds);
+                set_int_bounds(curr_node_v2.right_bounds, right_bounds);
+                curr_node_v2.left_child_data = get_child_data(layout, bvh, left_node_idx);
+                curr_node_v2.right_child_data = get_child_data(layout, bvh, right_node_idx);
+            }
+        }
+        if (trig_quant_bits != 0)
+            int_bvh_v2.qtrigs = quantize_trigs(int_bvh_v2.num_clusters, int_bvh_v2.clusters.get(), int_bvh_v2.num_trigs,
+                                               int_bvh_v2.trigs.get());
+        if (trig_format == trig_format_t::XFORM)
+            int_bvh_v2.xforms = transform_trigs(int_bvh_v2.num_trigs, int_bvh_v2.trigs.get());
+        print_line_stats(layout.line_stats);
+
+        return int_bvh_v2;
+    }
+
+    template <int N>
+    int_bvh_wide_t<N> build_int_bvh_wide(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
+                                         const bvh_t &bvh, size_t max_ref_depth)
+    {
+        cluster_layout_t layout = get_cluster_layout(t_trv_int, t_switch, t_ist, bvh, max_ref_depth, N);
+
+        // every wide node is rooted at a distinct internal node of the binary tree
+        int_bvh_wide_t<N> int_bvh_wide;
+        int_bvh_wide.num_clusters = layout.num_clusters;
+        int_bvh_wide.num_trigs = layout.trig_offsets[layout.num_clusters];
+        int_bvh_wide.clusters = std::make_unique<int_cluster_t[]>(layout.num_clusters);
+        int_bvh_wide.trigs = std::make_unique<trig_t[]>(int_bvh_wide.num_trigs);
+        int_bvh_wide.primitive_indices = std::make_unique<size_t[]>(int_bvh_wide.num_trigs);
+
+        // padding slots have only EMPTY children
+        constexpr size_t node_length = sizeof(int_node_wide_t<N>);
+        int_node_wide_t<N> empty_node{};
+        for (int j = 0; j < N; j++)
+            empty_node.children[j].data = empty_child_data;
+        std::vector<int_node_wide_t<N>> nodes;
+        nodes.reserve((bvh.node_count + 1) / 2);
+        line_stats_t line_stats = layout.line_stats;
+        line_stats.node_straddles_before = line_stats.node_straddles = line_stats.node_padding = 0;
+        line_stats.node_visit_straddles_before = line_stats.node_visit_straddles = 0.0;
+        line_stats.node_visit_shared_lines_before = line_stats.node_visit_shared_lines = 0.0;
+
+        size_t node_cursor = 0;
+        size_t unpadded_node_cursor = 0;
+        for (int i = 0; i < layout.num_clusters; i++)
+        {
+            wide_cluster_t wide = place_wide_cluster(layout, bvh, i, N, node_length, node_cursor, line_stats.node_padding);
+            fill_cluster(layout, bvh, trigs, i, wide.node_offset,
+                         int_bvh_wide.clusters.get(), int_bvh_wide.trigs.get(), int_bvh_wide.primitive_indices.get());
+            nodes.resize(node_cursor, empty_node);
+
+            for (size_t k = 0; k < wide.roots.size(); k++)
+            {
+                const std::vector<size_t> &child_indices = wide.children[k];
+                int_node_wide_t<N> &curr_node = nodes[wide.slots[k]];
+
+                size_t next_child_node = 0;
+                for (int j = 0; j < N; j++)
+                {
+                    int_node_t &curr_child = curr_node.children[j];
+                    if (j >= (int)child_indices.size())
+                    {
+                        curr_child = int_node_t{};
+                        curr_child.data = empty_child_data;
+                        continue;
+                    }
+
+                    size_t child_idx = child_indices[j];
+                    int_bounds_t bounds = get_int_bounds(bvh, child_idx, layout.ref_indices[i],
+                                                         layout.scaling_factors[i]);
+                    set_int_bounds(curr_child.bounds, bounds);
+
+                    if (!bvh.nodes[child_idx].is_leaf() && layout.policy[child_idx] == policy_t::STAY)
+                    {
+                        size_t field_c = wide.slots[wide.child_nodes[k][next_child_node++]] - wide.node_offset;
+                        if (field_c >= max_node_in_cluster_size)
+                        {
+                            std::cerr << "internal node cannot fit!" << std::endl;
+                            exit(EXIT_FAILURE);
+                        }
+                        curr_child.data = 0x8000 | field_c;
+                    }
+                    else
+                    {
+                        curr_child.data = get_child_data(layout, bvh, child_idx);
+                    }
+                }
+
+                size_t straddles_before = count_straddles(unpadded_node_cursor + k, 1, node_length);
+                size_t straddles = count_straddles(wide.slots[k], 1, node_length);
+                line_stats.node_straddles_before += straddles_before;
+                line_stats.node_straddles += straddles;
+                line_stats.node_visit_straddles_before += wide.heats[k] * straddles_before;
+                line_stats.node_visit_straddles += wide.heats[k] * straddles;
+                for (size_t c : wide.child_nodes[k])
+                {
+                    bool shared_before = get_line(unpadded_node_cursor + c, node_length) ==
+                                         get_line(unpadded_node_cursor + k, node_length);
+                    bool shared = get_line(wide.slots[c], node_length) == get_line(wide.slots[k], node_length);
+                    line_stats.node_visit_shared_lines_before += wide.heats[c] * shared_before;
+                    line_stats.node_visit_shared_lines += wide.heats[c] * shared;
+                }
+            }
+            unpadded_node_cursor += wide.roots.size();
+        }
+        int_bvh_wide.num_nodes = nodes.size();
+        int_bvh_wide.nodes = std::make_unique<int_node_wide_t<N>[]>(nodes.size());
+        std::copy(nodes.begin(), nodes.end(), int_bvh_wide.nodes.get());
+        if (trig_quant_bits != 0)
+            int_bvh_wide.qtrigs = quantize_trigs(int_bvh_wide.num_clusters, int_bvh_wide.clusters.get(), int_bvh_wide.num_trigs,
+                                                 int_bvh_wide.trigs.get());
+        if (trig_format == trig_format_t::XFORM)
+            int_bvh_wide.xforms = transform_trigs(int_bvh_wide.num_trigs, int_bvh_wide.trigs.get());
+        print_line_stats(line_stats);
+
+        return int_bvh_wide;
+    }
+
+    template int_bvh_wide_t<2> build_int_bvh_wide<2>(float, float, float, const std::vector<trig_t> &, const bvh_t &, size_t);
+    template int_bvh_wide_t<4> build_int_bvh_wide<4>(float, float, float, const std::vector<trig_t> &, const bvh_t &, size_t);
+    template int_bvh_wide_t<6> build_int_bvh_wide<6>(float, float, float, const std::vector<trig_t> &, const bvh_t &, size_t);
+    template int_bvh_wide_t<8> build_int_bvh_wide<8>(float, float, float, const std::vector<trig_t> &, const bvh_t &, size_t);
+
+    // refits cluster i of int_bvh after all of its child clusters, see refit_int_bvh
+    template <typename int_bvh_T>
+    static void refit_cluster(const std::vector<trig_t> &trigs, int_bvh_T &int_bvh, int i)
+    {
+        typedef int_nodes_t<int_bvh_T> nodes_t;
+        constexpr int width = nodes_t::width;
+
+        int_cluster_t &cluster = int_bvh.clusters[i];
+        typename nodes_t::type *local_nodes = nodes_t::get(int_bvh) + cluster.node_offset;
+        size_t node_end = i + 1 < int_bvh.num_clusters ? int_bvh.clusters[i + 1].node_offset : int_bvh.num_nodes;
+
+        // post-order over the nodes reachable from the cluster root, so children are refit before their parents
+        std::vector<bbox_t> child_bboxes((node_end - cluster.node_offset) * width, bbox_t::empty());
+        std::vector<uint16_t> post_order;
+        std::vector<std::pair<uint16_t, bool>> stk = {{0, false}};
+        while (!stk.empty())
+        {
+            auto [local_node_idx, expanded] = stk.back();
+            typename nodes_t::type &curr_node = local_nodes[local_node_idx];
+            if (!expanded)
+            {
+                stk.back().second = true;
+                for (int j = 0; j < width; j++)
+                {
+                    decoded_data_t decoded_data = decode_data(nodes_t::child_data(curr_node, j));
+                    if (decoded_data.child_type == child_type_t::INTERNAL)
+                        stk.emplace_back(decoded_data.idx, false);
+                }
+                continue;
+            }
+            stk.pop_back();
+            post_order.push_back(local_node_idx);
+
+            for (int j = 0; j < width; j++)
+            {
+                decoded_data_t decoded_data = decode_data(nodes_t::child_data(curr_node, j));
+                bbox_t &bbox = child_bboxes[local_node_idx * width + j];
+                switch (decoded_data.child_type)
+                {
+                case child_type_t::INTERNAL:
+                    for (int k = 0; k < width; k++)
+                        bbox.extend(child_bboxes[decoded_data.idx * width + k]);
+                    break;
+                case child_type_t::LEAF:
+                    for (int k = 0; k < decoded_data.num_trigs; k++)
+                    {
+                        size_t trig_idx = cluster.trig_offset + decoded_data.idx + k;
+                        assert(int_bvh.primitive_indices[trig_idx] < trigs.size());
+                        int_bvh.trigs[trig_idx] = trigs[int_bvh.primitive_indices[trig_idx]];
+                        bbox.extend(int_bvh.trigs[trig_idx].bounding_box());
+                    }
+                    break;
+                case child_type_t::SWITCH:
+                {
+                    // the reference node of a child cluster is the SWITCH child itself
+                    const float *ref_bounds = int_bvh.clusters[cluster.child_cluster_offset + decoded_data.idx].ref_bounds;
+                    bbox.extend(bbox_t(vector_t(ref_bounds[0], ref_bounds[2], ref_bounds[4]),
+                                       vector_t(ref_bounds[1], ref_bounds[3], ref_bounds[5])));
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+        }
+
+        bbox_t ref_bbox = bbox_t::empty();
+        for (int j = 0; j < width; j++)
+            ref_bbox.extend(child_bboxes[j]);
+        float scaling_factor = get_scaling_factor(ref_bbox);
+        for (int j = 0; j < 3; j++)
+        {
+            cluster.ref_bounds[2 * j] = ref_bbox.min[j];
+            cluster.ref_bounds[2 * j + 1] = ref_bbox.max[j];
+        }
+        cluster.inv_sx_inv_sw = inv_sw / scaling_factor;
+
+        for (uint16_t local_node_idx : post_order)
+        {
+            typename nodes_t::type &curr_node = local_nodes[local_node_idx];
+            for (int j = 0; j < width; j++)
+            {
+                if (nodes_t::child_data(curr_node, j) == empty_child_data)
+                    continue;
+                int_bounds_t bounds = get_int_bounds(child_bboxes[local_node_idx * width + j], ref_bbox, scaling_factor);
+                set_int_bounds(nodes_t::child_bounds(curr_node, j), bounds);
+            }
+        }
+    }
+
+    template <typename int_bvh_T>
+    void refit_int_bvh(const std::vector<trig_t> &trigs, int_bvh_T &int_bvh)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        // clusters are numbered breadth-first and the children of cluster k are
+        // [child_cluster_offset of k, child_cluster_offset of k + 1), so the level after the one
+        // starting at cluster k starts at the child_cluster_offset of k
+        std::vector<int> level_starts = {0};
+        while (level_starts.back() < int_bvh.num_clusters)
+        {
+            int next_level_start = int_bvh.clusters[level_starts.back()].child_cluster_offset;
+            if (next_level_start <= level_starts.back())
+            {
+                std::cerr << "int_bvh clusters are not numbered breadth-first, cannot refit" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            level_starts.push_back(std::min(next_level_start, int_bvh.num_clusters));
+        }
+
+        for (size_t level = level_starts.size() - 1; level-- > 0;)
+        {
+#pragma omp parallel for schedule(dynamic)
+            for (int i = level_starts[level]; i < level_starts[level + 1]; i++)
+                refit_cluster(trigs, int_bvh, i);
+        }
+        if (trig_quant_bits != 0)
+            int_bvh.qtrigs = quantize_trigs(int_bvh.num_clusters, int_bvh.clusters.get(), int_bvh.num_trigs, int_bvh.trigs.get());
+        if (trig_format == trig_format_t::XFORM)
+            int_bvh.xforms = transform_trigs(int_bvh.num_trigs, int_bvh.trigs.get());
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        printf("(ycpin) Refit INT BVH: %d clusters in %zu levels, %.1f ms\n", int_bvh.num_clusters, level_starts.size() - 1,
+               elapsed.count());
+    }
+
+    template void refit_int_bvh<int_bvh_v2_t>(const std::vector<trig_t> &, int_bvh_v2_t &);
+    template void refit_int_bvh<int_bvh_wide_t<2>>(const std::vector<trig_t> &, int_bvh_wide_t<2> &);
+    template void refit_int_bvh<int_bvh_wide_t<4>>(const std::vector<trig_t> &, int_bvh_wide_t<4> &);
+    template void refit_int_bvh<int_bvh_wide_t<6>>(const std::vector<trig_t> &, int_bvh_wide_t<6> &);
+    template void refit_int_bvh<int_bvh_wide_t<8>>(const std::vector<trig_t> &, int_bvh_wide_t<8> &);
+
+    bbox_t get_ref_bbox(const int_cluster_t &cluster)
+    {
+        bbox_t bbox;
+        for (int i = 0; i < 3; i++)
+        {
+            bbox.min[i] = cluster.ref_bounds[2 * i];
+            bbox.max[i] = cluster.ref_bounds[2 * i + 1];
+        }
+        return bbox;
+    }
 
-            uint16_t left_child_data = curr_node_v2.left_child_data;
-            decoded_data_t left_decoded_data = decode_data(left_child_data);
+    // bounds of the transformed box, widened by a few ulps so the transformed vertices stay inside
+    static bbox_t transform_bbox(const bbox_t &bbox, const float m[3][4])
+    {
+        bbox_t ret;
+        for (int i = 0; i < 3; i++)
+        {
+            ret.min[i] = ret.max[i] = m[i][3];
+            for (int j = 0; j < 3; j++)
+            {
+                float lo = m[i][j] * bbox.min[j];
+                float hi = m[i][j] * bbox.max[j];
+                ret.min[i] += std::min(lo, hi);
+                ret.max[i] += std::max(lo, hi);
+            }
+            float eps = 4.0f * std::numeric_limits<float>::epsilon() * (std::abs(ret.min[i]) + std::abs(ret.max[i]));
+            ret.min[i] -= eps;
+            ret.max[i] += eps;
+        }
+        return ret;
+    }
+
+    int_tlas_t build_int_tlas(const std::vector<int_instance_t> &instances, const std::vector<bbox_t> &blas_bboxes)
+    {
+        constexpr int N = INT_BVH_WIDTH;
+        int_tlas_t int_tlas;
+        size_t num_instances = instances.size();
+        if (num_instances == 0)
+            return int_tlas;
+        if (num_instances > max_node_in_cluster_size)
+        {
+            std::cerr << "too many instances for the INT TLAS: " << num_instances << " > " << max_node_in_cluster_size
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        auto bboxes = std::make_unique<bbox_t[]>(num_instances);
+        auto centers = std::make_unique<vector_t[]>(num_instances);
+        bbox_t global_bbox = bbox_t::empty();
+        for (size_t i = 0; i < num_instances; i++)
+        {
+            bboxes[i] = transform_bbox(blas_bboxes[instances[i].blas_idx], instances[i].object_to_world);
+            centers[i] = bboxes[i].center();
+            global_bbox.extend(bboxes[i]);
+        }
+
+        bvh_t bvh;
+        builder_t builder(bvh);
+        builder.max_leaf_size = max_trig_in_leaf_size;
+        builder.build(global_bbox, bboxes.get(), centers.get(), num_instances);
+
+        // one cluster referenced to the root, every internal node stays
+        std::vector<policy_t> policy(bvh.node_count, policy_t::STAY);
+        const size_t root_idx = 0;
+        float scaling_factor = get_scaling_factor(bvh, root_idx);
+
+        std::vector<int_node_wide_t<N>> nodes;
+        std::vector<size_t> wide_roots = {root_idx};
+        for (size_t k = 0; k < wide_roots.size(); k++)
+        {
+            std::vector<size_t> child_indices = bvh.nodes[wide_roots[k]].is_leaf()
+                                                    ? std::vector<size_t>{wide_roots[k]}
+                                                    : collapse_children(bvh, policy, wide_roots[k], N);
+            int_node_wide_t<N> node{};
+            for (int j = 0; j < N; j++)
+            {
+                int_node_t &curr_child = node.children[j];
+                curr_child.data = empty_child_data;
+                if (j >= (int)child_indices.size())
+                    continue;
+
+                size_t child_idx = child_indices[j];
+                const node_t &child = bvh.nodes[child_idx];
+                set_int_bounds(curr_child.bounds, get_int_bounds(bvh, child_idx, root_idx, scaling_factor));
+                if (child.is_leaf())
+                {
+                    curr_child.data = 0x8000 | (child.primitive_count << field_c_bits) | child.first_child_or_primitive;
+                }
+                else
+                {
+                    if (wide_roots.size() >= max_node_in_cluster_size)
+                    {
+                        std::cerr << "internal node cannot fit!" << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                    curr_child.data = 0x8000 | wide_roots.size();
+                    wide_roots.push_back(child_idx);
+                }
+            }
+            nodes.push_back(node);
+        }
+
+        for (int j = 0; j < 6; j++)
+            int_tlas.cluster.ref_bounds[j] = bvh.nodes[root_idx].bounds[j];
+        int_tlas.cluster.inv_sx_inv_sw = inv_sw / scaling_factor;
+        int_tlas.num_nodes = nodes.size();
+        int_tlas.nodes = std::make_unique<int_node_wide_t<N>[]>(nodes.size());
+        std::copy(nodes.begin(), nodes.end(), int_tlas.nodes.get());
+        for (size_t i = 0; i < num_instances; i++)
+            int_tlas.instances.push_back(instances[bvh.primitive_indices[i]]);
+
+        printf("(ycpin) Build INT TLAS: %zu instances, %zu nodes\n", num_instances, int_tlas.num_nodes);
+        return int_tlas;
+    }
+
+    decoded_data_t decode_data(uint16_t data)
+    {
+        decoded_data_t decoded_data{};
+        if (data == empty_child_data)
+        {
+            decoded_data.child_type = child_type_t::EMPTY;
+        }
+        else if (data & 0x8000)
+        {
+            int field_b = ((data & 0x7fff) >> field_c_bits);
+            int field_c = (data & ((1 << field_c_bits) - 1));
+            if (field_b == 0)
+            {
+                decoded_data.child_type = child_type_t::INTERNAL;
+            }
+            else
+            {
+                decoded_data.child_type = child_type_t::LEAF;
+                decoded_data.num_trigs = field_b;
+            }
+            decoded_data.idx = field_c;
+        }
+        else
+        {
+            decoded_data.child_type = child_type_t::SWITCH;
+            decoded_data.idx = data;
+        }
+        return decoded_data;
+    }
+
+    // inverse of get_packed, bytes must hold (count * bits + 7) / 8 bytes
+    static void set_packed(uint8_t *bytes, const uint16_t *values, int count, int bits)
+    {
+        std::memset(bytes, 0, (count * bits + 7) / 8);
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t first_bit = i * bits;
+            for (int j = 0; j < bits; j++)
+            {
+                if ((values[i] >> j) & 1)
+                    bytes[(first_bit + j) / 8] |= 1 << ((first_bit + j) % 8);
+            }
+        }
+    }
+
+    void set_int_bounds(uint8_t *bounds, const int_bounds_t &int_bounds)
+    {
+        if (quant_bits == 8)
+        {
+            for (int i = 0; i < 6; i++)
+                bounds[i] = static_cast<uint8_t>(int_bounds[i]);
+            return;
+        }
+        set_packed(bounds, int_bounds.data(), 6, quant_bits);
+    }
+
+    std::unique_ptr<int_qtrig_t[]> quantize_trigs(int num_clusters, const int_cluster_t *clusters, size_t num_trigs,
+                                                  const trig_t *trigs)
+    {
+        auto qtrigs = std::make_unique<int_qtrig_t[]>(num_trigs);
+        double max_error = 0.0;
+        size_t num_unbounded = 0;
+
+        // clusters own consecutive triangle ranges in cluster order
+#pragma omp parallel for schedule(dynamic) reduction(max : max_error) reduction(+ : num_unbounded)
+        for (int i = 0; i < num_clusters; i++)
+        {
+            size_t trig_end = i + 1 < num_clusters ? clusters[i + 1].trig_offset : num_trigs;
+            qtrig_frame_t frame = get_qtrig_frame(clusters[i]);
+
+            for (size_t trig_idx = clusters[i].trig_offset; trig_idx < trig_end; trig_idx++)
+            {
+                const trig_t &trig = trigs[trig_idx];
+                const vector_t v[3] = {trig.p0, trig.p1(), trig.p2()};
+
+                // spatial splits clip references to their leaf, so the whole triangle may lie outside the
+                // reference node; so do the zero triangles of line padding slots
+                bool inside = true;
+                for (int k = 0; k < 3; k++)
+                    for (int j = 0; j < 3; j++)
+                        inside &= clusters[i].ref_bounds[2 * j] <= v[k][j] && v[k][j] <= clusters[i].ref_bounds[2 * j + 1];
+                if (!inside)
+                {
+                    const uint16_t unbounded[9] = {qv_max, qv_max, qv_max, qv_max, qv_max, qv_max, qv_max, qv_max, qv_max};
+                    set_packed(qtrigs[trig_idx].v, unbounded, 9, trig_quant_bits);
+                    num_unbounded++;
+                    continue;
+                }
+
+                uint16_t values[9];
+                for (int k = 0; k < 3; k++)
+                {
+                    for (int j = 0; j < 3; j++)
+                    {
+                        double q = frame.scale[j] > 0.0f ? std::round((static_cast<double>(v[k][j]) - frame.lo[j]) / frame.scale[j]) : 0.0;
+                        values[3 * k + j] = static_cast<uint16_t>(std::clamp(q, 0.0, static_cast<double>(qv_max)));
+                    }
+                }
+                set_packed(qtrigs[trig_idx].v, values, 9, trig_quant_bits);
+
+                float p[3][3];
+                get_qtrig_vertices(qtrigs[trig_idx], frame, p);
+                for (int k = 0; k < 3; k++)
+                {
+                    double error = std::sqrt(std::pow(p[k][0] - v[k][0], 2) + std::pow(p[k][1] - v[k][1], 2) + std::pow(p[k][2] - v[k][2], 2));
+                    if (error > frame.r)
+                    {
+                        std::cerr << "quantized triangle " << trig_idx << " is off by " << error << " > " << frame.r << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                    max_error = std::max(max_error, error / frame.r);
+                }
+            }
+        }
+
+        printf("(ycpin) Quantized triangles: %d-bit, %d bytes (was %d), worst vertex error %.2f of bound, %zu unbounded\n",
+               trig_quant_bits, INT_BVH_QTRIG_length, INT_BVH_TRIG_length, max_error, num_unbounded);
+        return qtrigs;
+    }
+
+    std::unique_ptr<int_trig_xform_t[]> transform_trigs(size_t num_trigs, const trig_t *trigs)
+    {
+        auto xforms = std::make_unique<int_trig_xform_t[]>(num_trigs);
+        size_t num_degenerate = 0;
+        auto cross = [](const double *x, const double *y, double *z)
+        {
+            z[0] = x[1] * y[2] - x[2] * y[1];
+            z[1] = x[2] * y[0] - x[0] * y[2];
+            z[2] = x[0] * y[1] - x[1] * y[0];
+        };
+
+        // inverse of the matrix with columns a = p1 - p0, b = p2 - p0 and n = a x b, whose rows are
+        // (b x n, n x a, n) / |n|^2 as n is orthogonal to a and b; in double so that only the result is rounded
+#pragma omp parallel for schedule(static) reduction(+ : num_degenerate)
+        for (int64_t i = 0; i < static_cast<int64_t>(num_trigs); i++)
+        {
+            const trig_t &trig = trigs[i];
+            const vector_t p1 = trig.p1();
+            const vector_t p2 = trig.p2();
+            double p0[3], a[3], b[3];
+            for (int j = 0; j < 3; j++)
+            {
+                p0[j] = trig.p0[j];
+                a[j] = static_cast<double>(p1[j]) - p0[j];
+                b[j] = static_cast<double>(p2[j]) - p0[j];
+            }
+            double rows[3][3];
+            cross(a, b, rows[2]);
+            double n2 = rows[2][0] * rows[2][0] + rows[2][1] * rows[2][1] + rows[2][2] * rows[2][2];
+
+            int_trig_xform_t &xform = xforms[i];
+            if (!(n2 > 0.0) || !std::isfinite(n2))
+            {
+                // also the zero triangles of line padding slots
+                xform = int_trig_xform_t{};
+                num_degenerate++;
+                continue;
+            }
+            cross(b, rows[2], rows[0]);
+            cross(rows[2], a, rows[1]);
+            for (int k = 0; k < 3; k++)
+            {
+                double offset = 0.0;
+                for (int j = 0; j < 3; j++)
+                {
+                    xform.m[k][j] = static_cast<float>(rows[k][j] / n2);
+                    offset -= rows[k][j] / n2 * p0[j];
+                }
+                xform.m[k][3] = static_cast<float>(offset);
+            }
+        }
 
-            size_t left_child_index = i;
-            size_t right_child_index = i + 1;
+        printf("(ycpin) Transformed triangles: %d bytes (was %d), %zu degenerate\n", INT_BVH_TRIG_length,
+               static_cast<int>(sizeof(triangle_t)), num_degenerate);
+        return xforms;
+    }
+
+    int_bvh_v2_t convert_nodes(int_bvh_t &&int_bvh)
+    {
+        int_bvh_v2_t int_bvh_v2;
 
-            int_node_t &left_child = int_bvh.nodes[left_child_index];
-            int_node_t &right_child = int_bvh.nodes[right_child_index];
+        // clusters, triangles and primitive indices are laid out identically
+        int_bvh_v2.num_clusters = int_bvh.num_clusters;
+        int_bvh_v2.num_nodes = int_bvh.num_nodes;
+        int_bvh_v2.num_trigs = int_bvh.num_trigs;
+        int_bvh_v2.clusters = std::move(int_bvh.clusters);
+        int_bvh_v2.trigs = std::move(int_bvh.trigs);
+        int_bvh_v2.primitive_indices = std::move(int_bvh.primitive_indices);
+        int_bvh_v2.qtrigs = std::move(int_bvh.qtrigs);
+        int_bvh_v2.xforms = std::move(int_bvh.xforms);
+
+        // pair every left child with its right sibling, skipping the unused last slot
+        int_bvh_v2.nodes_v2 = std::make_unique<int_node_v2_t[]>(int_bvh.num_nodes);
+        for (size_t i = 0; i + 1 < int_bvh.num_nodes; i++)
+        {
+            int_node_v2_t &curr_node_v2 = int_bvh_v2.nodes_v2[i];
+            const int_node_t &left_child = int_bvh.nodes[i];
+            const int_node_t &right_child = int_bvh.nodes[i + 1];
 
-            std::memcpy(curr_node_v2.left_bounds, left_child.bounds, sizeof(uint8_t) * 6);
-            std::memcpy(curr_node_v2.right_bounds, right_child.bounds, sizeof(uint8_t) * 6);
+            std::memcpy(curr_node_v2.left_bounds, left_child.bounds, sizeof(left_child.bounds));
+            std::memcpy(curr_node_v2.right_bounds, right_child.bounds, sizeof(right_child.bounds));
             curr_node_v2.left_child_data = left_child.data;
             curr_node_v2.right_child_data = right_child.data;
         }
+        int_bvh.nodes.reset();
 
         return int_bvh_v2;
     }
@@ -6,6 +6,13 @@
 #include <vector>
 #include <bvh/triangle.hpp>
 #include <bvh/sweep_sah_builder.hpp>
+#include <bvh/binned_sah_builder.hpp>
+#include <bvh/locally_ordered_clustering_builder.hpp>
+#include <bvh/linear_bvh_builder.hpp>
+#include <bvh/spatial_split_bvh_builder.hpp>
+#include <bvh/heuristic_primitive_splitter.hpp>
+#include <bvh/bottom_up_algorithm.hpp>
+#include <bvh/parallel_reinsertion_optimizer.hpp>
 #include <array>
 #include <cassert>
 #include <queue>
@@ -13,12 +20,54 @@
 #include <memory>
 #include <string>
 #include <tuple>
+#include <limits>
+#include <cstring>
+#include <type_traits>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
 
 #define INT_BVH_ALIGNMENT 64
-#define INT_BVH_CLUSTER_length 36
+#define INT_BVH_CLUSTER_length 40
+// device layout of the int_bvh_trigs entries (0 = vertices, 1 = precomputed transform), see int_trig_xform_t
+#ifndef INT_BVH_TRIG_FORMAT
+#define INT_BVH_TRIG_FORMAT 0
+#endif
+#if INT_BVH_TRIG_FORMAT == 1
+#define INT_BVH_TRIG_length 48
+#else
 #define INT_BVH_TRIG_length 36
-#define INT_BVH_NODE_length 16
+#endif
+// number of children per quantized node, see int_node_wide_t
+#ifndef INT_BVH_WIDTH
+#define INT_BVH_WIDTH 2
+#endif
+// bits per quantized child bound, see get_qx
+#ifndef INT_BVH_QUANT_BITS
+#define INT_BVH_QUANT_BITS 8
+#endif
+#define INT_BVH_BOUNDS_length ((6 * INT_BVH_QUANT_BITS + 7) / 8)
+#define INT_BVH_NODE_length ((INT_BVH_BOUNDS_length + 2) * INT_BVH_WIDTH)
 #define INT_BVH_PRIMITIVE_INSTANCE_length 8
+// bits per quantized triangle vertex coordinate, 0 stores full-precision triangles only, see int_qtrig_t
+#ifndef INT_BVH_TRIG_QUANT_BITS
+#define INT_BVH_TRIG_QUANT_BITS 0
+#endif
+#define INT_BVH_QTRIG_length ((9 * INT_BVH_TRIG_QUANT_BITS + 7) / 8)
+#define INT_BVH_BLAS_length 64
+#define INT_BVH_INSTANCE_length 112
+// default BVH builder (sweep_sah, binned_sah, ploc, lbvh, sbvh or presplit), see get_builder_type
+#ifndef INT_BVH_BUILDER
+#define INT_BVH_BUILDER sweep_sah
+#endif
+// rays of check_correctness (origin, direction and tmax, 7 floats each), overridden by the INT_BVH_RAY_FILE
+// environment variable (an empty value skips the check)
+#ifndef INT_BVH_RAY_FILE
+#define INT_BVH_RAY_FILE "../../../assets/ray/kitchen.ray"
+#endif
+#define INT_BVH_STRINGIFY_(x) #x
+#define INT_BVH_STRINGIFY(x) INT_BVH_STRINGIFY_(x)
 
 namespace bvh_quantize
 {
@@ -33,23 +82,114 @@ namespace bvh_quantize
     //   *: num_trigs
     //   -: trig_idx
     // for SWITCH:
-    //   -: child_cluster_idx
+    //   -: child_cluster_idx - int_cluster_t::child_cluster_offset of the current cluster
+    //
+    // Clusters are numbered so that the child clusters of every cluster are contiguous, hence
+    // SWITCH only needs to tell apart the children of one cluster and the total number of
+    // clusters is not limited by the 15-bit field.
 
     constexpr int field_b_bits = 3;
     constexpr int field_c_bits = 15 - field_b_bits;
     constexpr int max_node_in_cluster_size = (1 << field_c_bits);
     constexpr size_t max_trig_in_leaf_size = (1 << field_b_bits) - 1;
     constexpr int max_trig_in_cluster_size = max_node_in_cluster_size;
+    // most child clusters of one cluster
     constexpr int max_cluster_size = (1 << 15);
-    constexpr auto inv_sw = static_cast<float>(1 << 7);
-    constexpr int qx_max = (1 << 8) - 1;
+    // child bounds use quant_bits bits, the ray's inverse direction quant_bits - 1 mantissa bits
+    constexpr int quant_bits = INT_BVH_QUANT_BITS;
+    static_assert(4 <= quant_bits && quant_bits <= 12, "unsupported quantization bit width");
+    constexpr auto inv_sw = static_cast<float>(1 << (quant_bits - 1));
+    constexpr int qx_max = (1 << quant_bits) - 1;
+    // INTERNAL children never point to local node 0 (only SWITCH does), so this value is free
+    constexpr uint16_t empty_child_data = 0x8000;
+    // triangle vertices use trig_quant_bits per coordinate relative to the cluster's ref_bounds
+    constexpr int trig_quant_bits = INT_BVH_TRIG_QUANT_BITS;
+    static_assert(trig_quant_bits == 0 || (8 <= trig_quant_bits && trig_quant_bits <= 16),
+                  "unsupported triangle quantization bit width");
+    constexpr uint32_t qv_max = trig_quant_bits != 0 ? (1u << trig_quant_bits) - 1 : 1;
+    // VERTICES stores the three vertices (Moeller-Trumbore at every leaf test), XFORM the affine map onto
+    // the triangle's own frame (Baldwin-Weber, no cross products at leaf tests, 12 more bytes per triangle)
+    enum class trig_format_t : uint8_t
+    {
+        VERTICES,
+        XFORM
+    };
+    static_assert(0 <= INT_BVH_TRIG_FORMAT && INT_BVH_TRIG_FORMAT <= 1, "unsupported triangle format");
+    constexpr trig_format_t trig_format = static_cast<trig_format_t>(INT_BVH_TRIG_FORMAT);
+    // get_policy: 0 keeps every ancestor as a candidate reference node
+    constexpr size_t unbounded_ref_depth = 0;
+    // closest ancestors that are candidate reference nodes of get_policy in Generate, tune_costs and the
+    // bench (0 = unbounded), bounds the policy table to node_count * INT_BVH_MAX_REF_DEPTH entries
+#ifndef INT_BVH_MAX_REF_DEPTH
+#define INT_BVH_MAX_REF_DEPTH 0
+#endif
+    constexpr size_t ref_depth_limit = INT_BVH_MAX_REF_DEPTH;
+    // most padding slots inserted in front of a cluster root, node or leaf that is not hot to keep it within
+    // INT_BVH_ALIGNMENT lines. Line placement pads where it saves more than min_padding_heat straddling fetches
+    // per ray entering the cluster (by surface area) for every padding slot, see place_in_lines.
+    constexpr size_t max_line_padding = 2;
+#ifndef INT_BVH_MIN_PADDING_HEAT
+#define INT_BVH_MIN_PADDING_HEAT 0.03f
+#endif
+    constexpr float min_padding_heat = INT_BVH_MIN_PADDING_HEAT;
+    // share of the triangle tests (expected by surface area) of the hot leaves, the largest leaves, which line
+    // placement pads as far as it takes to start where they straddle the fewest lines (0 = no hot leaves)
+#ifndef INT_BVH_HOT_LEAF_SHARE
+#define INT_BVH_HOT_LEAF_SHARE 0.25f
+#endif
+    constexpr float hot_leaf_share = INT_BVH_HOT_LEAF_SHARE;
+    // most bytes of nodes and triangles per cluster (0 = unbounded), see limit_cluster_bytes
+#ifndef INT_BVH_CLUSTER_BYTES
+#define INT_BVH_CLUSTER_BYTES 0
+#endif
+    constexpr size_t max_cluster_bytes = INT_BVH_CLUSTER_BYTES;
+    // footprint of one triangle (with its quantized copy) within a cluster
+    constexpr size_t cluster_trig_bytes = INT_BVH_TRIG_length + (INT_BVH_TRIG_QUANT_BITS != 0 ? INT_BVH_QTRIG_length : 0);
+    // run optimize_bvh on every BLAS before clustering, off by default as it takes several times as long as
+    // the float build and changes the int_bvh layout
+#ifndef INT_BVH_OPTIMIZE
+#define INT_BVH_OPTIMIZE 0
+#endif
+    constexpr bool optimize_quant_cost = INT_BVH_OPTIMIZE;
+    // order of the nodes and leaves within a cluster before line placement, see get_node_order
+    // (0 = hottest first, 1 = depth-first, 2 = van Emde Boas)
+#ifndef INT_BVH_NODE_ORDER
+#define INT_BVH_NODE_ORDER 1
+#endif
+    // search the get_policy costs on rays sampled from each BLAS instead of using the defaults of Generate
+    // (0 = off, 1 = fewest traversal steps, 2 = fewest estimated fetched bytes), see tune_costs
+#ifndef INT_BVH_AUTOTUNE
+#define INT_BVH_AUTOTUNE 0
+#endif
+#ifndef INT_BVH_AUTOTUNE_RAYS
+#define INT_BVH_AUTOTUNE_RAYS 4096
+#endif
+    // rays per packet of int_traverse_v2_packet in check_correctness (0 = one ray at a time with
+    // int_traverse_v2), set IntBvhSimd to avx2 or avx512 to test nodes against a packet at once
+#ifndef INT_BVH_PACKET_SIZE
+#define INT_BVH_PACKET_SIZE 0
+#endif
+    // order in which the CPU traversals of check_correctness and tune_costs trace their rays (0 = as given,
+    // 1 = by direction octant, then Morton code of the origin), see get_ray_order
+#ifndef INT_BVH_RAY_ORDER
+#define INT_BVH_RAY_ORDER 0
+#endif
 
     typedef bvh::Bvh<float> bvh_t;
     typedef bvh::Triangle<float> trig_t;
     typedef bvh::Vector3<float> vector_t;
     typedef bvh::BoundingBox<float> bbox_t;
     typedef bvh::SweepSahBuilder<bvh_t> builder_t;
+    typedef bvh::BinnedSahBuilder<bvh_t, 16> binned_sah_builder_t;
+    typedef bvh::LocallyOrderedClusteringBuilder<bvh_t, uint32_t> ploc_builder_t;
+    typedef bvh::LinearBvhBuilder<bvh_t, uint32_t> lbvh_builder_t;
+    typedef bvh::SpatialSplitBvhBuilder<bvh_t, trig_t, 64> sbvh_builder_t;
+    typedef bvh::HeuristicPrimitiveSplitter<trig_t> primitive_splitter_t;
     typedef bvh_t::Node node_t;
+    // quantized ray distances (qb, qy_max) grow with 2^(2 * quant_bits), so bounds wider than
+    // 8 bits need a wider ray preprocessing datapath
+    typedef std::conditional<(quant_bits <= 8), int32_t, int64_t>::type int_dist_t;
+    typedef std::conditional<(quant_bits <= 8), float, double>::type int_dist_float_t;
 
     struct arg_t
     {
@@ -60,7 +200,62 @@ namespace bvh_quantize
         char *ray_file;
     };
 
-    enum class policy_t
+    // builders of the float BVH the int_bvh is derived from, from the best SAH quality to the
+    // fastest build (the bottom-up ploc and lbvh only make single-triangle leaves).
+    // sbvh (spatial splits) and presplit (sweep_sah over pre-split triangle boxes) reference
+    // long thin triangles from several leaves, each leaf gets its own copy of the triangle.
+    enum class builder_type_t : uint8_t
+    {
+        SWEEP_SAH,
+        BINNED_SAH,
+        PLOC,
+        LBVH,
+        SBVH,
+        PRESPLIT
+    };
+
+    // HEAT places the nodes most likely to be visited first. DFS follows the larger child first, so a
+    // node's hotter child tends to share its line. VEB stores the top half of the cluster's tree (by
+    // height) first, then each bottom subtree, recursively, so any root-to-leaf path touches few lines.
+    enum class node_order_t : uint8_t
+    {
+        HEAT,
+        DFS,
+        VEB
+    };
+    static_assert(0 <= INT_BVH_NODE_ORDER && INT_BVH_NODE_ORDER <= 2, "unsupported node order");
+    constexpr node_order_t node_order = static_cast<node_order_t>(INT_BVH_NODE_ORDER);
+
+    enum class autotune_t : uint8_t
+    {
+        OFF,
+        STEPS,
+        BYTES
+    };
+    static_assert(0 <= INT_BVH_AUTOTUNE && INT_BVH_AUTOTUNE <= 2, "unsupported autotune mode");
+    constexpr autotune_t autotune = static_cast<autotune_t>(INT_BVH_AUTOTUNE);
+    constexpr size_t autotune_rays = INT_BVH_AUTOTUNE_RAYS;
+    static_assert(INT_BVH_PACKET_SIZE == 0 || INT_BVH_PACKET_SIZE == 8 || INT_BVH_PACKET_SIZE == 16,
+                  "unsupported packet size");
+    constexpr size_t packet_size = INT_BVH_PACKET_SIZE;
+
+    enum class ray_order_t : uint8_t
+    {
+        INPUT,
+        MORTON
+    };
+    static_assert(0 <= INT_BVH_RAY_ORDER && INT_BVH_RAY_ORDER <= 1, "unsupported ray order");
+    constexpr ray_order_t ray_order = static_cast<ray_order_t>(INT_BVH_RAY_ORDER);
+
+    // costs of the get_policy model, only their ratios matter
+    struct cost_params_t
+    {
+        float t_trv_int;
+        float t_switch;
+        float t_ist;
+    };
+
+    enum class policy_t : uint8_t
     {
         STAY,
         SWITCH
@@ -70,7 +265,8 @@ namespace bvh_quantize
     {
         INTERNAL,
         LEAF,
-        SWITCH
+        SWITCH,
+        EMPTY
     };
 
     struct triangle_t
@@ -78,45 +274,242 @@ namespace bvh_quantize
         float v[3][3];
     };
 
+    // Row-major 3x4 affine map of a triangle p0, p1, p2 onto the frame spanned by p1 - p0, p2 - p0 and their
+    // cross product: rows 0 and 1 give the barycentric u (weight of p1) and v (weight of p2) of a point, row 2
+    // its offset along the normal. A ray hits where row 2 is 0. Degenerate triangles map to all zeros.
+    struct int_trig_xform_t
+    {
+        float m[3][4];
+    };
+    static_assert((trig_format == trig_format_t::XFORM ? sizeof(int_trig_xform_t) : sizeof(triangle_t)) == INT_BVH_TRIG_length,
+                  "INT_BVH_TRIG_length mismatch");
+
+    // [qxmin, qxmax, qymin, qymax, qzmin, qzmax]
+    typedef std::array<uint16_t, 6> int_bounds_t;
+
+    // bounds hold the six values of int_bounds_t packed back to back (quant_bits each,
+    // LSB first), so the nodes stay unpadded for every quant_bits
+#pragma pack(push, 1)
     struct int_node_t
     {
-        uint8_t bounds[6];
+        uint8_t bounds[INT_BVH_BOUNDS_length];
         uint16_t data;
     };
 
     struct int_node_v2_t
     {
-        uint8_t left_bounds[6];
+        uint8_t left_bounds[INT_BVH_BOUNDS_length];
         uint16_t left_child_data;
-        uint8_t right_bounds[6];
+        uint8_t right_bounds[INT_BVH_BOUNDS_length];
         uint16_t right_child_data;
     };
 
+    // triangle with its nine vertex coordinates packed like int_node_t::bounds (trig_quant_bits each,
+    // v0.x first), v = ref_bounds lo + q * qtrig_frame_t::scale. Stored next to the full-precision
+    // triangle with the same index, which is only fetched when may_hit_qtrig cannot rule out a hit.
+    struct int_qtrig_t
+    {
+        uint8_t v[trig_quant_bits != 0 ? INT_BVH_QTRIG_length : 1];
+    };
+#pragma pack(pop)
+
+    // N-wide node collapsed from the binary tree, one int_node_t per child. Unused slots
+    // have data == empty_child_data. int_node_wide_t<2> has the layout of int_node_v2_t.
+    template <int N>
+    struct int_node_wide_t
+    {
+        static_assert(2 <= N && N <= 8, "unsupported int_bvh width");
+        int_node_t children[N];
+    };
+    static_assert(sizeof(int_node_wide_t<INT_BVH_WIDTH>) == INT_BVH_NODE_length, "INT_BVH_NODE_length mismatch");
+
     struct int_cluster_t
     {
         float ref_bounds[6];
         float inv_sx_inv_sw;
         uint32_t node_offset;
         uint32_t trig_offset;
+        uint32_t child_cluster_offset;
+    };
+    static_assert(sizeof(int_cluster_t) == INT_BVH_CLUSTER_length, "INT_BVH_CLUSTER_length mismatch");
+
+    // Entry blas_idx of the BLAS table: device addresses of the int_bvh buffers of one BLAS, the
+    // simulator reads the BLAS of every int_instance_t through them. Absent buffers have address 0.
+    struct int_blas_t
+    {
+        uint64_t clusters_addr;
+        uint64_t trigs_addr;
+        uint64_t nodes_addr;
+        uint64_t primitive_indices_addr;
+        uint64_t qtrigs_addr;
+        uint32_t num_clusters;
+        uint32_t num_nodes;
+        uint32_t num_trigs;
+        uint32_t reserved[3];
+    };
+    static_assert(sizeof(int_blas_t) == INT_BVH_BLAS_length, "INT_BVH_BLAS_length mismatch");
+
+    // BLAS instance referenced by the LEAF children of the int TLAS. Both transforms are row-major 3x4
+    // like VkTransformMatrixKHR. custom_index_mask packs gl_InstanceCustomIndexEXT (24 bits) and the
+    // cull mask (top 8 bits) like VkAccelerationStructureInstanceKHR, instance_idx is gl_InstanceID.
+    struct int_instance_t
+    {
+        float object_to_world[3][4];
+        float world_to_object[3][4];
+        uint32_t blas_idx;
+        uint32_t instance_idx;
+        uint32_t custom_index_mask;
+        uint32_t sbt_offset;
+    };
+    static_assert(sizeof(int_instance_t) == INT_BVH_INSTANCE_length, "INT_BVH_INSTANCE_length mismatch");
+
+    // dequantization of a cluster's int_qtrig_t, r bounds the distance between a dequantized vertex
+    // and the original one (half a quantization step per axis, plus float rounding)
+    struct qtrig_frame_t
+    {
+        float lo[3];
+        float scale[3];
+        float r;
     };
 
     struct int_bvh_t
     {
         int num_clusters = 0;
+        size_t num_nodes = 0;
+        size_t num_trigs = 0;
         std::unique_ptr<int_cluster_t[]> clusters;
         std::unique_ptr<trig_t[]> trigs;
         std::unique_ptr<int_node_t[]> nodes;
-        std::unique_ptr<int_node_v2_t[]> nodes_v2;
         std::unique_ptr<size_t[]> primitive_indices;
+        std::unique_ptr<int_qtrig_t[]> qtrigs;    // nullptr unless trig_quant_bits != 0
+        std::unique_ptr<int_trig_xform_t[]> xforms;    // nullptr unless trig_format == XFORM
     };
 
     struct int_bvh_v2_t
     {
         int num_clusters = 0;
+        size_t num_nodes = 0;
+        size_t num_trigs = 0;
         std::unique_ptr<int_cluster_t[]> clusters;
         std::unique_ptr<trig_t[]> trigs;
         std::unique_ptr<int_node_v2_t[]> nodes_v2;
         std::unique_ptr<size_t[]> primitive_indices;
+        std::unique_ptr<int_qtrig_t[]> qtrigs;    // nullptr unless trig_quant_bits != 0
+        std::unique_ptr<int_trig_xform_t[]> xforms;    // nullptr unless trig_format == XFORM
+    };
+
+    template <int N>
+    struct int_bvh_wide_t
+    {
+        int num_clusters = 0;
+        size_t num_nodes = 0;
+        size_t num_trigs = 0;
+        std::unique_ptr<int_cluster_t[]> clusters;
+        std::unique_ptr<trig_t[]> trigs;
+        std::unique_ptr<int_node_wide_t<N>[]> nodes;
+        std::unique_ptr<size_t[]> primitive_indices;
+        std::unique_ptr<int_qtrig_t[]> qtrigs;    // nullptr unless trig_quant_bits != 0
+        std::unique_ptr<int_trig_xform_t[]> xforms;    // nullptr unless trig_format == XFORM
+    };
+
+    // Quantized TLAS, a single cluster with the node format of the BLASes whose LEAF children index
+    // instances instead of triangles. Instances are stored in leaf order, so a leaf holds up to
+    // max_trig_in_leaf_size consecutive ones. Empty if no instance references triangles.
+    struct int_tlas_t
+    {
+        int_cluster_t cluster{};
+        size_t num_nodes = 0;
+        std::unique_ptr<int_node_wide_t<INT_BVH_WIDTH>[]> nodes;
+        std::vector<int_instance_t> instances;
+    };
+
+    // node array of an int_bvh_v2_t or int_bvh_wide_t and the children of one of its nodes, a node of
+    // int_bvh_v2_t is the sibling pair stored at the local index of the left child
+    template <typename int_bvh_T>
+    struct int_nodes_t;
+
+    template <>
+    struct int_nodes_t<int_bvh_v2_t>
+    {
+        typedef int_node_v2_t type;
+        static constexpr int width = 2;
+        static type *get(int_bvh_v2_t &int_bvh) { return int_bvh.nodes_v2.get(); }
+        static uint16_t &child_data(type &node, int j) { return j == 0 ? node.left_child_data : node.right_child_data; }
+        static uint8_t *child_bounds(type &node, int j) { return j == 0 ? node.left_bounds : node.right_bounds; }
+    };
+
+    template <int N>
+    struct int_nodes_t<int_bvh_wide_t<N>>
+    {
+        typedef int_node_wide_t<N> type;
+        static constexpr int width = N;
+        static type *get(int_bvh_wide_t<N> &int_bvh) { return int_bvh.nodes.get(); }
+        static uint16_t &child_data(type &node, int j) { return node.children[j].data; }
+        static uint8_t *child_bounds(type &node, int j) { return node.children[j].bounds; }
+    };
+
+    // Fetches that cross an INT_BVH_ALIGNMENT boundary (two transactions in the simulator), in BFS order
+    // (before) and after line placement. *_straddles count stored nodes or triangles, hot_trig_* those of
+    // the hot leaves (see hot_leaf_share) and the fewest their sizes allow. node_visit_straddles* weight
+    // the nodes by their surface area relative to the reference node, i.e. the expected double fetches
+    // per ray entering each cluster, summed over all clusters. node_visit_shared_lines* likewise count
+    // the expected node fetches from the line of the parent node, which the RT cache already holds.
+    // statistics_t counts the straddling fetches a traversal actually makes.
+    struct line_stats_t
+    {
+        size_t node_straddles_before = 0;
+        size_t node_straddles = 0;
+        double node_visit_straddles_before = 0.0;
+        double node_visit_straddles = 0.0;
+        size_t node_padding = 0;
+        double node_visit_shared_lines_before = 0.0;
+        double node_visit_shared_lines = 0.0;
+        size_t trig_straddles_before = 0;
+        size_t trig_straddles = 0;
+        size_t hot_trigs = 0;
+        size_t hot_trig_straddles_before = 0;
+        size_t hot_trig_straddles = 0;
+        size_t hot_trig_min_straddles = 0;
+        size_t trig_padding = 0;
+    };
+
+    // Node-to-cluster assignment shared by the int_bvh_t and int_bvh_v2_t builders.
+    // Within a cluster, siblings are always stored next to each other, left child first.
+    // Clusters never exceed max_node_in_cluster_size nodes or max_trig_in_cluster_size triangles,
+    // the policy is switched where the cost model would build larger ones (num_split_clusters).
+    // With max_cluster_bytes != 0 the policy is also switched, and solved again around the switched
+    // nodes, where a cluster's emitted nodes and triangles outgrow the byte budget (num_budget_switches).
+    // node_offsets and trig_offsets have num_clusters + 1 entries, the last one is the total
+    // number of slots including padding.
+    struct cluster_layout_t
+    {
+        int num_clusters = 0;
+        std::vector<policy_t> policy;
+        std::vector<std::vector<size_t>> cluster_node_indices;
+        std::vector<size_t> ref_indices;
+        std::vector<uint32_t> child_cluster_offsets;
+        size_t num_split_clusters = 0;
+        size_t num_budget_switches = 0;
+        std::vector<float> scaling_factors;
+        std::vector<int> cluster_idx_map;
+        std::vector<size_t> local_node_idx_map;
+        std::vector<size_t> local_trig_idx_map;
+        std::vector<size_t> node_offsets;
+        std::vector<size_t> trig_offsets;
+        line_stats_t line_stats;
+    };
+
+    // Collapsed nodes of one cluster of build_int_bvh_wide: roots[k] is the binary node whose collapsed
+    // children (children[k]) form the k-th node in BFS order, child_nodes[k] the nodes its STAY children
+    // form, heats[k] its surface area relative to the reference node and slots[k] where it is stored.
+    struct wide_cluster_t
+    {
+        size_t node_offset = 0;
+        std::vector<size_t> roots;
+        std::vector<std::vector<size_t>> children;
+        std::vector<std::vector<size_t>> child_nodes;
+        std::vector<float> heats;
+        std::vector<size_t> slots;
     };
 
     struct decoded_data_t
@@ -129,15 +522,185 @@ namespace bvh_quantize
     // Function declarations
     int32_t floor_to_int32(float x);
     int32_t ceil_to_int32(float x);
+    int_dist_t floor_to_int_dist(int_dist_float_t x);
+    int_dist_t ceil_to_int_dist(int_dist_float_t x);
     float get_scaling_factor(const bvh_t &bvh, size_t ref_idx);
-    std::array<uint8_t, 6> get_int_bounds(const bvh_t &bvh, size_t node_idx, size_t ref_idx, float scaling_factor);
+    float get_scaling_factor(const bbox_t &ref_bbox);
+    int_bounds_t get_int_bounds(const bvh_t &bvh, size_t node_idx, size_t ref_idx, float scaling_factor);
+    int_bounds_t get_int_bounds(const bbox_t &node_bbox, const bbox_t &ref_bbox, float scaling_factor);
     bbox_t get_quant_bbox(const bvh_t &bvh, size_t node_idx, size_t ref_idx, float scaling_factor);
     arg_t parse_arg(int argc, char *argv[]);
-    bvh_t build_bvh(const std::vector<trig_t> &trigs);
-    std::vector<policy_t> get_policy(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh);
-    int_bvh_t build_int_bvh(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs, const bvh_t &bvh);
+    const char *get_builder_name(builder_type_t builder_type);
+    const char *get_node_order_name(node_order_t order);
+    const char *get_trig_format_name(trig_format_t format);
+    // INT_BVH_BUILDER environment variable if set, the INT_BVH_BUILDER build option otherwise
+    builder_type_t get_builder_type();
+    // INT_BVH_RAY_FILE environment variable if set, the INT_BVH_RAY_FILE build option otherwise
+    std::string get_ray_file();
+    bvh_t build_bvh(const std::vector<trig_t> &trigs, builder_type_t builder_type = builder_type_t::SWEEP_SAH);
+    std::vector<policy_t> get_policy(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh,
+                                     size_t max_ref_depth = unbounded_ref_depth);
+    // Reinsertion and leaf collapse between build_bvh and the int_bvh builders, each step is kept only
+    // if it lowers the quantized cost get_policy minimizes. Leaves stay within max_trig_in_leaf_size.
+    void optimize_bvh(float t_trv_int, float t_switch, float t_ist, bvh_t &bvh,
+                      size_t max_ref_depth = unbounded_ref_depth);
+    size_t limit_cluster_bytes(const cluster_layout_t &layout, const bvh_t &bvh, int wide_width, size_t max_bytes,
+                               std::vector<bool> &forced_switches);
+    // the cluster budget measures nodes as the int_node_v2_t slots of place_cluster_lines with wide_width 0,
+    // as the nodes of build_int_bvh_wide<wide_width> otherwise
+    cluster_layout_t get_cluster_layout(float t_trv_int, float t_switch, float t_ist, const bvh_t &bvh,
+                                        size_t max_ref_depth = unbounded_ref_depth, int wide_width = 0);
+    uint16_t get_child_data(const cluster_layout_t &layout, const bvh_t &bvh, size_t node_idx);
+    size_t count_straddles(size_t slot, size_t count, size_t length, size_t stride = 1);
+    void print_line_stats(const line_stats_t &line_stats);
+    int_bvh_t build_int_bvh(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs, const bvh_t &bvh,
+                            size_t max_ref_depth = unbounded_ref_depth);
+    int_bvh_v2_t build_int_bvh_v2(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs, const bvh_t &bvh,
+                                  size_t max_ref_depth = unbounded_ref_depth);
+    template <int N>
+    int_bvh_wide_t<N> build_int_bvh_wide(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
+                                         const bvh_t &bvh, size_t max_ref_depth = unbounded_ref_depth);
+    // Refits an int_bvh_v2_t or int_bvh_wide_t to moved triangles, trigs must hold the triangles it was
+    // built from in the same order. Clusters, reference nodes and the node and triangle layout stay,
+    // ref_bounds, inv_sx_inv_sw, the child bounds and the triangles are recomputed bottom-up, one
+    // level of the cluster tree at a time with the clusters of a level in parallel.
+    template <typename int_bvh_T>
+    void refit_int_bvh(const std::vector<trig_t> &trigs, int_bvh_T &int_bvh);
+    // bounds of a cluster's reference node
+    bbox_t get_ref_bbox(const int_cluster_t &cluster);
+    // blas_bboxes[k] bounds BLAS k in object space (get_ref_bbox of its root cluster), the instances
+    // are placed by the world bounds of their transformed BLAS
+    int_tlas_t build_int_tlas(const std::vector<int_instance_t> &instances, const std::vector<bbox_t> &blas_bboxes);
     decoded_data_t decode_data(uint16_t data);
-    int_bvh_v2_t convert_nodes(const int_bvh_t &int_bvh, const bvh_t &bvh, const std::vector<trig_t> &trigs);
+    void set_int_bounds(uint8_t *bounds, const int_bounds_t &int_bounds);
+    std::unique_ptr<int_qtrig_t[]> quantize_trigs(int num_clusters, const int_cluster_t *clusters, size_t num_trigs,
+                                                  const trig_t *trigs);
+    std::unique_ptr<int_trig_xform_t[]> transform_trigs(size_t num_trigs, const trig_t *trigs);
+    int_bvh_v2_t convert_nodes(int_bvh_t &&int_bvh);
+
+    // i-th value of bits each, packed back to back LSB first
+    inline uint32_t get_packed(const uint8_t *bytes, int i, int bits)
+    {
+        uint32_t first_bit = i * bits;
+        uint32_t word = 0;
+        for (uint32_t byte = first_bit / 8; byte * 8 < first_bit + bits; byte++)
+            word |= static_cast<uint32_t>(bytes[byte]) << (8 * (byte - first_bit / 8));
+        return (word >> (first_bit % 8)) & ((1u << bits) - 1);
+    }
+
+    // i-th value of an int_bounds_t packed by set_int_bounds
+    inline uint32_t get_qx(const uint8_t *bounds, int i)
+    {
+        if (quant_bits == 8)
+            return bounds[i];
+        return get_packed(bounds, i, quant_bits);
+    }
+
+    inline qtrig_frame_t get_qtrig_frame(const int_cluster_t &cluster)
+    {
+        qtrig_frame_t frame;
+        float r2 = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            float lo = cluster.ref_bounds[2 * i];
+            float hi = cluster.ref_bounds[2 * i + 1];
+            frame.lo[i] = lo;
+            frame.scale[i] = (hi - lo) / qv_max;
+            float err = 0.5f * frame.scale[i] + 1e-6f * (std::abs(lo) + std::abs(hi));
+            r2 += err * err;
+        }
+        frame.r = 1.001f * std::sqrt(r2);
+        return frame;
+    }
+
+    inline void get_qtrig_vertices(const int_qtrig_t &qtrig, const qtrig_frame_t &frame, float p[3][3])
+    {
+        for (int k = 0; k < 3; k++)
+            for (int i = 0; i < 3; i++)
+                p[k][i] = frame.lo[i] + static_cast<float>(get_packed(qtrig.v, 3 * k + i, trig_quant_bits)) * frame.scale[i];
+    }
+
+    // every coordinate at qv_max marks a triangle that sticks out of its cluster's reference node
+    // (a clipped spatial-split reference), may_hit_qtrig then always defers to the full-precision test
+    inline bool is_unbounded_qtrig(const int_qtrig_t &qtrig)
+    {
+        for (int i = 0; i < 9; i++)
+            if (get_packed(qtrig.v, i, trig_quant_bits) != qv_max)
+                return false;
+        return true;
+    }
+
+    // false only if the ray (any direction length) cannot hit the original triangle within [tmin, tmax].
+    // The original vertices lie within frame.r of the dequantized ones, which bounds both the hit distance
+    // and the edge functions d . (a_j x a_k) (a = vertex - origin) the exact test takes the signs of.
+    inline bool may_hit_qtrig(const int_qtrig_t &qtrig, const qtrig_frame_t &frame,
+                              const float o[3], const float d[3], float tmin, float tmax)
+    {
+        if (is_unbounded_qtrig(qtrig))
+            return true;
+
+        float p[3][3];
+        get_qtrig_vertices(qtrig, frame, p);
+
+        float a[3][3], len[3], s[3];
+        for (int k = 0; k < 3; k++)
+        {
+            for (int i = 0; i < 3; i++)
+                a[k][i] = p[k][i] - o[i];
+            len[k] = std::sqrt(a[k][0] * a[k][0] + a[k][1] * a[k][1] + a[k][2] * a[k][2]);
+            s[k] = d[0] * a[k][0] + d[1] * a[k][1] + d[2] * a[k][2];
+        }
+        float d_len2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        float d_len = std::sqrt(d_len2);
+
+        // hit distance of any point of the original triangle
+        float t_slack = frame.r * d_len + 1e-5f * d_len * (len[0] + len[1] + len[2]);
+        float t_lo = (std::min({s[0], s[1], s[2]}) - t_slack) / d_len2;
+        float t_hi = (std::max({s[0], s[1], s[2]}) + t_slack) / d_len2;
+        if (t_hi < tmin || t_lo > tmax)
+            return false;
+
+        // every edge function must be able to share one sign, float error of the exact test included
+        float sum = len[0] + len[1] + len[2];
+        bool may_be_positive = true;
+        bool may_be_negative = true;
+        for (int k = 0; k < 3; k++)
+        {
+            const float *a1 = a[(k + 1) % 3];
+            const float *a2 = a[(k + 2) % 3];
+            float e = d[0] * (a1[1] * a2[2] - a1[2] * a2[1]) +
+                      d[1] * (a1[2] * a2[0] - a1[0] * a2[2]) +
+                      d[2] * (a1[0] * a2[1] - a1[1] * a2[0]);
+            float bound = d_len * frame.r * (len[(k + 1) % 3] + len[(k + 2) % 3] + frame.r) + 1e-5f * d_len * sum * sum;
+            may_be_positive &= e >= -bound;
+            may_be_negative &= e <= bound;
+        }
+        return may_be_positive || may_be_negative;
+    }
+
+    // Baldwin-Weber test of a ray (any direction length) against an int_trig_xform_t: the hit distance only
+    // needs row 2, u and v are computed for hits within [tmin, tmax] alone
+    inline bool intersect_trig_xform(const int_trig_xform_t &xform, const float o[3], const float d[3], float tmin,
+                                     float tmax, float &t, float &u, float &v)
+    {
+        const float *n = xform.m[2];
+        float dz = n[0] * d[0] + n[1] * d[1] + n[2] * d[2];
+        // parallel rays and degenerate triangles never hit
+        if (dz == 0.0f)
+            return false;
+        t = -(n[0] * o[0] + n[1] * o[1] + n[2] * o[2] + n[3]) / dz;
+        if (!(t >= tmin && t <= tmax))
+            return false;
+
+        float p[3];
+        for (int i = 0; i < 3; i++)
+            p[i] = o[i] + t * d[i];
+        const float *a = xform.m[0];
+        const float *b = xform.m[1];
+        u = a[0] * p[0] + a[1] * p[1] + a[2] * p[2] + a[3];
+        v = b[0] * p[0] + b[1] * p[1] + b[2] * p[2] + b[3];
+        return u >= 0.0f && v >= 0.0f && u + v <= 1.0f;
+    }
 
 } // namespace bvh_quantize
 
@@ -0,0 +1,333 @@
+#include "cache.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bvh_quantize
+{
+    static_assert(sizeof(cache_key_t) == 96, "cache_key_t must not contain padding");
+    static_assert(std::is_trivially_copyable<trig_t>::value, "trig_t is stored as raw bytes");
+
+    // file layout: cache_header_t, then the arrays at the given offsets (INT_BVH_ALIGNMENT aligned)
+    struct cache_header_t
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_length;
+        cache_key_t key;
+        cost_params_t costs;
+        uint32_t reserved;
+        uint64_t num_clusters;
+        uint64_t num_nodes;
+        uint64_t num_trigs;
+        // clusters, trigs, nodes, primitive_indices, qtrigs (0 if absent)
+        uint64_t offsets[5];
+    };
+
+    constexpr char cache_magic[8] = {'I', 'N', 'T', 'B', 'V', 'H', '\0', '\0'};
+
+    template <typename int_bvh_T>
+    struct cache_nodes_t;
+
+    template <>
+    struct cache_nodes_t<int_bvh_v2_t>
+    {
+        typedef int_node_v2_t type;
+        static std::unique_ptr<type[]> &get(int_bvh_v2_t &int_bvh) { return int_bvh.nodes_v2; }
+        static const type *get(const int_bvh_v2_t &int_bvh) { return int_bvh.nodes_v2.get(); }
+    };
+
+    template <int N>
+    struct cache_nodes_t<int_bvh_wide_t<N>>
+    {
+        typedef int_node_wide_t<N> type;
+        static std::unique_ptr<type[]> &get(int_bvh_wide_t<N> &int_bvh) { return int_bvh.nodes; }
+        static const type *get(const int_bvh_wide_t<N> &int_bvh) { return int_bvh.nodes.get(); }
+    };
+
+    // read-only view of a whole file, memory-mapped where available
+    class mapped_file_t
+    {
+    public:
+        explicit mapped_file_t(const std::string &path)
+        {
+#ifndef _WIN32
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr != MAP_FAILED)
+                {
+                    data_ = static_cast<const uint8_t *>(addr);
+                    size_ = st.st_size;
+                }
+            }
+            close(fd);
+#else
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                return;
+            buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            data_ = reinterpret_cast<const uint8_t *>(buffer_.data());
+            size_ = buffer_.size();
+#endif
+        }
+
+        ~mapped_file_t()
+        {
+#ifndef _WIN32
+            if (data_)
+                munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+        }
+
+        mapped_file_t(const mapped_file_t &) = delete;
+        mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+        const uint8_t *data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        const uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        std::vector<char> buffer_;
+#endif
+    };
+
+    uint64_t hash_trigs(const std::vector<trig_t> &trigs)
+    {
+        // FNV-1a over the vertex bits
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const trig_t &trig : trigs)
+        {
+            const vector_t v[3] = {trig.p0, trig.p1(), trig.p2()};
+            for (int k = 0; k < 3; k++)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    float x = v[k][j];
+                    uint32_t bits;
+                    std::memcpy(&bits, &x, sizeof(bits));
+                    for (int byte = 0; byte < 4; byte++)
+                    {
+                        hash ^= (bits >> (8 * byte)) & 0xff;
+                        hash *= 0x100000001b3ull;
+                    }
+                }
+            }
+        }
+        return hash;
+    }
+
+    cache_key_t get_cache_key(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
+                              builder_type_t builder_type, size_t max_ref_depth)
+    {
+        cache_key_t key;
+        key.trigs_hash = hash_trigs(trigs);
+        key.num_trigs = trigs.size();
+        key.max_ref_depth = max_ref_depth;
+        key.max_cluster_bytes = max_cluster_bytes;
+        key.t_trv_int = t_trv_int;
+        key.t_switch = t_switch;
+        key.t_ist = t_ist;
+        key.min_padding_heat = min_padding_heat;
+        key.hot_leaf_share = hot_leaf_share;
+        key.max_leaf_size = max_trig_in_leaf_size;
+        key.max_line_padding = max_line_padding;
+        key.width = INT_BVH_WIDTH;
+        key.quant_bits = quant_bits;
+        key.trig_quant_bits = trig_quant_bits;
+        key.builder = static_cast<uint32_t>(builder_type);
+        key.optimize = optimize_quant_cost;
+        key.node_order = static_cast<uint32_t>(node_order);
+        key.trig_format = static_cast<uint32_t>(trig_format);
+        if (autotune != autotune_t::OFF)
+        {
+            key.autotune = static_cast<uint32_t>(autotune);
+            key.autotune_rays = static_cast<uint32_t>(autotune_rays);
+        }
+        return key;
+    }
+
+    std::string get_cache_path(const cache_key_t &key)
+    {
+        const char *dir = std::getenv("INT_BVH_CACHE_DIR");
+        std::string cache_dir = dir ? dir : INT_BVH_CACHE_DIR;
+        if (cache_dir.empty())
+            return "";
+
+        char name[96];
+        snprintf(name, sizeof(name), "%016llx_w%u_q%u_t%u_f%u_%s.intbvh", static_cast<unsigned long long>(key.trigs_hash),
+                 key.width, key.quant_bits, key.trig_quant_bits, key.trig_format,
+                 get_builder_name(static_cast<builder_type_t>(key.builder)));
+        return (std::filesystem::path(cache_dir) / name).string();
+    }
+
+    template <typename int_bvh_T>
+    bool load_int_bvh(const std::string &path, const cache_key_t &key, int_bvh_T &int_bvh, cost_params_t *costs)
+    {
+        typedef typename cache_nodes_t<int_bvh_T>::type cache_node_t;
+
+        if (path.empty())
+            return false;
+
+        mapped_file_t file(path);
+        if (file.size() < sizeof(cache_header_t))
+            return false;
+
+        cache_header_t header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version ||
+            header.node_length != sizeof(cache_node_t) || std::memcmp(&header.key, &key, sizeof(key)) != 0)
+            return false;
+
+        bool has_qtrigs = header.offsets[4] != 0;
+        if (has_qtrigs != (trig_quant_bits != 0))
+            return false;
+
+        const uint64_t lengths[5] = {header.num_clusters * sizeof(int_cluster_t),
+                                     header.num_trigs * sizeof(trig_t),
+                                     header.num_nodes * sizeof(cache_node_t),
+                                     header.num_trigs * sizeof(size_t),
+                                     has_qtrigs ? header.num_trigs * sizeof(int_qtrig_t) : 0};
+        for (int i = 0; i < 5; i++)
+        {
+            if ((i < 4 || has_qtrigs) && (header.offsets[i] < sizeof(header) || header.offsets[i] > file.size() ||
+                                          lengths[i] > file.size() - header.offsets[i]))
+                return false;
+        }
+
+        // the int_bvh owns its arrays, so each section is copied out of the mapping
+        auto copy_section = [&](auto &array, int i, size_t count)
+        {
+            typedef typename std::remove_reference<decltype(array[0])>::type element_t;
+            array = std::make_unique<element_t[]>(count);
+            std::memcpy(array.get(), file.data() + header.offsets[i], lengths[i]);
+        };
+
+        int_bvh.num_clusters = static_cast<int>(header.num_clusters);
+        int_bvh.num_nodes = header.num_nodes;
+        int_bvh.num_trigs = header.num_trigs;
+        copy_section(int_bvh.clusters, 0, header.num_clusters);
+        copy_section(int_bvh.trigs, 1, header.num_trigs);
+        copy_section(cache_nodes_t<int_bvh_T>::get(int_bvh), 2, header.num_nodes);
+        copy_section(int_bvh.primitive_indices, 3, header.num_trigs);
+        if (has_qtrigs)
+            copy_section(int_bvh.qtrigs, 4, header.num_trigs);
+        else
+            int_bvh.qtrigs.reset();
+        if (trig_format == trig_format_t::XFORM)
+            int_bvh.xforms = transform_trigs(int_bvh.num_trigs, int_bvh.trigs.get());
+        else
+            int_bvh.xforms.reset();
+        if (costs)
+            *costs = header.costs;
+        return true;
+    }
+
+    template <typename int_bvh_T>
+    bool save_int_bvh(const std::string &path, const cache_key_t &key, const int_bvh_T &int_bvh,
+                      const cost_params_t *costs)
+    {
+        typedef typename cache_nodes_t<int_bvh_T>::type cache_node_t;
+
+        if (path.empty())
+            return false;
+
+        cache_header_t header{};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.node_length = sizeof(cache_node_t);
+        header.key = key;
+        header.costs = costs ? *costs : cost_params_t{key.t_trv_int, key.t_switch, key.t_ist};
+        header.num_clusters = int_bvh.num_clusters;
+        header.num_nodes = int_bvh.num_nodes;
+        header.num_trigs = int_bvh.num_trigs;
+
+        const void *sections[5] = {int_bvh.clusters.get(), int_bvh.trigs.get(), cache_nodes_t<int_bvh_T>::get(int_bvh),
+                                   int_bvh.primitive_indices.get(), int_bvh.qtrigs.get()};
+        const uint64_t lengths[5] = {header.num_clusters * sizeof(int_cluster_t),
+                                     header.num_trigs * sizeof(trig_t),
+                                     header.num_nodes * sizeof(cache_node_t),
+                                     header.num_trigs * sizeof(size_t),
+                                     int_bvh.qtrigs ? header.num_trigs * sizeof(int_qtrig_t) : 0};
+        uint64_t offset = sizeof(header);
+        for (int i = 0; i < 5; i++)
+        {
+            if (!sections[i])
+                continue;
+            offset = (offset + INT_BVH_ALIGNMENT - 1) & ~uint64_t{INT_BVH_ALIGNMENT - 1};
+            header.offsets[i] = offset;
+            offset += lengths[i];
+        }
+
+        std::error_code error;
+        std::filesystem::path final_path(path);
+        if (final_path.has_parent_path())
+            std::filesystem::create_directories(final_path.parent_path(), error);
+
+        // write to a private file first, a reader never sees a partial file
+        std::filesystem::path tmp_path = final_path;
+        tmp_path += ".tmp" + std::to_string(std::random_device{}());
+        {
+            std::ofstream file(tmp_path, std::ios::binary);
+            if (!file)
+                return false;
+
+            const char zeros[INT_BVH_ALIGNMENT] = {};
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            uint64_t written = sizeof(header);
+            for (int i = 0; i < 5; i++)
+            {
+                if (!sections[i])
+                    continue;
+                file.write(zeros, header.offsets[i] - written);
+                file.write(static_cast<const char *>(sections[i]), lengths[i]);
+                written = header.offsets[i] + lengths[i];
+            }
+            if (!file)
+            {
+                file.close();
+                std::filesystem::remove(tmp_path, error);
+                return false;
+            }
+        }
+
+        std::filesystem::rename(tmp_path, final_path, error);
+        if (error)
+        {
+            std::filesystem::remove(tmp_path, error);
+            return false;
+        }
+        return true;
+    }
+
+    template bool load_int_bvh<int_bvh_v2_t>(const std::string &, const cache_key_t &, int_bvh_v2_t &,
+                                                cost_params_t *);
+    template bool save_int_bvh<int_bvh_v2_t>(const std::string &, const cache_key_t &, const int_bvh_v2_t &,
+                                                const cost_params_t *);
+    template bool load_int_bvh<int_bvh_wide_t<4>>(const std::string &, const cache_key_t &, int_bvh_wide_t<4> &,
+                                                     cost_params_t *);
+    template bool save_int_bvh<int_bvh_wide_t<4>>(const std::string &, const cache_key_t &,
+                                                     const int_bvh_wide_t<4> &, const cost_params_t *);
+    template bool load_int_bvh<int_bvh_wide_t<6>>(const std::string &, const cache_key_t &, int_bvh_wide_t<6> &,
+                                                     cost_params_t *);
+    template bool save_int_bvh<int_bvh_wide_t<6>>(const std::string &, const cache_key_t &,
+                                                     const int_bvh_wide_t<6> &, const cost_params_t *);
+    template bool load_int_bvh<int_bvh_wide_t<8>>(const std::string &, const cache_key_t &, int_bvh_wide_t<8> &,
+                                                     cost_params_t *);
+    template bool save_int_bvh<int_bvh_wide_t<8>>(const std::string &, const cache_key_t &,
+                                                     const int_bvh_wide_t<8> &, const cost_params_t *);
+
+} // namespace bvh_quantize
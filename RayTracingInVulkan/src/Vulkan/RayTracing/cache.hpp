@@ -0,0 +1,63 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "build.hpp"
+
+// directory of cached int_bvh files, overridden by the INT_BVH_CACHE_DIR environment variable
+// (an empty value disables the cache)
+#define INT_BVH_CACHE_DIR "int_bvh_cache"
+
+namespace bvh_quantize
+{
+    // bump whenever the builders change their output for the same triangles and parameters
+    constexpr uint32_t cache_version = 11;
+
+    // everything an int_bvh depends on, a cached file is only used if all fields match
+    struct cache_key_t
+    {
+        uint64_t trigs_hash = 0;
+        uint64_t num_trigs = 0;
+        uint64_t max_ref_depth = 0;
+        uint64_t max_cluster_bytes = 0;
+        float t_trv_int = 0.0f;
+        float t_switch = 0.0f;
+        float t_ist = 0.0f;
+        float min_padding_heat = 0.0f;
+        float hot_leaf_share = 0.0f;
+        uint32_t max_leaf_size = 0;
+        uint32_t max_line_padding = 0;
+        uint32_t width = 0;
+        uint32_t quant_bits = 0;
+        uint32_t trig_quant_bits = 0;
+        uint32_t builder = 0;
+        uint32_t optimize = 0;
+        uint32_t node_order = 0;
+        // with autotune the cost fields are the starting point of tune_costs
+        uint32_t autotune = 0;
+        uint32_t autotune_rays = 0;
+        uint32_t trig_format = 0; // the layout of the clusters depends on INT_BVH_TRIG_length
+    };
+
+    uint64_t hash_trigs(const std::vector<trig_t> &trigs);
+    cache_key_t get_cache_key(float t_trv_int, float t_switch, float t_ist, const std::vector<trig_t> &trigs,
+                              builder_type_t builder_type = builder_type_t::SWEEP_SAH,
+                              size_t max_ref_depth = unbounded_ref_depth);
+    // empty if the cache is disabled
+    std::string get_cache_path(const cache_key_t &key);
+
+    // Both return false (and leave int_bvh untouched on load) if path is empty, the file is missing,
+    // truncated, of another version or built from another key. Load reads the file through a memory
+    // map and copies each section into newly allocated int_bvh arrays, the mapping is released before it
+    // returns. Files are written atomically, so concurrent runs of the same scene can share a cache
+    // directory. Transformed triangles are not stored, load derives them from the triangles.
+    // costs are the ones the int_bvh was built with (the key's costs if none are given on save).
+    template <typename int_bvh_T>
+    bool load_int_bvh(const std::string &path, const cache_key_t &key, int_bvh_T &int_bvh,
+                      cost_params_t *costs = nullptr);
+    template <typename int_bvh_T>
+    bool save_int_bvh(const std::string &path, const cache_key_t &key, const int_bvh_T &int_bvh,
+                      const cost_params_t *costs = nullptr);
+
+} // namespace bvh_quantize
+
+#endif // CACHE_HPP
@@ -0,0 +1,172 @@
+#ifndef TUNE_HPP
+#define TUNE_HPP
+
+// cost auto-tuning with the CPU traversals, include after bvh/traverse.hpp
+
+#include <map>
+#include <random>
+
+namespace bvh_quantize
+{
+    // Rays from points uniform in the scene bounds towards the centroids of random triangles, so that most
+    // of them hit something. Deterministic for the same triangles, directions are normalized as the
+    // integer traversals expect.
+    inline std::vector<ray_t> get_tuning_rays(const std::vector<trig_t> &trigs, size_t num_rays)
+    {
+        std::vector<ray_t> rays;
+        if (trigs.empty())
+            return rays;
+
+        bbox_t scene_bbox = bbox_t::empty();
+        for (const trig_t &trig : trigs)
+            scene_bbox.extend(trig.bounding_box());
+        float tmax = length(scene_bbox.diagonal());
+
+        std::mt19937 rng(0x1234567u);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_int_distribution<size_t> pick(0, trigs.size() - 1);
+        rays.reserve(num_rays);
+        while (rays.size() < num_rays)
+        {
+            vector_t origin;
+            for (int i = 0; i < 3; i++)
+                origin[i] = scene_bbox.min[i] + unit(rng) * (scene_bbox.max[i] - scene_bbox.min[i]);
+            vector_t dir = trigs[pick(rng)].center() - origin;
+            float dir_length = length(dir);
+            if (!(dir_length > 0.0f))
+                continue;
+            rays.emplace_back(origin, dir * (1.0f / dir_length), 0.0f, tmax);
+        }
+        return rays;
+    }
+
+    // per-ray traversal steps, or bytes of clusters, node lines (a step in the line of the previous
+    // step's node is free) and triangles fetched
+    inline double get_tuning_score(autotune_t mode, const statistics_t &statistics, size_t num_rays)
+    {
+        double score = static_cast<double>(statistics.traversal_steps);
+        if (mode == autotune_t::BYTES)
+        {
+            score = static_cast<double>(INT_BVH_CLUSTER_length) * statistics.intersect_bbox +
+                    static_cast<double>(INT_BVH_ALIGNMENT) * (statistics.traversal_steps - statistics.same_line_steps) +
+                    static_cast<double>(INT_BVH_TRIG_length) * statistics.bvh_statistics.intersections_a;
+            if (trig_quant_bits != 0)
+                score += static_cast<double>(INT_BVH_QTRIG_length) * statistics.qtrig_tests;
+        }
+        return num_rays != 0 ? score / num_rays : 0.0;
+    }
+
+    // deep copy of a float BVH (bvh_t is move-only), its primitive_indices run up to the end of the last leaf
+    inline bvh_t copy_bvh(const bvh_t &bvh)
+    {
+        size_t num_indices = 0;
+        for (size_t i = 0; i < bvh.node_count; i++)
+            if (bvh.nodes[i].is_leaf())
+                num_indices = std::max(num_indices, static_cast<size_t>(bvh.nodes[i].first_child_or_primitive +
+                                                                        bvh.nodes[i].primitive_count));
+
+        bvh_t copy;
+        copy.node_count = bvh.node_count;
+        copy.nodes = std::make_unique<node_t[]>(bvh.node_count);
+        std::copy(bvh.nodes.get(), bvh.nodes.get() + bvh.node_count, copy.nodes.get());
+        copy.primitive_indices = std::make_unique<size_t[]>(num_indices);
+        std::copy(bvh.primitive_indices.get(), bvh.primitive_indices.get() + num_indices, copy.primitive_indices.get());
+        return copy;
+    }
+
+    // Coordinate search over t_trv_int and t_switch from costs (t_ist stays the unit of the cost model):
+    // each round halves and doubles one cost at a time and keeps whatever lowers the score on the tuning
+    // rays, until a round changes nothing. build(costs, bvh) converts the caller's float BVH of trigs, or a
+    // copy of it optimized for the candidate costs and max_ref_depth with optimize_quant_cost (build should
+    // cluster with the same max_ref_depth), so the caller can convert the same float BVH with the tuned
+    // costs. traverse(int_bvh, ray, statistics) runs the CPU traversal and is called from several threads
+    // at once.
+    template <typename build_T, typename traverse_T>
+    cost_params_t tune_costs(cost_params_t costs, const std::vector<trig_t> &trigs, const bvh_t &base_bvh,
+                             size_t max_ref_depth, build_T build, traverse_T traverse)
+    {
+        constexpr int max_rounds = 8;
+        constexpr int max_exponent = 6;
+
+        std::vector<ray_t> rays = get_tuning_rays(trigs, autotune_rays);
+        if (ray_order == ray_order_t::MORTON)
+        {
+            std::vector<size_t> order;
+            rays = sort_rays(rays, order);
+        }
+        const char *score_name = autotune == autotune_t::BYTES ? "bytes" : "steps";
+
+        // candidates are costs * 2^exponents, each is built at most once
+        std::map<std::pair<int, int>, double> scores;
+        auto get_candidate = [&](std::pair<int, int> exponents)
+        {
+            return cost_params_t{std::ldexp(costs.t_trv_int, exponents.first), std::ldexp(costs.t_switch, exponents.second),
+                                 costs.t_ist};
+        };
+        auto get_score = [&](std::pair<int, int> exponents)
+        {
+            auto it = scores.find(exponents);
+            if (it != scores.end())
+                return it->second;
+
+            cost_params_t candidate = get_candidate(exponents);
+            bvh_t bvh;
+            if (optimize_quant_cost)
+            {
+                bvh = copy_bvh(base_bvh);
+                optimize_bvh(candidate.t_trv_int, candidate.t_switch, candidate.t_ist, bvh, max_ref_depth);
+            }
+            auto int_bvh = build(candidate, optimize_quant_cost ? bvh : base_bvh);
+
+            statistics_t statistics;
+#pragma omp parallel
+            {
+                statistics_t local_statistics;
+#pragma omp for schedule(dynamic, 64)
+                for (int64_t i = 0; i < static_cast<int64_t>(rays.size()); i++)
+                    traverse(int_bvh, rays[i], local_statistics);
+#pragma omp critical
+                statistics += local_statistics;
+            }
+            double score = get_tuning_score(autotune, statistics, rays.size());
+            printf("(ycpin) Tune t_trv_int = %g, t_switch = %g, t_ist = %g: %.2f %s per ray\n", candidate.t_trv_int,
+                   candidate.t_switch, candidate.t_ist, score, score_name);
+            scores.emplace(exponents, score);
+            return score;
+        };
+
+        std::pair<int, int> best(0, 0);
+        double best_score = get_score(best);
+        for (int round = 0; round < max_rounds; round++)
+        {
+            std::pair<int, int> round_start = best;
+            for (int param = 0; param < 2; param++)
+            {
+                for (int step : {-1, 1})
+                {
+                    std::pair<int, int> exponents = best;
+                    int &exponent = param == 0 ? exponents.first : exponents.second;
+                    exponent += step;
+                    if (std::abs(exponent) > max_exponent)
+                        continue;
+                    double score = get_score(exponents);
+                    if (score < best_score)
+                    {
+                        best = exponents;
+                        best_score = score;
+                    }
+                }
+            }
+            if (best == round_start)
+                break;
+        }
+
+        cost_params_t best_costs = get_candidate(best);
+        printf("(ycpin) Tuned t_trv_int = %g, t_switch = %g, t_ist = %g (%.2f %s per ray, %zu candidates)\n",
+               best_costs.t_trv_int, best_costs.t_switch, best_costs.t_ist, best_score, score_name, scores.size());
+        return best_costs;
+    }
+
+} // namespace bvh_quantize
+
+#endif // TUNE_HPP
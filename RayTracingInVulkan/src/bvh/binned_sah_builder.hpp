@@ -218,7 +218,7 @@ public:
             auto& bins = bins_per_axis[best_axis];
             auto left_bbox  = BoundingBox<Scalar>::empty();
             auto right_bbox = BoundingBox<Scalar>::empty();
-            for (size_t i = 0; i < best_splits[best_axis].second; ++i)
+            for (size_t i = 0; i < split_index; ++i)
                 left_bbox.extend(bins[i].bbox);
             for (size_t i = split_index; i < bin_count; ++i)
                 right_bbox.extend(bins[i].bbox);
@@ -231,6 +231,32 @@ public:
             return std::make_optional(std::make_pair(first_item, second_item));
         }
 
+        // All centers fall into the same bin: split the range in two halves if the leaf would be too large
+        if (item.work_size() > builder.max_leaf_size) {
+            size_t first_child;
+            #pragma omp atomic capture
+            { first_child = bvh.node_count; bvh.node_count += 2; }
+
+            auto& left  = bvh.nodes[first_child + 0];
+            auto& right = bvh.nodes[first_child + 1];
+            node.first_child_or_primitive = static_cast<IndexType>(first_child);
+            node.primitive_count          = 0;
+
+            begin_right = item.begin + item.work_size() / 2;
+            auto left_bbox  = BoundingBox<Scalar>::empty();
+            auto right_bbox = BoundingBox<Scalar>::empty();
+            for (size_t i = item.begin; i < begin_right; ++i)
+                left_bbox.extend(bboxes[primitive_indices[i]]);
+            for (size_t i = begin_right; i < item.end; ++i)
+                right_bbox.extend(bboxes[primitive_indices[i]]);
+            left.bounding_box_proxy()  = left_bbox;
+            right.bounding_box_proxy() = right_bbox;
+
+            WorkItem first_item (first_child + 0, item.begin, begin_right, item.depth + 1);
+            WorkItem second_item(first_child + 1, begin_right, item.end,   item.depth + 1);
+            return std::make_optional(std::make_pair(first_item, second_item));
+        }
+
         make_leaf(node, item.begin, item.end);
         return std::nullopt;
     }
@@ -74,6 +74,14 @@ struct AnyPrimitiveIntersector : public PrimitiveIntersector<Bvh, Primitive, Per
             return std::make_optional(Result { hit->distance() });
         return std::nullopt;
     }
+
+    template <typename Statistics>
+    std::optional<Result> intersect(size_t index, const Ray<Scalar>& ray, Statistics &statistics) const {
+        auto [p, i] = this->primitive_at(index);
+        if (auto hit = p.intersect(ray, statistics))
+            return std::make_optional(Result { hit->distance() });
+        return std::nullopt;
+    }
 };
 
 } // namespace bvh
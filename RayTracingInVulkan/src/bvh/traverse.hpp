@@ -1,6 +1,14 @@
 #ifndef TRAVERSE_HPP
 #define TRAVERSE_HPP
 
+#include <new>
+#include <utility>
+#include <bvh/morton.hpp>
+#include <bvh/radix_sort.hpp>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 namespace bvh_quantize
 {
 
@@ -9,47 +17,176 @@ namespace bvh_quantize
 
     struct cluster_data_t
     {
-        uint16_t cluster_idx;
+        uint32_t cluster_idx;
         int_node_t *local_nodes;
         trig_t *local_trigs;
 
         uint32_t node_offset;
         uint32_t trig_offset;
+        uint32_t child_cluster_offset;
 
         float inv_sx_inv_sw;
         float y_ref;
-        int32_t qb_l[3];
-        int32_t qb_h[3];
+        int_dist_t qb_l[3];
+        int_dist_t qb_h[3];
         uint8_t tmax_version;
-        int32_t qy_max;
+        int_dist_t qy_max;
         uint8_t num_nodes_in_stk_2;
+        qtrig_frame_t qtrig_frame;
     };
 
     struct cluster_data_v2_t
     {
-        uint16_t cluster_idx;
+        uint32_t cluster_idx;
         int_node_v2_t *local_nodes;
         trig_t *local_trigs;
 
         uint32_t node_offset;
         uint32_t trig_offset;
+        uint32_t child_cluster_offset;
+
+        float inv_sx_inv_sw;
+        float y_ref;
+        int_dist_t qb_l[3];
+        int_dist_t qb_h[3];
+        uint8_t tmax_version;
+        int_dist_t qy_max;
+        uint8_t num_nodes_in_stk_2;
+        qtrig_frame_t qtrig_frame;
+    };
+
+    template <int N>
+    struct cluster_data_wide_t
+    {
+        uint32_t cluster_idx;
+        int_node_wide_t<N> *local_nodes;
+        trig_t *local_trigs;
+
+        uint32_t node_offset;
+        uint32_t trig_offset;
+        uint32_t child_cluster_offset;
 
         float inv_sx_inv_sw;
         float y_ref;
-        int32_t qb_l[3];
-        int32_t qb_h[3];
+        int_dist_t qb_l[3];
+        int_dist_t qb_h[3];
+        uint8_t tmax_version;
+        int_dist_t qy_max;
+        uint8_t num_nodes_in_stk_2;
+        qtrig_frame_t qtrig_frame;
+    };
+
+    // What stk_1 keeps of a cluster left with nodes still on stk_2: the per-ray state only (qb_h is
+    // always qb_l + 1), the cluster's constants are read again from its int_cluster_t when it is popped.
+    struct cluster_stack_entry_t
+    {
+        uint32_t cluster_idx;
+        float y_ref;
+        int_dist_t qb_l[3];
+        int_dist_t qy_max;
         uint8_t tmax_version;
-        int32_t qy_max;
         uint8_t num_nodes_in_stk_2;
     };
 
+    template <typename cluster_data_T>
+    cluster_stack_entry_t get_cluster_stack_entry(const cluster_data_T &cluster_data)
+    {
+        cluster_stack_entry_t entry;
+        entry.cluster_idx = cluster_data.cluster_idx;
+        entry.y_ref = cluster_data.y_ref;
+        for (int i = 0; i < 3; i++)
+            entry.qb_l[i] = cluster_data.qb_l[i];
+        entry.qy_max = cluster_data.qy_max;
+        entry.tmax_version = cluster_data.tmax_version;
+        entry.num_nodes_in_stk_2 = cluster_data.num_nodes_in_stk_2;
+        return entry;
+    }
+
+    // restores the per-ray state of entry, the cluster's constants must already be set
+    template <typename cluster_data_T>
+    void set_cluster_stack_entry(const cluster_stack_entry_t &entry, cluster_data_T &cluster_data)
+    {
+        assert(cluster_data.cluster_idx == entry.cluster_idx);
+        cluster_data.y_ref = entry.y_ref;
+        for (int i = 0; i < 3; i++)
+        {
+            cluster_data.qb_l[i] = entry.qb_l[i];
+            cluster_data.qb_h[i] = entry.qb_l[i] + 1;
+        }
+        cluster_data.qy_max = entry.qy_max;
+        cluster_data.tmax_version = entry.tmax_version;
+        cluster_data.num_nodes_in_stk_2 = entry.num_nodes_in_stk_2;
+    }
+
+    // LIFO for the traversal stacks whose first Capacity entries live inline, so tracing a ray allocates
+    // nothing and entries are only constructed when pushed. Overflow policy: pushes beyond Capacity spill
+    // to a heap buffer, traversals of degenerate trees stay exact and only they pay for the allocation.
+    template <typename T, size_t Capacity>
+    class fixed_stack_t
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "fixed_stack_t never destroys its entries");
+
+    public:
+        fixed_stack_t() {}
+
+        bool empty() const { return size == 0; }
+
+        T &top()
+        {
+            assert(size != 0);
+            return size <= Capacity ? items[size - 1] : spilled.back();
+        }
+
+        void push(const T &item)
+        {
+            if (size < Capacity)
+                new (&items[size]) T(item);
+            else
+                spilled.push_back(item);
+            size++;
+        }
+
+        template <typename... Args>
+        void emplace(Args &&...args) { push(T(std::forward<Args>(args)...)); }
+
+        void pop()
+        {
+            assert(size != 0);
+            if (size > Capacity)
+                spilled.pop_back();
+            size--;
+        }
+
+        void clear()
+        {
+            size = 0;
+            spilled.clear();
+        }
+
+    private:
+        union
+        {
+            T items[Capacity];
+        };
+        size_t size = 0;
+        std::vector<T> spilled;
+    };
+
+    // inline entries of stk_2 ([local_node_idx, cluster_idx], up to width - 1 per level) and of stk_1 (one
+    // per cluster on the path with nodes left on stk_2), see fixed_stack_t for deeper traversals
+    constexpr size_t node_stack_capacity = 128;
+    constexpr size_t cluster_stack_capacity = 16;
+
+    typedef fixed_stack_t<std::pair<uint16_t, uint32_t>, node_stack_capacity> node_stack_t;
+    typedef fixed_stack_t<cluster_stack_entry_t, cluster_stack_capacity> cluster_stack_t;
+
     struct int_w_t
     {
         bool iw[3];
         uint8_t rw_l[3];
-        uint8_t qw_l[3];
+        uint16_t qw_l[3];
         uint8_t rw_h[3];
-        uint8_t qw_h[3];
+        uint16_t qw_h[3];
     };
 
     struct statistics_t
@@ -69,8 +206,90 @@ namespace bvh_quantize
         uintmax_t traversal_steps = 0;
         uintmax_t both_intersected = 0;
         uintmax_t finalize = 0;
+        // quantized triangles tested, and those that needed the full-precision triangle
+        uintmax_t qtrig_tests = 0;
+        uintmax_t qtrig_candidates = 0;
+        // traversal steps whose node lies in the INT_BVH_ALIGNMENT line of the previous step's node
+        uintmax_t same_line_steps = 0;
+        // node and triangle (or quantized triangle) fetches that straddle two INT_BVH_ALIGNMENT lines
+        uintmax_t straddling_node_fetches = 0;
+        uintmax_t straddling_trig_fetches = 0;
+
+        // sums the statistics of another thread
+        statistics_t &operator+=(const statistics_t &other)
+        {
+            bvh_statistics.intersections_a += other.bvh_statistics.intersections_a;
+            bvh_statistics.intersections_b += other.bvh_statistics.intersections_b;
+            intersect_bbox += other.intersect_bbox;
+            push_cluster += other.push_cluster;
+            recompute_qymax += other.recompute_qymax;
+            traversal_steps += other.traversal_steps;
+            both_intersected += other.both_intersected;
+            finalize += other.finalize;
+            qtrig_tests += other.qtrig_tests;
+            qtrig_candidates += other.qtrig_candidates;
+            same_line_steps += other.same_line_steps;
+            straddling_node_fetches += other.straddling_node_fetches;
+            straddling_trig_fetches += other.straddling_trig_fetches;
+            return *this;
+        }
     };
 
+    // may_hit_qtrig for the index-th triangle, always true without quantized triangles
+    inline bool may_hit_trig(const int_qtrig_t *qtrigs, size_t index, const qtrig_frame_t &frame, const ray_t &ray,
+                             statistics_t &statistics)
+    {
+        if (!qtrigs)
+            return true;
+
+        statistics.qtrig_tests++;
+        statistics.straddling_trig_fetches += count_straddles(index, 1, INT_BVH_QTRIG_length);
+        const float o[3] = {ray.origin[0], ray.origin[1], ray.origin[2]};
+        const float d[3] = {ray.direction[0], ray.direction[1], ray.direction[2]};
+        if (!may_hit_qtrig(qtrigs[index], frame, o, d, ray.tmin, ray.tmax))
+            return false;
+
+        statistics.qtrig_candidates++;
+        return true;
+    }
+
+    // the index-th triangle's test in the stored format, trig_t::intersect unless the int_bvh has
+    // int_trig_xform_t (which also counts in intersections_b only the hits)
+    inline std::optional<intersection_t> intersect_trig(const trig_t *trigs, const int_trig_xform_t *xforms, size_t index,
+                                                        const ray_t &ray, statistics_t &statistics)
+    {
+        statistics.straddling_trig_fetches += count_straddles(index, 1, INT_BVH_TRIG_length);
+        if (!xforms)
+            return trigs[index].intersect(ray, statistics.bvh_statistics);
+
+        statistics.bvh_statistics.intersections_a++;
+        const float o[3] = {ray.origin[0], ray.origin[1], ray.origin[2]};
+        const float d[3] = {ray.direction[0], ray.direction[1], ray.direction[2]};
+        float t, u, v;
+        if (!intersect_trig_xform(xforms[index], o, d, ray.tmin, ray.tmax, t, u, v))
+            return std::nullopt;
+        statistics.bvh_statistics.intersections_b++;
+        return intersection_t{t, u, v};
+    }
+
+    // whether a hit distance of an int_bvh matches the float BVH's ref_t: exactly with triangle vertices, the
+    // transformed triangles round differently from trig_t::intersect and only have to agree within 1e-4 of
+    // ref_t (of 1 for hits closer than that, whose error follows the scale of the scene rather than t)
+    inline bool is_same_distance(float t, float ref_t)
+    {
+        return t == ref_t ||
+               (trig_format == trig_format_t::XFORM && std::abs(t - ref_t) <= 1e-4f * std::max(std::abs(ref_t), 1.0f));
+    }
+
+    // like is_same_distance, u and v of transformed triangles within 1e-3
+    inline bool is_same_hit(const intersection_t &hit, const intersection_t &ref_hit)
+    {
+        if (trig_format == trig_format_t::VERTICES)
+            return hit.t == ref_hit.t && hit.u == ref_hit.u && hit.v == ref_hit.v;
+        return is_same_distance(hit.t, ref_hit.t) && std::abs(hit.u - ref_hit.u) <= 1e-3f &&
+               std::abs(hit.v - ref_hit.v) <= 1e-3f;
+    }
+
     int_w_t get_int_w(const std::array<float, 3> &w)
     {
         int_w_t int_w{};
@@ -83,18 +302,19 @@ namespace bvh_quantize
             uint32_t exponent = (wi >> 23) & 0xff;
             uint32_t mantissa = wi & 0x7fffff;
 
-            // 127 + 7 = 134
+            // keep quant_bits - 1 mantissa bits, matching inv_sw = 2^(quant_bits - 1)
+            constexpr uint32_t qw_bits = quant_bits - 1;
             uint32_t near_exponent = (exponent - 127) & 0b11111;
-            uint32_t near_mantissa = mantissa >> 16;
-            uint32_t near = (near_exponent << 7) | near_mantissa;
+            uint32_t near_mantissa = mantissa >> (23 - qw_bits);
+            uint32_t near = (near_exponent << qw_bits) | near_mantissa;
 
             uint32_t far = near + 1;
-            uint32_t far_exponent = far >> 7;
-            uint32_t far_mantissa = far & 0b1111111;
+            uint32_t far_exponent = far >> qw_bits;
+            uint32_t far_mantissa = far & ((1u << qw_bits) - 1);
 
             int_w.iw[i] = sign;
-            near_mantissa |= 0b10000000;
-            far_mantissa |= 0b10000000;
+            near_mantissa |= 1u << qw_bits;
+            far_mantissa |= 1u << qw_bits;
 
             if (sign)
             {
@@ -115,7 +335,7 @@ namespace bvh_quantize
         return int_w;
     }
 
-    std::optional<intersection_t> intersect_leaf(const decoded_data_t &decoded_data, const cluster_data_t &curr_cluster, ray_t &ray, const int_bvh_t &int_bvh, statistics_t &statistics)
+    std::optional<intersection_t> intersect_leaf(const decoded_data_t &decoded_data, const cluster_data_t &curr_cluster, ray_t &ray, const int_bvh_t &int_bvh, statistics_t &statistics, bool any_hit = false)
     {
         assert(decoded_data.child_type == child_type_t::LEAF);
         std::optional<intersection_t> best_hit;
@@ -123,12 +343,14 @@ namespace bvh_quantize
         for (int i = 0; i < decoded_data.num_trigs; i++)
         {
             uint32_t primID = curr_cluster.trig_offset + decoded_data.idx + i;
-            trig_t *tmp_trigs = &int_bvh.trigs[primID];
-
-            if (auto hit = tmp_trigs->intersect(ray, statistics.bvh_statistics))
+            if (!may_hit_trig(int_bvh.qtrigs.get(), primID, curr_cluster.qtrig_frame, ray, statistics))
+                continue;
+            if (auto hit = intersect_trig(int_bvh.trigs.get(), int_bvh.xforms.get(), primID, ray, statistics))
             {
                 best_hit = hit.value();
                 ray.tmax = hit->t;
+                if (any_hit)
+                    break;
             }
         }
 
@@ -158,47 +380,50 @@ namespace bvh_quantize
             return std::nullopt;
     }
 
-    std::optional<int32_t> intersect_int_bbox(int32_t qy_max,
-                                              const int_w_t &int_w,
-                                              const uint8_t *qx,
-                                              const int32_t *qb_l,
-                                              const int32_t *qb_h)
+    std::optional<int_dist_t> intersect_int_bbox(int_dist_t qy_max,
+                                                 const int_w_t &int_w,
+                                                 const uint8_t *qx,
+                                                 const int_dist_t *qb_l,
+                                                 const int_dist_t *qb_h)
     {
-        const int32_t qx_a[3] = {// we use int32_t instead of uint8_t just for convenience
-                                 int_w.iw[0] ? qx[1] : qx[0],
-                                 int_w.iw[1] ? qx[3] : qx[2],
-                                 int_w.iw[2] ? qx[5] : qx[4]};
+        const int32_t qx_a[3] = {// qx is packed, see get_qx
+                                 static_cast<int32_t>(get_qx(qx, int_w.iw[0] ? 1 : 0)),
+                                 static_cast<int32_t>(get_qx(qx, int_w.iw[1] ? 3 : 2)),
+                                 static_cast<int32_t>(get_qx(qx, int_w.iw[2] ? 5 : 4))};
 
         const int32_t qx_b[3] = {
-            int_w.iw[0] ? qx[0] : qx[1],
-            int_w.iw[1] ? qx[2] : qx[3],
-            int_w.iw[2] ? qx[4] : qx[5]};
-
-        int32_t entry[3];
-        int32_t exit[3];
-        entry[0] = (int_w.qw_l[0] * qx_a[0]) << int_w.rw_l[0];
+            static_cast<int32_t>(get_qx(qx, int_w.iw[0] ? 0 : 1)),
+            static_cast<int32_t>(get_qx(qx, int_w.iw[1] ? 2 : 3)),
+            static_cast<int32_t>(get_qx(qx, int_w.iw[2] ? 4 : 5))};
+
+        // products reach 2 * quant_bits + 31 bits, so accumulate in 64 bits
+        int64_t entry[3];
+        int64_t exit[3];
+        entry[0] = (static_cast<int64_t>(int_w.qw_l[0]) * qx_a[0]) << int_w.rw_l[0];
         entry[0] = (int_w.iw[0] ? -entry[0] : entry[0]) + qb_l[0];
-        entry[1] = (int_w.qw_l[1] * qx_a[1]) << int_w.rw_l[1];
+        entry[1] = (static_cast<int64_t>(int_w.qw_l[1]) * qx_a[1]) << int_w.rw_l[1];
         entry[1] = (int_w.iw[1] ? -entry[1] : entry[1]) + qb_l[1];
-        entry[2] = (int_w.qw_l[2] * qx_a[2]) << int_w.rw_l[2];
+        entry[2] = (static_cast<int64_t>(int_w.qw_l[2]) * qx_a[2]) << int_w.rw_l[2];
         entry[2] = (int_w.iw[2] ? -entry[2] : entry[2]) + qb_l[2];
-        exit[0] = (int_w.qw_h[0] * qx_b[0]) << int_w.rw_h[0];
+        exit[0] = (static_cast<int64_t>(int_w.qw_h[0]) * qx_b[0]) << int_w.rw_h[0];
         exit[0] = (int_w.iw[0] ? -exit[0] : exit[0]) + qb_h[0];
-        exit[1] = (int_w.qw_h[1] * qx_b[1]) << int_w.rw_h[1];
+        exit[1] = (static_cast<int64_t>(int_w.qw_h[1]) * qx_b[1]) << int_w.rw_h[1];
         exit[1] = (int_w.iw[1] ? -exit[1] : exit[1]) + qb_h[1];
-        exit[2] = (int_w.qw_h[2] * qx_b[2]) << int_w.rw_h[2];
+        exit[2] = (static_cast<int64_t>(int_w.qw_h[2]) * qx_b[2]) << int_w.rw_h[2];
         exit[2] = (int_w.iw[2] ? -exit[2] : exit[2]) + qb_h[2];
 
-        int32_t entry_ = std::max(entry[0], std::max(entry[1], std::max(entry[2], 0)));
-        int32_t exit_ = std::min(exit[0], std::min(exit[1], std::min(exit[2], qy_max)));
+        int64_t entry_ = std::max(entry[0], std::max(entry[1], std::max(entry[2], int64_t{0})));
+        int64_t exit_ = std::min(exit[0], std::min(exit[1], std::min(exit[2], static_cast<int64_t>(qy_max))));
 
         if (entry_ <= exit_)
-            return entry_;
+            return static_cast<int_dist_t>(entry_); // 0 <= entry_ <= qy_max
         else
             return std::nullopt;
     }
 
-    std::optional<intersection_t> int_traverse(int_bvh_t &int_bvh, trig_t *trigs, ray_t ray, statistics_t &statistics)
+    // Closest hit of ray, or with any_hit (occlusion, terminate on first hit) the first hit found: the
+    // traversal stops right there, so shadow rays fetch only the nodes and triangles up to that hit.
+    std::optional<intersection_t> int_traverse(int_bvh_t &int_bvh, trig_t *trigs, ray_t ray, statistics_t &statistics, bool any_hit = false)
     {
         std::optional<intersection_t> best_hit;
 
@@ -221,10 +446,25 @@ namespace bvh_quantize
 
         cluster_data_t cluster_data = {
             .num_nodes_in_stk_2 = 0};
-        std::stack<cluster_data_t> stk_1;
-        std::stack<std::pair<uint16_t, uint16_t>> stk_2; // [local_node_idx, cluster_idx]
+        cluster_stack_t stk_1;
+        node_stack_t stk_2; // [local_node_idx, cluster_idx]
+
+        // constants of the cluster, set when entering it and when returning to it from stk_1
+        auto set_cluster = [&](uint32_t cluster_idx, const int_cluster_t &cluster)
+        {
+            cluster_data.cluster_idx = cluster_idx;
+            cluster_data.local_nodes = &int_bvh.nodes[cluster.node_offset];
+            cluster_data.local_trigs = &int_bvh.trigs[cluster.trig_offset];
+            cluster_data.qtrig_frame = get_qtrig_frame(cluster);
 
-        auto update_cluster_data = [&](uint16_t cluster_idx) -> bool
+            cluster_data.node_offset = cluster.node_offset;
+            cluster_data.trig_offset = cluster.trig_offset;
+            cluster_data.child_cluster_offset = cluster.child_cluster_offset;
+
+            cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+        };
+
+        auto update_cluster_data = [&](uint32_t cluster_idx) -> bool
         {
             statistics.intersect_bbox++;
             int_cluster_t cluster = int_bvh.clusters[cluster_idx];
@@ -233,29 +473,24 @@ namespace bvh_quantize
                 return false;
 
             if (cluster_data.num_nodes_in_stk_2 != 0)
-                stk_1.push(cluster_data);
+                stk_1.push(get_cluster_stack_entry(cluster_data));
 
             statistics.push_cluster++;
-            cluster_data.cluster_idx = cluster_idx;
-            cluster_data.local_nodes = &int_bvh.nodes[cluster.node_offset];
-            cluster_data.local_trigs = &int_bvh.trigs[cluster.trig_offset];
-
-            cluster_data.node_offset = cluster.node_offset;
-            cluster_data.trig_offset = cluster.trig_offset;
-
-            cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+            set_cluster(cluster_idx, cluster);
             cluster_data.y_ref = y_ref.value();
 
             for (int i = 0; i < 3; i++)
             {
                 // float o_local = ray.origin[i] + y_ref.value() * ray.direction[i] - cluster.ref_bounds[2 * i];
                 // cluster_data.qb_l[i] = floor_to_int32(-o_local * w[i] * cluster_data.inv_sx_inv_sw);
-                cluster_data.qb_l[i] = floor_to_int32((b[i] - y_ref.value() + cluster.ref_bounds[2 * i] * w[i]) *
-                                                      cluster_data.inv_sx_inv_sw);
+                cluster_data.qb_l[i] = floor_to_int_dist((static_cast<int_dist_float_t>(b[i]) - y_ref.value() +
+                                                          cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[i])) *
+                                                         cluster_data.inv_sx_inv_sw);
                 cluster_data.qb_h[i] = cluster_data.qb_l[i] + 1;
             }
             cluster_data.tmax_version = global_tmax_version;
-            cluster_data.qy_max = ceil_to_int32((ray.tmax - cluster_data.y_ref) * cluster_data.inv_sx_inv_sw);
+            cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - cluster_data.y_ref) *
+                                                   cluster_data.inv_sx_inv_sw);
             cluster_data.num_nodes_in_stk_2 = 0;
             return true;
         };
@@ -274,7 +509,7 @@ namespace bvh_quantize
                 return true;
             case child_type_t::SWITCH:
                 left_local_node_idx = 0;
-                return update_cluster_data(decoded_data.idx);
+                return update_cluster_data(cluster_data.child_cluster_offset + decoded_data.idx);
             default:
                 assert(false);
             }
@@ -292,7 +527,7 @@ namespace bvh_quantize
             std::cout << "bounds: ";
             for (int i = 0; i < 6; i++)
             {
-                std::cout << static_cast<int>(n.bounds[i]) << " ";
+                std::cout << get_qx(n.bounds, i) << " ";
             }
         };
 
@@ -312,7 +547,8 @@ namespace bvh_quantize
             {
                 statistics.recompute_qymax++;
                 cluster_data.tmax_version = global_tmax_version;
-                cluster_data.qy_max = ceil_to_int32((ray.tmax - cluster_data.y_ref) * cluster_data.inv_sx_inv_sw);
+                cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - cluster_data.y_ref) *
+                                                       cluster_data.inv_sx_inv_sw);
             }
 
             statistics.traversal_steps++;
@@ -336,10 +572,16 @@ namespace bvh_quantize
             {
                 if (left_decoded_data.child_type == child_type_t::LEAF)
                 {
-                    if (auto hit = intersect_leaf(left_decoded_data, cluster_data, ray, int_bvh, statistics))
+                    if (auto hit = intersect_leaf(left_decoded_data, cluster_data, ray, int_bvh, statistics, any_hit))
                     {
                         best_hit = hit;
                         global_tmax_version++;
+                        // an occlusion ray is done with its first hit
+                        if (any_hit)
+                        {
+                            statistics.finalize++;
+                            return best_hit;
+                        }
                     }
                 }
                 else
@@ -352,10 +594,16 @@ namespace bvh_quantize
             {
                 if (right_decoded_data.child_type == child_type_t::LEAF)
                 {
-                    if (auto hit = intersect_leaf(right_decoded_data, cluster_data, ray, int_bvh, statistics))
+                    if (auto hit = intersect_leaf(right_decoded_data, cluster_data, ray, int_bvh, statistics, any_hit))
                     {
                         best_hit = hit;
                         global_tmax_version++;
+                        // an occlusion ray is done with its first hit
+                        if (any_hit)
+                        {
+                            statistics.finalize++;
+                            return best_hit;
+                        }
                     }
                 }
                 else
@@ -382,7 +630,7 @@ namespace bvh_quantize
                         stk_2.emplace(right_decoded_data.idx, cluster_data.cluster_idx);
                         break;
                     case child_type_t::SWITCH:
-                        stk_2.emplace(0, right_decoded_data.idx);
+                        stk_2.emplace(0, cluster_data.child_cluster_offset + right_decoded_data.idx);
                         break;
                     default:
                         assert(false);
@@ -403,7 +651,7 @@ namespace bvh_quantize
                 if (stk_2.empty())
                     goto end;
                 left_local_node_idx = stk_2.top().first;
-                int cluster_idx = stk_2.top().second;
+                uint32_t cluster_idx = stk_2.top().second;
                 stk_2.pop();
                 if (cluster_data.cluster_idx == cluster_idx)
                 {
@@ -412,7 +660,8 @@ namespace bvh_quantize
                 }
                 if ((!stk_1.empty() && stk_1.top().cluster_idx == cluster_idx))
                 {
-                    cluster_data = stk_1.top();
+                    set_cluster(cluster_idx, int_bvh.clusters[cluster_idx]);
+                    set_cluster_stack_entry(stk_1.top(), cluster_data);
                     stk_1.pop();
                     cluster_data.num_nodes_in_stk_2--;
                     break;
@@ -429,7 +678,7 @@ namespace bvh_quantize
         return best_hit;
     }
 
-    std::optional<intersection_t> intersect_leaf_v2(const decoded_data_t &decoded_data, const cluster_data_v2_t &curr_cluster, ray_t &ray, const int_bvh_v2_t &int_bvh_v2, statistics_t &statistics)
+    std::optional<intersection_t> intersect_leaf_v2(const decoded_data_t &decoded_data, const cluster_data_v2_t &curr_cluster, ray_t &ray, const int_bvh_v2_t &int_bvh_v2, statistics_t &statistics, bool any_hit = false)
     {
         assert(decoded_data.child_type == child_type_t::LEAF);
         std::optional<intersection_t> best_hit;
@@ -437,19 +686,22 @@ namespace bvh_quantize
         for (int i = 0; i < decoded_data.num_trigs; i++)
         {
             uint32_t primID = curr_cluster.trig_offset + decoded_data.idx + i;
-            trig_t *tmp_trigs = &int_bvh_v2.trigs[primID];
-
-            if (auto hit = tmp_trigs->intersect(ray, statistics.bvh_statistics))
+            if (!may_hit_trig(int_bvh_v2.qtrigs.get(), primID, curr_cluster.qtrig_frame, ray, statistics))
+                continue;
+            if (auto hit = intersect_trig(int_bvh_v2.trigs.get(), int_bvh_v2.xforms.get(), primID, ray, statistics))
             {
                 best_hit = hit.value();
                 ray.tmax = hit->t;
+                if (any_hit)
+                    break;
             }
         }
 
         return best_hit;
     }
 
-    std::optional<intersection_t> int_traverse_v2(int_bvh_v2_t &int_bvh_v2, trig_t *trigs, ray_t ray, statistics_t &statistics)
+    // int_traverse on int_bvh_v2_t, any_hit likewise returns the first hit found
+    std::optional<intersection_t> int_traverse_v2(int_bvh_v2_t &int_bvh_v2, trig_t *trigs, ray_t ray, statistics_t &statistics, bool any_hit = false)
     {
         std::optional<intersection_t> best_hit;
 
@@ -472,10 +724,25 @@ namespace bvh_quantize
 
         cluster_data_v2_t cluster_data = {
             .num_nodes_in_stk_2 = 0};
-        std::stack<cluster_data_v2_t> stk_1;
-        std::stack<std::pair<uint16_t, uint16_t>> stk_2; // [local_node_idx, cluster_idx]
+        cluster_stack_t stk_1;
+        node_stack_t stk_2; // [local_node_idx, cluster_idx]
+
+        // constants of the cluster, set when entering it and when returning to it from stk_1
+        auto set_cluster = [&](uint32_t cluster_idx, const int_cluster_t &cluster)
+        {
+            cluster_data.cluster_idx = cluster_idx;
+            cluster_data.local_nodes = &int_bvh_v2.nodes_v2[cluster.node_offset];
+            cluster_data.local_trigs = &int_bvh_v2.trigs[cluster.trig_offset];
+            cluster_data.qtrig_frame = get_qtrig_frame(cluster);
+
+            cluster_data.node_offset = cluster.node_offset;
+            cluster_data.trig_offset = cluster.trig_offset;
+            cluster_data.child_cluster_offset = cluster.child_cluster_offset;
+
+            cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+        };
 
-        auto update_cluster_data = [&](uint16_t cluster_idx) -> bool
+        auto update_cluster_data = [&](uint32_t cluster_idx) -> bool
         {
             statistics.intersect_bbox++;
             int_cluster_t cluster = int_bvh_v2.clusters[cluster_idx];
@@ -484,29 +751,24 @@ namespace bvh_quantize
                 return false;
 
             if (cluster_data.num_nodes_in_stk_2 != 0)
-                stk_1.push(cluster_data);
+                stk_1.push(get_cluster_stack_entry(cluster_data));
 
             statistics.push_cluster++;
-            cluster_data.cluster_idx = cluster_idx;
-            cluster_data.local_nodes = &int_bvh_v2.nodes_v2[cluster.node_offset];
-            cluster_data.local_trigs = &int_bvh_v2.trigs[cluster.trig_offset];
-
-            cluster_data.node_offset = cluster.node_offset;
-            cluster_data.trig_offset = cluster.trig_offset;
-
-            cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+            set_cluster(cluster_idx, cluster);
             cluster_data.y_ref = y_ref.value();
 
             for (int i = 0; i < 3; i++)
             {
                 // float o_local = ray.origin[i] + y_ref.value() * ray.direction[i] - cluster.ref_bounds[2 * i];
                 // cluster_data.qb_l[i] = floor_to_int32(-o_local * w[i] * cluster_data.inv_sx_inv_sw);
-                cluster_data.qb_l[i] = floor_to_int32((b[i] - y_ref.value() + cluster.ref_bounds[2 * i] * w[i]) *
-                                                      cluster_data.inv_sx_inv_sw);
+                cluster_data.qb_l[i] = floor_to_int_dist((static_cast<int_dist_float_t>(b[i]) - y_ref.value() +
+                                                          cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[i])) *
+                                                         cluster_data.inv_sx_inv_sw);
                 cluster_data.qb_h[i] = cluster_data.qb_l[i] + 1;
             }
             cluster_data.tmax_version = global_tmax_version;
-            cluster_data.qy_max = ceil_to_int32((ray.tmax - cluster_data.y_ref) * cluster_data.inv_sx_inv_sw);
+            cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - cluster_data.y_ref) *
+                                                   cluster_data.inv_sx_inv_sw);
             cluster_data.num_nodes_in_stk_2 = 0;
             return true;
         };
@@ -525,7 +787,7 @@ namespace bvh_quantize
                 return true;
             case child_type_t::SWITCH:
                 curr_local_node_idx = 0;
-                return update_cluster_data(decoded_data.idx);
+                return update_cluster_data(cluster_data.child_cluster_offset + decoded_data.idx);
             default:
                 assert(false);
             }
@@ -543,13 +805,14 @@ namespace bvh_quantize
             std::cout << "bounds: ";
             for (int i = 0; i < 6; i++)
             {
-                std::cout << static_cast<int>(bounds[i]) << " ";
+                std::cout << get_qx(bounds, i) << " ";
             }
         };
 
         // int_node_v2_t *curr_node = &int_bvh_v2.root;
         // bool traversed_root = false;
 
+        size_t prev_line = std::numeric_limits<size_t>::max();
         while (true)
         {
             statistics.traversal_steps++;
@@ -566,6 +829,10 @@ namespace bvh_quantize
             // }
 
             int_node_v2_t *curr_node = &cluster_data.local_nodes[curr_local_node_idx];
+            size_t curr_line = (cluster_data.node_offset + curr_local_node_idx) * sizeof(int_node_v2_t) / INT_BVH_ALIGNMENT;
+            statistics.same_line_steps += curr_line == prev_line;
+            statistics.straddling_node_fetches += count_straddles(cluster_data.node_offset + curr_local_node_idx, 1, sizeof(int_node_v2_t));
+            prev_line = curr_line;
             decoded_data_t left_decoded_data = decode_data(curr_node->left_child_data);
             decoded_data_t right_decoded_data = decode_data(curr_node->right_child_data);
 
@@ -579,7 +846,8 @@ namespace bvh_quantize
             {
                 statistics.recompute_qymax++;
                 cluster_data.tmax_version = global_tmax_version;
-                cluster_data.qy_max = ceil_to_int32((ray.tmax - cluster_data.y_ref) * cluster_data.inv_sx_inv_sw);
+                cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - cluster_data.y_ref) *
+                                                       cluster_data.inv_sx_inv_sw);
             }
 
             auto distance_left = intersect_int_bbox(cluster_data.qy_max, int_w, curr_node->left_bounds,
@@ -594,10 +862,16 @@ namespace bvh_quantize
             {
                 if (left_decoded_data.child_type == child_type_t::LEAF)
                 {
-                    if (auto hit = intersect_leaf_v2(left_decoded_data, cluster_data, ray, int_bvh_v2, statistics))
+                    if (auto hit = intersect_leaf_v2(left_decoded_data, cluster_data, ray, int_bvh_v2, statistics, any_hit))
                     {
                         best_hit = hit;
                         global_tmax_version++;
+                        // an occlusion ray is done with its first hit
+                        if (any_hit)
+                        {
+                            statistics.finalize++;
+                            return best_hit;
+                        }
                     }
                 }
                 else
@@ -610,10 +884,16 @@ namespace bvh_quantize
             {
                 if (right_decoded_data.child_type == child_type_t::LEAF)
                 {
-                    if (auto hit = intersect_leaf_v2(right_decoded_data, cluster_data, ray, int_bvh_v2, statistics))
+                    if (auto hit = intersect_leaf_v2(right_decoded_data, cluster_data, ray, int_bvh_v2, statistics, any_hit))
                     {
                         best_hit = hit;
                         global_tmax_version++;
+                        // an occlusion ray is done with its first hit
+                        if (any_hit)
+                        {
+                            statistics.finalize++;
+                            return best_hit;
+                        }
                     }
                 }
                 else
@@ -640,7 +920,7 @@ namespace bvh_quantize
                         stk_2.emplace(right_decoded_data.idx, cluster_data.cluster_idx);
                         break;
                     case child_type_t::SWITCH:
-                        stk_2.emplace(0, right_decoded_data.idx);
+                        stk_2.emplace(0, cluster_data.child_cluster_offset + right_decoded_data.idx);
                         break;
                     default:
                         assert(false);
@@ -661,7 +941,7 @@ namespace bvh_quantize
                 if (stk_2.empty())
                     goto end;
                 curr_local_node_idx = stk_2.top().first;
-                int cluster_idx = stk_2.top().second;
+                uint32_t cluster_idx = stk_2.top().second;
                 stk_2.pop();
                 if (cluster_data.cluster_idx == cluster_idx)
                 {
@@ -670,7 +950,8 @@ namespace bvh_quantize
                 }
                 if ((!stk_1.empty() && stk_1.top().cluster_idx == cluster_idx))
                 {
-                    cluster_data = stk_1.top();
+                    set_cluster(cluster_idx, int_bvh_v2.clusters[cluster_idx]);
+                    set_cluster_stack_entry(stk_1.top(), cluster_data);
                     stk_1.pop();
                     cluster_data.num_nodes_in_stk_2--;
                     break;
@@ -687,6 +968,890 @@ namespace bvh_quantize
         return best_hit;
     }
 
+    // int_w_t of the rays of a packet, one lane per ray
+    template <int P>
+    struct packet_w_t
+    {
+        int64_t neg[3][P]; // -1 where iw, 0 otherwise
+        int64_t qw_l[3][P];
+        int64_t rw_l[3][P];
+        int64_t qw_h[3][P];
+        int64_t rw_h[3][P];
+    };
+
+    // cluster_data_v2_t of a packet, lanes outside mask did not enter the cluster
+    template <int P>
+    struct packet_cluster_v2_t
+    {
+        uint32_t cluster_idx;
+        uint32_t mask;
+        uint32_t node_offset;
+        uint32_t trig_offset;
+        uint32_t child_cluster_offset;
+        float inv_sx_inv_sw;
+        uint32_t tmax_version;
+        uint32_t num_nodes_in_stk_2;
+        qtrig_frame_t qtrig_frame;
+        float y_ref[P];
+        int64_t qb_l[3][P];
+        int64_t qb_h[3][P];
+        int64_t qy_max[P];
+    };
+
+    // intersect_int_bbox for every lane of a packet, returns the mask of lanes that hit and their entries in
+    // distance. Lanes are evaluated 8 (AVX-512) or 4 (AVX2) at a time where available.
+    template <int P>
+    uint32_t intersect_int_bbox_packet(const packet_w_t<P> &packet_w, const packet_cluster_v2_t<P> &cluster,
+                                       const uint8_t *qx, int64_t *distance)
+    {
+        int64_t qx_lo[3], qx_hi[3];
+        for (int i = 0; i < 3; i++)
+        {
+            qx_lo[i] = get_qx(qx, 2 * i);
+            qx_hi[i] = get_qx(qx, 2 * i + 1);
+        }
+
+        uint32_t mask = 0;
+#if defined(__AVX512F__)
+        for (int k = 0; k < P; k += 8)
+        {
+            __m512i entry = _mm512_setzero_si512();
+            __m512i exit = _mm512_loadu_si512(&cluster.qy_max[k]);
+            for (int i = 0; i < 3; i++)
+            {
+                __m512i neg = _mm512_loadu_si512(&packet_w.neg[i][k]);
+                __mmask8 iw = _mm512_cmpneq_epi64_mask(neg, _mm512_setzero_si512());
+                __m512i lo = _mm512_set1_epi64(qx_lo[i]);
+                __m512i hi = _mm512_set1_epi64(qx_hi[i]);
+                // qw and qx fit in 32 bits, so the low 32x32 bit multiply is exact
+                __m512i a = _mm512_mul_epu32(_mm512_loadu_si512(&packet_w.qw_l[i][k]), _mm512_mask_blend_epi64(iw, lo, hi));
+                __m512i b = _mm512_mul_epu32(_mm512_loadu_si512(&packet_w.qw_h[i][k]), _mm512_mask_blend_epi64(iw, hi, lo));
+                a = _mm512_sllv_epi64(a, _mm512_loadu_si512(&packet_w.rw_l[i][k]));
+                b = _mm512_sllv_epi64(b, _mm512_loadu_si512(&packet_w.rw_h[i][k]));
+                a = _mm512_add_epi64(_mm512_sub_epi64(_mm512_xor_si512(a, neg), neg), _mm512_loadu_si512(&cluster.qb_l[i][k]));
+                b = _mm512_add_epi64(_mm512_sub_epi64(_mm512_xor_si512(b, neg), neg), _mm512_loadu_si512(&cluster.qb_h[i][k]));
+                entry = _mm512_max_epi64(entry, a);
+                exit = _mm512_min_epi64(exit, b);
+            }
+            _mm512_storeu_si512(&distance[k], entry);
+            mask |= static_cast<uint32_t>(_mm512_cmple_epi64_mask(entry, exit)) << k;
+        }
+#elif defined(__AVX2__)
+        auto max_epi64 = [](__m256i x, __m256i y)
+        { return _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(y, x)); };
+        auto min_epi64 = [](__m256i x, __m256i y)
+        { return _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(x, y)); };
+        auto load = [](const int64_t *x)
+        { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x)); };
+        for (int k = 0; k < P; k += 4)
+        {
+            __m256i entry = _mm256_setzero_si256();
+            __m256i exit = load(&cluster.qy_max[k]);
+            for (int i = 0; i < 3; i++)
+            {
+                __m256i neg = load(&packet_w.neg[i][k]);
+                __m256i lo = _mm256_set1_epi64x(qx_lo[i]);
+                __m256i hi = _mm256_set1_epi64x(qx_hi[i]);
+                // qw and qx fit in 32 bits, so the low 32x32 bit multiply is exact
+                __m256i a = _mm256_mul_epu32(load(&packet_w.qw_l[i][k]), _mm256_blendv_epi8(lo, hi, neg));
+                __m256i b = _mm256_mul_epu32(load(&packet_w.qw_h[i][k]), _mm256_blendv_epi8(hi, lo, neg));
+                a = _mm256_sllv_epi64(a, load(&packet_w.rw_l[i][k]));
+                b = _mm256_sllv_epi64(b, load(&packet_w.rw_h[i][k]));
+                a = _mm256_add_epi64(_mm256_sub_epi64(_mm256_xor_si256(a, neg), neg), load(&cluster.qb_l[i][k]));
+                b = _mm256_add_epi64(_mm256_sub_epi64(_mm256_xor_si256(b, neg), neg), load(&cluster.qb_h[i][k]));
+                entry = max_epi64(entry, a);
+                exit = min_epi64(exit, b);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(&distance[k]), entry);
+            __m256i miss = _mm256_cmpgt_epi64(entry, exit);
+            mask |= static_cast<uint32_t>(~_mm256_movemask_pd(_mm256_castsi256_pd(miss)) & 0xf) << k;
+        }
+#else
+        for (int k = 0; k < P; k++)
+        {
+            int64_t entry = 0;
+            int64_t exit = cluster.qy_max[k];
+            for (int i = 0; i < 3; i++)
+            {
+                int64_t neg = packet_w.neg[i][k];
+                int64_t a = (packet_w.qw_l[i][k] * (neg ? qx_hi[i] : qx_lo[i])) << packet_w.rw_l[i][k];
+                int64_t b = (packet_w.qw_h[i][k] * (neg ? qx_lo[i] : qx_hi[i])) << packet_w.rw_h[i][k];
+                entry = std::max(entry, ((a ^ neg) - neg) + cluster.qb_l[i][k]);
+                exit = std::min(exit, ((b ^ neg) - neg) + cluster.qb_h[i][k]);
+            }
+            distance[k] = entry;
+            mask |= static_cast<uint32_t>(entry <= exit) << k;
+        }
+#endif
+        return mask;
+    }
+
+    // Traces count <= P rays through int_bvh_v2 together, one stack for the packet and a lane mask per stack
+    // entry. Each node is tested against all rays of the packet at once (intersect_int_bbox_packet), every
+    // ray keeps its own y_ref, qb and qy_max, so its node tests are the ones of int_traverse_v2, only the
+    // visiting order follows the majority of the rays. The closest hit does not depend on that order unless
+    // two triangles are hit at the same t, such rays are traced again with int_traverse_v2, which keeps the
+    // hits bit-exact. statistics count steps and cluster entries per packet, triangle tests per ray.
+    template <int P>
+    void int_traverse_v2_packet(int_bvh_v2_t &int_bvh_v2, trig_t *trigs, const ray_t *rays, size_t count,
+                                std::optional<intersection_t> *hits, statistics_t &statistics)
+    {
+        static_assert(P == 8 || P == 16, "packets hold 8 or 16 rays");
+        assert(count <= P);
+
+        // preprocess rays, as int_traverse_v2
+        ray_t lane_rays[P];
+        std::array<bool, 3> octant[P];
+        std::array<float, 3> w[P];
+        std::array<float, 3> b[P];
+        packet_w_t<P> packet_w{};
+        uint32_t active = 0;
+        for (size_t lane = 0; lane < count; lane++)
+        {
+            const ray_t &ray = rays[lane];
+            assert(ray.tmin == 0.0f);
+            lane_rays[lane] = ray;
+            octant[lane] = {
+                std::signbit(ray.direction[0]),
+                std::signbit(ray.direction[1]),
+                std::signbit(ray.direction[2])};
+            w[lane] = {
+                1.0f / ray.direction[0],
+                1.0f / ray.direction[1],
+                1.0f / ray.direction[2]};
+            b[lane] = {
+                -ray.origin[0] * w[lane][0],
+                -ray.origin[1] * w[lane][1],
+                -ray.origin[2] * w[lane][2]};
+            int_w_t int_w = get_int_w(w[lane]);
+            for (int i = 0; i < 3; i++)
+            {
+                packet_w.neg[i][lane] = int_w.iw[i] ? -1 : 0;
+                packet_w.qw_l[i][lane] = int_w.qw_l[i];
+                packet_w.rw_l[i][lane] = int_w.rw_l[i];
+                packet_w.qw_h[i][lane] = int_w.qw_h[i];
+                packet_w.rw_h[i][lane] = int_w.rw_h[i];
+            }
+            hits[lane].reset();
+            active |= 1u << lane;
+        }
+        if (active == 0)
+            return;
+
+        auto for_each_lane = [](uint32_t mask, auto f)
+        {
+            for (; mask != 0; mask &= mask - 1)
+                f(__builtin_ctz(mask));
+        };
+
+        uint32_t global_tmax_version = 0;
+        uint32_t ties = 0;
+
+        struct stack_entry_t
+        {
+            uint16_t local_node_idx;
+            uint32_t cluster_idx;
+            uint32_t mask;
+        };
+        packet_cluster_v2_t<P> cluster_data{};
+        fixed_stack_t<packet_cluster_v2_t<P>, cluster_stack_capacity> stk_1;
+        fixed_stack_t<stack_entry_t, node_stack_capacity> stk_2;
+
+        auto update_qy_max = [&]()
+        {
+            for_each_lane(cluster_data.mask, [&](int lane)
+                          { cluster_data.qy_max[lane] = ceil_to_int_dist((static_cast<int_dist_float_t>(lane_rays[lane].tmax) -
+                                                                          cluster_data.y_ref[lane]) *
+                                                                         cluster_data.inv_sx_inv_sw); });
+            cluster_data.tmax_version = global_tmax_version;
+        };
+
+        // lanes of mask that enter the cluster, 0 leaves cluster_data untouched
+        auto update_cluster_data = [&](uint32_t cluster_idx, uint32_t mask) -> uint32_t
+        {
+            statistics.intersect_bbox++;
+            const int_cluster_t &cluster = int_bvh_v2.clusters[cluster_idx];
+            float y_ref[P];
+            uint32_t hit_mask = 0;
+            for_each_lane(mask, [&](int lane)
+                          {
+                              if (auto y = intersect_bbox(octant[lane], w[lane], cluster.ref_bounds, b[lane], lane_rays[lane].tmax))
+                              {
+                                  y_ref[lane] = y.value();
+                                  hit_mask |= 1u << lane;
+                              } });
+            if (hit_mask == 0)
+                return 0;
+
+            if (cluster_data.num_nodes_in_stk_2 != 0)
+                stk_1.push(cluster_data);
+
+            statistics.push_cluster++;
+            cluster_data.cluster_idx = cluster_idx;
+            cluster_data.mask = hit_mask;
+            cluster_data.node_offset = cluster.node_offset;
+            cluster_data.trig_offset = cluster.trig_offset;
+            cluster_data.child_cluster_offset = cluster.child_cluster_offset;
+            cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+            cluster_data.qtrig_frame = get_qtrig_frame(cluster);
+            for_each_lane(hit_mask, [&](int lane)
+                          {
+                              cluster_data.y_ref[lane] = y_ref[lane];
+                              for (int i = 0; i < 3; i++)
+                              {
+                                  int_dist_t qb_l = floor_to_int_dist((static_cast<int_dist_float_t>(b[lane][i]) - y_ref[lane] +
+                                                                       cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[lane][i])) *
+                                                                      cluster_data.inv_sx_inv_sw);
+                                  cluster_data.qb_l[i][lane] = qb_l;
+                                  cluster_data.qb_h[i][lane] = qb_l + 1;
+                              } });
+            update_qy_max();
+            cluster_data.num_nodes_in_stk_2 = 0;
+            return hit_mask;
+        };
+
+        auto intersect_leaf = [&](const decoded_data_t &decoded_data, uint32_t mask)
+        {
+            bool any_hit = false;
+            for_each_lane(mask, [&](int lane)
+                          {
+                              ray_t &ray = lane_rays[lane];
+                              for (int i = 0; i < decoded_data.num_trigs; i++)
+                              {
+                                  uint32_t primID = cluster_data.trig_offset + decoded_data.idx + i;
+                                  if (!may_hit_trig(int_bvh_v2.qtrigs.get(), primID, cluster_data.qtrig_frame, ray, statistics))
+                                      continue;
+                                  if (auto hit = intersect_trig(int_bvh_v2.trigs.get(), int_bvh_v2.xforms.get(), primID, ray, statistics))
+                                  {
+                                      const auto &best_hit = hits[lane];
+                                      if (best_hit.has_value() && best_hit->t == hit->t && (best_hit->u != hit->u || best_hit->v != hit->v))
+                                          ties |= 1u << lane;
+                                      hits[lane] = hit;
+                                      ray.tmax = hit->t;
+                                      any_hit = true;
+                                  }
+                              } });
+            if (any_hit)
+                global_tmax_version++;
+        };
+
+        // intersect root cluster
+        uint32_t curr_mask = update_cluster_data(0, active);
+        if (curr_mask == 0)
+            return;
+
+        uint16_t curr_local_node_idx = 0;
+        auto update_node_and_cluster = [&](const decoded_data_t &decoded_data, uint32_t mask) -> bool
+        {
+            switch (decoded_data.child_type)
+            {
+            case child_type_t::INTERNAL:
+                curr_local_node_idx = decoded_data.idx;
+                curr_mask = mask;
+                return true;
+            case child_type_t::SWITCH:
+                curr_local_node_idx = 0;
+                curr_mask = update_cluster_data(cluster_data.child_cluster_offset + decoded_data.idx, mask);
+                return curr_mask != 0;
+            default:
+                assert(false);
+                return false;
+            }
+        };
+
+        size_t prev_line = std::numeric_limits<size_t>::max();
+        while (true)
+        {
+            statistics.traversal_steps++;
+            int_node_v2_t *curr_node = &int_bvh_v2.nodes_v2[cluster_data.node_offset + curr_local_node_idx];
+            size_t curr_line = (cluster_data.node_offset + curr_local_node_idx) * sizeof(int_node_v2_t) / INT_BVH_ALIGNMENT;
+            statistics.same_line_steps += curr_line == prev_line;
+            statistics.straddling_node_fetches += count_straddles(cluster_data.node_offset + curr_local_node_idx, 1, sizeof(int_node_v2_t));
+            prev_line = curr_line;
+            decoded_data_t left_decoded_data = decode_data(curr_node->left_child_data);
+            decoded_data_t right_decoded_data = decode_data(curr_node->right_child_data);
+
+            if (cluster_data.tmax_version != global_tmax_version)
+            {
+                statistics.recompute_qymax++;
+                update_qy_max();
+            }
+
+            int64_t distance_left[P];
+            int64_t distance_right[P];
+            uint32_t left_mask = intersect_int_bbox_packet(packet_w, cluster_data, curr_node->left_bounds, distance_left) & curr_mask;
+            uint32_t right_mask = intersect_int_bbox_packet(packet_w, cluster_data, curr_node->right_bounds, distance_right) & curr_mask;
+
+            if (left_mask != 0 && left_decoded_data.child_type == child_type_t::LEAF)
+            {
+                intersect_leaf(left_decoded_data, left_mask);
+                left_mask = 0;
+            }
+            if (right_mask != 0 && right_decoded_data.child_type == child_type_t::LEAF)
+            {
+                intersect_leaf(right_decoded_data, right_mask);
+                right_mask = 0;
+            }
+
+            if (left_mask != 0)
+            {
+                if (right_mask != 0)
+                {
+                    statistics.both_intersected++;
+
+                    // ensure left_decoded_data is closer for most of the rays that hit both
+                    int closer_left = 0;
+                    for_each_lane(left_mask & right_mask, [&](int lane)
+                                  { closer_left += distance_left[lane] > distance_right[lane] ? -1 : 1; });
+                    if (closer_left < 0)
+                    {
+                        std::swap(left_decoded_data, right_decoded_data);
+                        std::swap(left_mask, right_mask);
+                    }
+
+                    // push to stk_2
+                    switch (right_decoded_data.child_type)
+                    {
+                    case child_type_t::INTERNAL:
+                        cluster_data.num_nodes_in_stk_2++;
+                        stk_2.push({right_decoded_data.idx, cluster_data.cluster_idx, right_mask});
+                        break;
+                    case child_type_t::SWITCH:
+                        stk_2.push({0, cluster_data.child_cluster_offset + right_decoded_data.idx, right_mask});
+                        break;
+                    default:
+                        assert(false);
+                    }
+                }
+                if (update_node_and_cluster(left_decoded_data, left_mask))
+                    continue;
+            }
+            else if (right_mask != 0)
+            {
+                if (update_node_and_cluster(right_decoded_data, right_mask))
+                    continue;
+            }
+
+            // pop from stk_2 until we found a valid node
+            while (true)
+            {
+                if (stk_2.empty())
+                    goto end;
+                stack_entry_t entry = stk_2.top();
+                stk_2.pop();
+                curr_local_node_idx = entry.local_node_idx;
+                curr_mask = entry.mask;
+                if (cluster_data.cluster_idx == entry.cluster_idx)
+                {
+                    cluster_data.num_nodes_in_stk_2--;
+                    break;
+                }
+                if ((!stk_1.empty() && stk_1.top().cluster_idx == entry.cluster_idx))
+                {
+                    cluster_data = stk_1.top();
+                    stk_1.pop();
+                    cluster_data.num_nodes_in_stk_2--;
+                    break;
+                }
+                curr_mask = update_cluster_data(entry.cluster_idx, entry.mask);
+                if (curr_mask != 0)
+                    break;
+            }
+        }
+
+    end:
+        assert(stk_1.empty());
+        for_each_lane(ties, [&](int lane)
+                      { hits[lane] = int_traverse_v2(int_bvh_v2, trigs, rays[lane], statistics); });
+        for_each_lane(active & ~ties, [&](int lane)
+                      { statistics.finalize += hits[lane].has_value(); });
+    }
+
+    template <int N>
+    std::optional<intersection_t> intersect_leaf_wide(const decoded_data_t &decoded_data, const cluster_data_wide_t<N> &curr_cluster, ray_t &ray, const int_bvh_wide_t<N> &int_bvh_wide, statistics_t &statistics, bool any_hit = false)
+    {
+        assert(decoded_data.child_type == child_type_t::LEAF);
+        std::optional<intersection_t> best_hit;
+
+        for (int i = 0; i < decoded_data.num_trigs; i++)
+        {
+            uint32_t primID = curr_cluster.trig_offset + decoded_data.idx + i;
+            if (!may_hit_trig(int_bvh_wide.qtrigs.get(), primID, curr_cluster.qtrig_frame, ray, statistics))
+                continue;
+            if (auto hit = intersect_trig(int_bvh_wide.trigs.get(), int_bvh_wide.xforms.get(), primID, ray, statistics))
+            {
+                best_hit = hit.value();
+                ray.tmax = hit->t;
+                if (any_hit)
+                    break;
+            }
+        }
+
+        return best_hit;
+    }
+
+    // int_traverse on int_bvh_wide_t<N>, any_hit likewise returns the first hit found
+    template <int N>
+    std::optional<intersection_t> int_traverse_wide(int_bvh_wide_t<N> &int_bvh_wide, trig_t *trigs, ray_t ray, statistics_t &statistics, bool any_hit = false)
+    {
+        std::optional<intersection_t> best_hit;
+
+        // preprocess ray
+        assert(ray.tmin == 0.0f);
+        std::array<bool, 3> octant = {
+            std::signbit(ray.direction[0]),
+            std::signbit(ray.direction[1]),
+            std::signbit(ray.direction[2])};
+        std::array<float, 3> w = {
+            1.0f / ray.direction[0],
+            1.0f / ray.direction[1],
+            1.0f / ray.direction[2]};
+        std::array<float, 3> b = {
+            -ray.origin[0] * w[0],
+            -ray.origin[1] * w[1],
+            -ray.origin[2] * w[2]};
+        int_w_t int_w = get_int_w(w);
+        uint8_t global_tmax_version = 0;
+
+        cluster_data_wide_t<N> cluster_data = {
+            .num_nodes_in_stk_2 = 0};
+        cluster_stack_t stk_1;
+        node_stack_t stk_2; // [local_node_idx, cluster_idx]
+
+        // constants of the cluster, set when entering it and when returning to it from stk_1
+        auto set_cluster = [&](uint32_t cluster_idx, const int_cluster_t &cluster)
+        {
+            cluster_data.cluster_idx = cluster_idx;
+            cluster_data.local_nodes = &int_bvh_wide.nodes[cluster.node_offset];
+            cluster_data.local_trigs = &int_bvh_wide.trigs[cluster.trig_offset];
+            cluster_data.qtrig_frame = get_qtrig_frame(cluster);
+
+            cluster_data.node_offset = cluster.node_offset;
+            cluster_data.trig_offset = cluster.trig_offset;
+            cluster_data.child_cluster_offset = cluster.child_cluster_offset;
+
+            cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+        };
+
+        auto update_cluster_data = [&](uint32_t cluster_idx) -> bool
+        {
+            statistics.intersect_bbox++;
+            int_cluster_t cluster = int_bvh_wide.clusters[cluster_idx];
+            auto y_ref = intersect_bbox(octant, w, cluster.ref_bounds, b, ray.tmax);
+            if (!y_ref.has_value())
+                return false;
+
+            if (cluster_data.num_nodes_in_stk_2 != 0)
+                stk_1.push(get_cluster_stack_entry(cluster_data));
+
+            statistics.push_cluster++;
+            set_cluster(cluster_idx, cluster);
+            cluster_data.y_ref = y_ref.value();
+
+            for (int i = 0; i < 3; i++)
+            {
+                cluster_data.qb_l[i] = floor_to_int_dist((static_cast<int_dist_float_t>(b[i]) - y_ref.value() +
+                                                          cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[i])) *
+                                                         cluster_data.inv_sx_inv_sw);
+                cluster_data.qb_h[i] = cluster_data.qb_l[i] + 1;
+            }
+            cluster_data.tmax_version = global_tmax_version;
+            cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - cluster_data.y_ref) *
+                                                   cluster_data.inv_sx_inv_sw);
+            cluster_data.num_nodes_in_stk_2 = 0;
+            return true;
+        };
+
+        // intersect root cluster
+        if (!update_cluster_data(0))
+            return std::nullopt;
+
+        uint16_t curr_local_node_idx = 0;
+        auto update_node_and_cluster = [&](const decoded_data_t &decoded_data) -> bool
+        {
+            switch (decoded_data.child_type)
+            {
+            case child_type_t::INTERNAL:
+                curr_local_node_idx = decoded_data.idx;
+                return true;
+            case child_type_t::SWITCH:
+                curr_local_node_idx = 0;
+                return update_cluster_data(cluster_data.child_cluster_offset + decoded_data.idx);
+            default:
+                assert(false);
+            }
+        };
+
+        size_t prev_line = std::numeric_limits<size_t>::max();
+        while (true)
+        {
+            statistics.traversal_steps++;
+
+            int_node_wide_t<N> *curr_node = &cluster_data.local_nodes[curr_local_node_idx];
+            size_t curr_line = (cluster_data.node_offset + curr_local_node_idx) * sizeof(int_node_wide_t<N>) / INT_BVH_ALIGNMENT;
+            statistics.same_line_steps += curr_line == prev_line;
+            statistics.straddling_node_fetches += count_straddles(cluster_data.node_offset + curr_local_node_idx, 1, sizeof(int_node_wide_t<N>));
+            prev_line = curr_line;
+
+            // optional, but can reduce traversal steps
+            if (cluster_data.tmax_version != global_tmax_version)
+            {
+                statistics.recompute_qymax++;
+                cluster_data.tmax_version = global_tmax_version;
+                cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - cluster_data.y_ref) *
+                                                       cluster_data.inv_sx_inv_sw);
+            }
+
+            // intersect every child against the same qy_max before visiting any leaf
+            std::array<decoded_data_t, N> decoded_data;
+            std::array<std::optional<int_dist_t>, N> distance;
+            for (int i = 0; i < N; i++)
+            {
+                decoded_data[i] = decode_data(curr_node->children[i].data);
+                if (decoded_data[i].child_type != child_type_t::EMPTY)
+                    distance[i] = intersect_int_bbox(cluster_data.qy_max, int_w, curr_node->children[i].bounds,
+                                                     cluster_data.qb_l, cluster_data.qb_h);
+            }
+
+            // [distance, decoded_data] of every intersected INTERNAL or SWITCH child
+            std::array<std::pair<int_dist_t, decoded_data_t>, N> hits;
+            int num_hits = 0;
+            for (int i = 0; i < N; i++)
+            {
+                if (!distance[i].has_value())
+                    continue;
+
+                if (decoded_data[i].child_type == child_type_t::LEAF)
+                {
+                    if (auto hit = intersect_leaf_wide(decoded_data[i], cluster_data, ray, int_bvh_wide, statistics, any_hit))
+                    {
+                        best_hit = hit;
+                        global_tmax_version++;
+                        // an occlusion ray is done with its first hit
+                        if (any_hit)
+                        {
+                            statistics.finalize++;
+                            return best_hit;
+                        }
+                    }
+                }
+                else
+                {
+                    hits[num_hits++] = std::make_pair(distance[i].value(), decoded_data[i]);
+                }
+            }
+
+            if (num_hits > 1)
+            {
+                statistics.both_intersected++;
+
+                // closest child first, ties keep the child order
+                std::stable_sort(hits.begin(), hits.begin() + num_hits,
+                                 [](const auto &a, const auto &c)
+                                 { return a.first < c.first; });
+
+                // push to stk_2, farthest first
+                for (int i = num_hits - 1; i > 0; i--)
+                {
+                    const decoded_data_t &far_decoded_data = hits[i].second;
+                    switch (far_decoded_data.child_type)
+                    {
+                    case child_type_t::INTERNAL:
+                        cluster_data.num_nodes_in_stk_2++;
+                        stk_2.emplace(far_decoded_data.idx, cluster_data.cluster_idx);
+                        break;
+                    case child_type_t::SWITCH:
+                        stk_2.emplace(0, cluster_data.child_cluster_offset + far_decoded_data.idx);
+                        break;
+                    default:
+                        assert(false);
+                    }
+                }
+            }
+
+            if (num_hits > 0)
+            {
+                if (update_node_and_cluster(hits[0].second))
+                    continue;
+            }
+
+            // pop from stk_2 until we found a valid node
+            while (true)
+            {
+                if (stk_2.empty())
+                    goto end;
+                curr_local_node_idx = stk_2.top().first;
+                uint32_t cluster_idx = stk_2.top().second;
+                stk_2.pop();
+                if (cluster_data.cluster_idx == cluster_idx)
+                {
+                    cluster_data.num_nodes_in_stk_2--;
+                    break;
+                }
+                if ((!stk_1.empty() && stk_1.top().cluster_idx == cluster_idx))
+                {
+                    set_cluster(cluster_idx, int_bvh_wide.clusters[cluster_idx]);
+                    set_cluster_stack_entry(stk_1.top(), cluster_data);
+                    stk_1.pop();
+                    cluster_data.num_nodes_in_stk_2--;
+                    break;
+                }
+                if (update_cluster_data(cluster_idx))
+                    break;
+            }
+        }
+
+    end:
+        assert(stk_1.empty());
+        if (best_hit.has_value())
+            statistics.finalize++;
+        return best_hit;
+    }
+
+    struct tlas_intersection_t
+    {
+        intersection_t hit;
+        uint32_t instance_idx; // index into int_tlas_t::instances
+    };
+
+    // Two-level traversal: the int TLAS with the world ray, then the BLAS of every instance a leaf
+    // reaches with the ray in object space. Like in the simulator, the object direction is normalized
+    // (get_int_w needs direction components within [-1, 1]) and t is scaled back to world space, the
+    // closest hit so far clips the next instances. traverse(blas, ray, statistics) is the BLAS
+    // traversal, e.g. int_traverse_v2. With any_hit the first instance hit ends the traversal, traverse
+    // should then be an occlusion traversal too.
+    template <typename int_bvh_T, typename traverse_T>
+    std::optional<tlas_intersection_t> int_traverse_tlas(const int_tlas_t &int_tlas, std::vector<int_bvh_T> &blases,
+                                                         ray_t ray, statistics_t &statistics, traverse_T traverse,
+                                                         bool any_hit = false)
+    {
+        constexpr int N = INT_BVH_WIDTH;
+        std::optional<tlas_intersection_t> best_hit;
+        if (int_tlas.num_nodes == 0)
+            return best_hit;
+
+        // preprocess ray
+        std::array<bool, 3> octant = {
+            std::signbit(ray.direction[0]),
+            std::signbit(ray.direction[1]),
+            std::signbit(ray.direction[2])};
+        std::array<float, 3> w = {
+            1.0f / ray.direction[0],
+            1.0f / ray.direction[1],
+            1.0f / ray.direction[2]};
+        std::array<float, 3> b = {
+            -ray.origin[0] * w[0],
+            -ray.origin[1] * w[1],
+            -ray.origin[2] * w[2]};
+        int_w_t int_w = get_int_w(w);
+
+        const int_cluster_t &cluster = int_tlas.cluster;
+        statistics.intersect_bbox++;
+        auto y_ref = intersect_bbox(octant, w, cluster.ref_bounds, b, ray.tmax);
+        if (!y_ref.has_value())
+            return best_hit;
+
+        int_dist_t qb_l[3], qb_h[3];
+        for (int i = 0; i < 3; i++)
+        {
+            qb_l[i] = floor_to_int_dist((static_cast<int_dist_float_t>(b[i]) - y_ref.value() +
+                                         cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[i])) *
+                                        cluster.inv_sx_inv_sw);
+            qb_h[i] = qb_l[i] + 1;
+        }
+
+        auto intersect_instance = [&](uint32_t instance_idx)
+        {
+            const int_instance_t &instance = int_tlas.instances[instance_idx];
+            const auto &m = instance.world_to_object;
+            ray_t object_ray = ray;
+            for (int i = 0; i < 3; i++)
+            {
+                object_ray.origin[i] = m[i][0] * ray.origin[0] + m[i][1] * ray.origin[1] + m[i][2] * ray.origin[2] + m[i][3];
+                object_ray.direction[i] = m[i][0] * ray.direction[0] + m[i][1] * ray.direction[1] + m[i][2] * ray.direction[2];
+            }
+            float t_multiplier = length(object_ray.direction);
+            object_ray.direction = object_ray.direction * (1.0f / t_multiplier);
+            object_ray.tmin = ray.tmin * t_multiplier;
+            object_ray.tmax = ray.tmax * t_multiplier;
+            if (auto hit = traverse(blases[instance.blas_idx], object_ray, statistics))
+            {
+                hit->t /= t_multiplier;
+                best_hit = tlas_intersection_t{hit.value(), instance_idx};
+                ray.tmax = hit->t;
+            }
+        };
+
+        fixed_stack_t<uint16_t, node_stack_capacity> stk;
+        uint16_t curr_local_node_idx = 0;
+        while (true)
+        {
+            statistics.traversal_steps++;
+            const int_node_wide_t<N> &curr_node = int_tlas.nodes[curr_local_node_idx];
+            int_dist_t qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(ray.tmax) - y_ref.value()) *
+                                                 cluster.inv_sx_inv_sw);
+
+            // instances of intersected leaves first, they may shorten the ray for the inner children
+            std::array<std::pair<int_dist_t, uint16_t>, N> hits;
+            int num_hits = 0;
+            for (int i = 0; i < N; i++)
+            {
+                decoded_data_t decoded_data = decode_data(curr_node.children[i].data);
+                if (decoded_data.child_type == child_type_t::EMPTY)
+                    continue;
+                auto distance = intersect_int_bbox(qy_max, int_w, curr_node.children[i].bounds, qb_l, qb_h);
+                if (!distance.has_value())
+                    continue;
+
+                if (decoded_data.child_type == child_type_t::LEAF)
+                {
+                    for (int j = 0; j < decoded_data.num_trigs; j++)
+                    {
+                        intersect_instance(decoded_data.idx + j);
+                        if (any_hit && best_hit.has_value())
+                        {
+                            statistics.finalize++;
+                            return best_hit;
+                        }
+                    }
+                }
+                else
+                {
+                    hits[num_hits++] = std::make_pair(distance.value(), decoded_data.idx);
+                }
+            }
+
+            // closest child next, the others to the stack farthest first
+            std::stable_sort(hits.begin(), hits.begin() + num_hits,
+                             [](const auto &a, const auto &c)
+                             { return a.first < c.first; });
+            for (int i = num_hits - 1; i > 0; i--)
+                stk.push(hits[i].second);
+
+            if (num_hits > 0)
+            {
+                curr_local_node_idx = hits[0].second;
+                continue;
+            }
+            if (stk.empty())
+                break;
+            curr_local_node_idx = stk.top();
+            stk.pop();
+        }
+
+        if (best_hit.has_value())
+            statistics.finalize++;
+        return best_hit;
+    }
+
+    // rays of a ray file (origin, direction and tmax, 7 floats each), empty if it cannot be read
+    inline std::vector<ray_t> load_rays(const std::string &path)
+    {
+        std::vector<ray_t> rays;
+        std::ifstream ray_fs(path, std::ios::binary);
+        for (float r[7]; ray_fs.read((char *)r, 7 * sizeof(float));)
+        {
+            rays.emplace_back(
+                vector_t(r[0], r[1], r[2]),
+                vector_t(r[3], r[4], r[5]),
+                0.f,
+                r[6]);
+        }
+        return rays;
+    }
+
+    // Permutation of rays (order[i] is the index of the i-th ray to trace) by direction octant, then by the
+    // Morton code of the origin within the bounds of all origins. Consecutive rays then tend to visit the
+    // same clusters and nodes, which keeps stk_1 short and packets coherent. Rays with the same key keep
+    // their relative order.
+    inline std::vector<size_t> get_ray_order(const std::vector<ray_t> &rays)
+    {
+        typedef uint64_t morton_t;
+        constexpr size_t morton_bits = 60; // 20 per axis, the octant goes above
+
+        size_t num_rays = rays.size();
+        bbox_t origin_bbox = bbox_t::empty();
+        for (const ray_t &ray : rays)
+            origin_bbox.extend(ray.origin);
+        for (int i = 0; i < 3; i++)
+        {
+            // a flat extent (e.g. camera rays from one point) would make the grid scale infinite
+            if (!(origin_bbox.max[i] > origin_bbox.min[i]))
+                origin_bbox.max[i] = origin_bbox.min[i] + 1.0f;
+        }
+        bvh::MortonEncoder<morton_t, float> encoder(origin_bbox, size_t(1) << (morton_bits / 3));
+
+        auto keys = std::make_unique<morton_t[]>(num_rays);
+        auto keys_copy = std::make_unique<morton_t[]>(num_rays);
+        auto indices = std::make_unique<size_t[]>(num_rays);
+        auto indices_copy = std::make_unique<size_t[]>(num_rays);
+        morton_t *sorted_keys = keys.get();
+        morton_t *unsorted_keys = keys_copy.get();
+        size_t *sorted_indices = indices.get();
+        size_t *unsorted_indices = indices_copy.get();
+
+        bvh::RadixSort<8> radix_sort;
+#pragma omp parallel
+        {
+#pragma omp for
+            for (int64_t i = 0; i < static_cast<int64_t>(num_rays); i++)
+            {
+                const ray_t &ray = rays[i];
+                morton_t octant = std::signbit(ray.direction[0]) | std::signbit(ray.direction[1]) << 1 |
+                                  std::signbit(ray.direction[2]) << 2;
+                keys[i] = octant << morton_bits | encoder.encode(ray.origin);
+                indices[i] = static_cast<size_t>(i);
+            }
+
+            radix_sort.sort_in_parallel(sorted_keys, unsorted_keys, sorted_indices, unsorted_indices, num_rays,
+                                        morton_bits + 3);
+        }
+        return std::vector<size_t>(sorted_indices, sorted_indices + num_rays);
+    }
+
+    // rays in the order of get_ray_order, which is returned in order
+    inline std::vector<ray_t> sort_rays(const std::vector<ray_t> &rays, std::vector<size_t> &order)
+    {
+        order = get_ray_order(rays);
+        std::vector<ray_t> sorted_rays;
+        sorted_rays.reserve(rays.size());
+        for (size_t index : order)
+            sorted_rays.push_back(rays[index]);
+        return sorted_rays;
+    }
+
+    // traces count rays (at most max(packet_size, 1)) through an int_bvh, as one packet of
+    // int_traverse_v2_packet with INT_BVH_PACKET_SIZE for int_bvh_v2_t. Occlusion rays (any_hit) are
+    // traced one by one, packets only find closest hits.
+    inline void int_traverse_rays(int_bvh_t &int_bvh, trig_t *trigs, const ray_t *rays, size_t count,
+                                  std::optional<intersection_t> *hits, statistics_t &statistics, bool any_hit = false)
+    {
+        for (size_t i = 0; i < count; i++)
+            hits[i] = int_traverse(int_bvh, trigs, rays[i], statistics, any_hit);
+    }
+
+    inline void int_traverse_rays(int_bvh_v2_t &int_bvh_v2, trig_t *trigs, const ray_t *rays, size_t count,
+                                  std::optional<intersection_t> *hits, statistics_t &statistics, bool any_hit = false)
+    {
+#if INT_BVH_PACKET_SIZE != 0
+        if (!any_hit)
+        {
+            int_traverse_v2_packet<INT_BVH_PACKET_SIZE>(int_bvh_v2, trigs, rays, count, hits, statistics);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; i++)
+            hits[i] = int_traverse_v2(int_bvh_v2, trigs, rays[i], statistics, any_hit);
+    }
+
+    template <int N>
+    void int_traverse_rays(int_bvh_wide_t<N> &int_bvh_wide, trig_t *trigs, const ray_t *rays, size_t count,
+                           std::optional<intersection_t> *hits, statistics_t &statistics, bool any_hit = false)
+    {
+        for (size_t i = 0; i < count; i++)
+            hits[i] = int_traverse_wide(int_bvh_wide, trigs, rays[i], statistics, any_hit);
+    }
+
 } // namespace bvh_quantize
 
 #endif // TRAVERSE_HPP
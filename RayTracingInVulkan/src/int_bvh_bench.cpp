@@ -0,0 +1,353 @@
+// Stand-alone benchmark of the quantized BVH, no Vulkan device needed: loads an OBJ model, builds the
+// float BVH and the int_bvh with the build options of the renderer, then traces a ray file with the float
+// SingleRayTraverser and the CPU int_bvh traversal on all OpenMP threads, as closest-hit and as occlusion
+// (any hit) rays. The closest-hit rays are traced once more sorted by get_ray_order, and once through
+// the int_bvh refit to deformed triangles and through an int_bvh rebuilt from them.
+//
+// usage: int_bvh_bench MODEL_FILE T_TRV_INT T_SWITCH T_IST [RAY_FILE]
+// Without RAY_FILE, INT_BVH_BENCH_RAYS rays of get_tuning_rays are traced.
+
+#include "Vulkan/RayTracing/build.hpp"
+
+#include <optional>
+#include <tiny_obj_loader.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "bvh/traverse.hpp"
+#include "bvh/single_ray_traverser.hpp"
+#include "bvh/primitive_intersectors.hpp"
+#include "Vulkan/RayTracing/tune.hpp"
+
+// rays traced when no RAY_FILE is given
+#ifndef INT_BVH_BENCH_RAYS
+#define INT_BVH_BENCH_RAYS (1 << 20)
+#endif
+
+using namespace bvh_quantize;
+
+typedef bvh::SingleRayTraverser<bvh_t> traverser_t;
+typedef bvh::ClosestPrimitiveIntersector<bvh_t, trig_t> primitive_intersector_t;
+typedef bvh::AnyPrimitiveIntersector<bvh_t, trig_t> any_primitive_intersector_t;
+
+namespace
+{
+    typedef std::chrono::steady_clock bench_clock_t;
+
+    double get_ms(bench_clock_t::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(bench_clock_t::now() - start).count();
+    }
+
+    // peak resident set size in MiB, 0 where getrusage is missing
+    double get_peak_rss_mb()
+    {
+#ifndef _WIN32
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            return usage.ru_maxrss / 1024.0; // KiB on Linux
+#endif
+        return 0.0;
+    }
+
+    int get_num_threads()
+    {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    // Moves every vertex by a smooth wave of 1% of the scene diagonal, a function of the vertex position so
+    // that shared vertices move together. Deterministic, the triangles keep their order for refit_int_bvh.
+    std::vector<trig_t> deform_trigs(const std::vector<trig_t> &trigs)
+    {
+        bbox_t scene_bbox = bbox_t::empty();
+        for (const trig_t &trig : trigs)
+            scene_bbox.extend(trig.bounding_box());
+        float diagonal = length(scene_bbox.diagonal());
+        float amplitude = 0.01f * diagonal;
+        float frequency = diagonal > 0.0f ? 8.0f * 3.14159265f / diagonal : 0.0f;
+
+        auto deform = [&](const vector_t &p)
+        {
+            return p + vector_t(std::sin(frequency * p[1]), std::sin(frequency * p[2]), std::sin(frequency * p[0])) *
+                           amplitude;
+        };
+        std::vector<trig_t> deformed_trigs;
+        deformed_trigs.reserve(trigs.size());
+        for (const trig_t &trig : trigs)
+            deformed_trigs.emplace_back(deform(trig.p0), deform(trig.p1()), deform(trig.p2()));
+        return deformed_trigs;
+    }
+
+    std::vector<trig_t> load_trigs(const std::string &model_file)
+    {
+        tinyobj::ObjReader obj_reader;
+        if (!obj_reader.ParseFromFile(model_file))
+        {
+            std::cerr << "failed to load model '" << model_file << "': " << obj_reader.Error() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        const std::vector<float> &vertices = obj_reader.GetAttrib().vertices;
+        auto get_vertex = [&](const tinyobj::index_t &index)
+        {
+            return vector_t(vertices[3 * index.vertex_index + 0], vertices[3 * index.vertex_index + 1],
+                            vertices[3 * index.vertex_index + 2]);
+        };
+
+        // faces are triangulated by the reader
+        std::vector<trig_t> trigs;
+        for (const tinyobj::shape_t &shape : obj_reader.GetShapes())
+        {
+            const std::vector<tinyobj::index_t> &indices = shape.mesh.indices;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+                trigs.emplace_back(get_vertex(indices[i]), get_vertex(indices[i + 1]), get_vertex(indices[i + 2]));
+        }
+        return trigs;
+    }
+
+    // host bytes of the float BVH, nodes and the primitive indices of its leaves
+    size_t get_bvh_bytes(const bvh_t &bvh)
+    {
+        size_t num_refs = 0;
+        for (size_t i = 0; i < bvh.node_count; i++)
+        {
+            if (bvh.nodes[i].is_leaf())
+                num_refs += bvh.nodes[i].primitive_count;
+        }
+        return bvh.node_count * sizeof(node_t) + num_refs * sizeof(size_t);
+    }
+
+    // device bytes of an int_bvh, as uploaded by create_int_bvh_buffer
+    template <typename int_bvh_T>
+    size_t get_int_bvh_bytes(const int_bvh_T &int_bvh)
+    {
+        size_t bytes = int_bvh.num_clusters * sizeof(int_cluster_t) +
+                       int_bvh.num_nodes * sizeof(typename int_nodes_t<int_bvh_T>::type) +
+                       int_bvh.num_trigs * (INT_BVH_TRIG_length + sizeof(uint32_t));
+        if (int_bvh.qtrigs)
+            bytes += int_bvh.num_trigs * sizeof(int_qtrig_t);
+        return bytes;
+    }
+
+    void print_rate(const char *name, size_t num_rays, double ms)
+    {
+        printf("(ycpin) Bench %s: %.1f ms, %.2f Mrays/s\n", name, ms, ms > 0.0 ? num_rays / (ms * 1000.0) : 0.0);
+    }
+
+    // traces rays through the float BVH, returns the hit distance of each ray (infinity on a miss)
+    template <typename primitive_intersector_T>
+    std::vector<float> bench_bvh(const char *name, const bvh_t &bvh, const std::vector<trig_t> &trigs,
+                                 const std::vector<ray_t> &rays)
+    {
+        std::vector<float> distances(rays.size());
+        traverser_t traverser(bvh);
+        traverser_t::Statistics statistics;
+
+        auto start = bench_clock_t::now();
+#pragma omp parallel
+        {
+            primitive_intersector_T primitive_intersector(bvh, trigs.data());
+            traverser_t::Statistics local_statistics;
+#pragma omp for schedule(dynamic, 64)
+            for (int64_t i = 0; i < static_cast<int64_t>(rays.size()); i++)
+            {
+                auto hit = traverser.traverse(rays[i], primitive_intersector, local_statistics);
+                distances[i] = hit ? hit->distance() : std::numeric_limits<float>::infinity();
+            }
+#pragma omp critical
+            {
+                statistics.traversal_steps += local_statistics.traversal_steps;
+                statistics.intersections_a += local_statistics.intersections_a;
+            }
+        }
+        print_rate(name, rays.size(), get_ms(start));
+
+        // each step fetches both children, each triangle test its primitive index and triangle
+        double num_rays = static_cast<double>(rays.size());
+        printf("(ycpin) Bench %s per ray: %.2f steps, %.1f node bytes, %.2f triangles, %.1f triangle bytes\n", name,
+               statistics.traversal_steps / num_rays, 2.0 * sizeof(node_t) * statistics.traversal_steps / num_rays,
+               statistics.intersections_a / num_rays,
+               (sizeof(trig_t) + sizeof(size_t)) * statistics.intersections_a / num_rays);
+        return distances;
+    }
+
+    // traces rays through an int_bvh in blocks of int_traverse_rays, returns the hit distance of each ray
+    template <typename int_bvh_T>
+    std::vector<float> bench_int_bvh(const char *name, int_bvh_T &int_bvh, std::vector<trig_t> &trigs,
+                                     const std::vector<ray_t> &rays, bool any_hit)
+    {
+        constexpr size_t block_size = std::max<size_t>(packet_size, 1);
+
+        std::vector<float> distances(rays.size());
+        statistics_t statistics;
+        int64_t num_blocks = static_cast<int64_t>((rays.size() + block_size - 1) / block_size);
+
+        auto start = bench_clock_t::now();
+#pragma omp parallel
+        {
+            statistics_t local_statistics;
+#pragma omp for schedule(dynamic, 64)
+            for (int64_t block = 0; block < num_blocks; block++)
+            {
+                size_t begin = static_cast<size_t>(block) * block_size;
+                size_t count = std::min(block_size, rays.size() - begin);
+                std::optional<intersection_t> hits[block_size];
+                int_traverse_rays(int_bvh, trigs.data(), rays.data() + begin, count, hits, local_statistics, any_hit);
+                for (size_t i = 0; i < count; i++)
+                    distances[begin + i] = hits[i] ? hits[i]->t : std::numeric_limits<float>::infinity();
+            }
+#pragma omp critical
+            statistics += local_statistics;
+        }
+        print_rate(name, rays.size(), get_ms(start));
+
+        // nodes are fetched whole, clusters once per entry, quantized triangles before their triangle
+        double num_rays = static_cast<double>(rays.size());
+        double node_bytes = static_cast<double>(sizeof(typename int_nodes_t<int_bvh_T>::type)) * statistics.traversal_steps +
+                            static_cast<double>(sizeof(int_cluster_t)) * statistics.intersect_bbox;
+        double trig_bytes = static_cast<double>(INT_BVH_TRIG_length) * statistics.bvh_statistics.intersections_a;
+        if (int_bvh.qtrigs)
+            trig_bytes += static_cast<double>(sizeof(int_qtrig_t)) * statistics.qtrig_tests;
+        printf("(ycpin) Bench %s per ray: %.2f steps, %.2f clusters, %.1f node bytes, %.2f triangles, "
+               "%.1f triangle bytes, %.1f fetched bytes in %d-byte lines\n",
+               name, statistics.traversal_steps / num_rays, statistics.intersect_bbox / num_rays, node_bytes / num_rays,
+               statistics.bvh_statistics.intersections_a / num_rays, trig_bytes / num_rays,
+               get_tuning_score(autotune_t::BYTES, statistics, rays.size()), INT_BVH_ALIGNMENT);
+        // the double fetches line placement is there to avoid
+        printf("(ycpin) Bench %s per ray: %.3f node and %.3f triangle fetches straddle %d-byte lines\n", name,
+               statistics.straddling_node_fetches / num_rays, statistics.straddling_trig_fetches / num_rays,
+               INT_BVH_ALIGNMENT);
+        return distances;
+    }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    arg_t arg = parse_arg(argc, argv);
+
+    auto start = bench_clock_t::now();
+    std::vector<trig_t> trigs = load_trigs(arg.model_file);
+    printf("(ycpin) Bench load %zu triangles from %s, %.1f ms\n", trigs.size(), arg.model_file, get_ms(start));
+    if (trigs.empty())
+    {
+        std::cerr << "no triangles in '" << arg.model_file << "'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<ray_t> rays;
+    if (arg.ray_file)
+    {
+        rays = load_rays(arg.ray_file);
+        if (rays.empty())
+        {
+            std::cerr << "no rays in '" << arg.ray_file << "'" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+        rays = get_tuning_rays(trigs, INT_BVH_BENCH_RAYS);
+    printf("(ycpin) Bench %zu rays, %d threads\n", rays.size(), get_num_threads());
+
+    builder_type_t builder_type = get_builder_type();
+    start = bench_clock_t::now();
+    bvh_t bvh = build_bvh(trigs, builder_type);
+    double bvh_ms = get_ms(start);
+
+    double optimize_ms = 0.0;
+    if (optimize_quant_cost)
+    {
+        start = bench_clock_t::now();
+        optimize_bvh(arg.t_trv_int, arg.t_switch, arg.t_ist, bvh, ref_depth_limit);
+        optimize_ms = get_ms(start);
+    }
+
+    start = bench_clock_t::now();
+#if INT_BVH_WIDTH == 2
+    int_bvh_v2_t int_bvh = build_int_bvh_v2(arg.t_trv_int, arg.t_switch, arg.t_ist, trigs, bvh, ref_depth_limit);
+#else
+    int_bvh_wide_t<INT_BVH_WIDTH> int_bvh =
+        build_int_bvh_wide<INT_BVH_WIDTH>(arg.t_trv_int, arg.t_switch, arg.t_ist, trigs, bvh, ref_depth_limit);
+#endif
+    double int_bvh_ms = get_ms(start);
+
+    printf("(ycpin) Bench build %s BVH %.1f ms, optimize %.1f ms, %d-wide INT BVH %.1f ms\n",
+           get_builder_name(builder_type), bvh_ms, optimize_ms, INT_BVH_WIDTH, int_bvh_ms);
+    printf("(ycpin) Bench BVH %zu nodes, %zu bytes; INT BVH %d clusters, %zu nodes, %zu bytes\n", bvh.node_count,
+           get_bvh_bytes(bvh), int_bvh.num_clusters, int_bvh.num_nodes, get_int_bvh_bytes(int_bvh));
+    // leaf bandwidth against leaf ALU: the transform saves the cross products of every triangle test
+    printf("(ycpin) Bench triangles as %s, %zu x %d bytes (vertices %zu bytes, transforms %zu bytes)\n",
+           get_trig_format_name(trig_format), int_bvh.num_trigs, INT_BVH_TRIG_length,
+           int_bvh.num_trigs * sizeof(triangle_t), int_bvh.num_trigs * sizeof(int_trig_xform_t));
+
+    std::vector<float> distances = bench_bvh<primitive_intersector_t>("float BVH", bvh, trigs, rays);
+    std::vector<float> int_distances = bench_int_bvh("INT BVH", int_bvh, trigs, rays, false);
+
+    size_t matching_rays = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        matching_rays += is_same_distance(int_distances[i], distances[i]);
+    printf("(ycpin) Bench %zu of %zu rays hit at the same distance\n", matching_rays, rays.size());
+
+    // the same rays in get_ray_order, their hits scattered back to the input order
+    start = bench_clock_t::now();
+    std::vector<size_t> order;
+    std::vector<ray_t> sorted_rays = sort_rays(rays, order);
+    printf("(ycpin) Bench sort rays by octant and origin Morton code, %.1f ms\n", get_ms(start));
+    std::vector<float> sorted_distances = bench_int_bvh("INT BVH sorted", int_bvh, trigs, sorted_rays, false);
+
+    std::vector<float> scattered_distances(rays.size());
+    for (size_t i = 0; i < rays.size(); i++)
+        scattered_distances[order[i]] = sorted_distances[i];
+    size_t matching_sorted_rays = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        matching_sorted_rays += scattered_distances[i] == int_distances[i];
+    printf("(ycpin) Bench %zu of %zu sorted rays hit where they do unsorted\n", matching_sorted_rays, rays.size());
+
+    // occlusion rays only need to agree with the closest hits on whether there is a hit at all
+    std::vector<float> occluded = bench_bvh<any_primitive_intersector_t>("float BVH occlusion", bvh, trigs, rays);
+    std::vector<float> int_occluded = bench_int_bvh("INT BVH occlusion", int_bvh, trigs, rays, true);
+
+    size_t matching_occlusions = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        bool hit = std::isfinite(int_distances[i]);
+        matching_occlusions += std::isfinite(occluded[i]) == std::isfinite(distances[i]) &&
+                               std::isfinite(int_occluded[i]) == hit;
+    }
+    printf("(ycpin) Bench %zu of %zu occlusion rays agree with their closest hits\n", matching_occlusions, rays.size());
+
+    // refit to deformed triangles against a full rebuild from them, the hits must be the same and the
+    // steps show what the kept clusters and layout cost
+    std::vector<trig_t> deformed_trigs = deform_trigs(trigs);
+    refit_int_bvh(deformed_trigs, int_bvh);
+
+    start = bench_clock_t::now();
+    bvh_t deformed_bvh = build_bvh(deformed_trigs, builder_type);
+    if (optimize_quant_cost)
+        optimize_bvh(arg.t_trv_int, arg.t_switch, arg.t_ist, deformed_bvh, ref_depth_limit);
+#if INT_BVH_WIDTH == 2
+    int_bvh_v2_t rebuilt_int_bvh =
+        build_int_bvh_v2(arg.t_trv_int, arg.t_switch, arg.t_ist, deformed_trigs, deformed_bvh, ref_depth_limit);
+#else
+    int_bvh_wide_t<INT_BVH_WIDTH> rebuilt_int_bvh = build_int_bvh_wide<INT_BVH_WIDTH>(
+        arg.t_trv_int, arg.t_switch, arg.t_ist, deformed_trigs, deformed_bvh, ref_depth_limit);
+#endif
+    printf("(ycpin) Bench rebuild INT BVH from deformed triangles, %.1f ms\n", get_ms(start));
+
+    std::vector<float> refit_distances = bench_int_bvh("INT BVH refit", int_bvh, deformed_trigs, rays, false);
+    std::vector<float> rebuilt_distances =
+        bench_int_bvh("INT BVH rebuilt", rebuilt_int_bvh, deformed_trigs, rays, false);
+
+    size_t matching_refit_rays = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        matching_refit_rays += is_same_distance(refit_distances[i], rebuilt_distances[i]);
+    printf("(ycpin) Bench %zu of %zu rays hit the refit INT BVH where they hit the rebuilt one\n", matching_refit_rays,
+           rays.size());
+    printf("(ycpin) Bench peak RSS %.1f MiB\n", get_peak_rss_mb());
+    return 0;
+}
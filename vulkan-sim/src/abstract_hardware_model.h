@@ -214,6 +214,9 @@ enum class TransactionType
   INT_BVH_TRIG,
   INT_BVH_NODE,
   INT_BVH_PRIMITIVE_INSTANCE,
+  INT_BVH_QTRIG,
+  INT_BVH_TLAS_NODE,
+  INT_BVH_INSTANCE,
 
   UNDEFINED,
 };
@@ -3,12 +3,41 @@
 
 #include <iostream>
 #include <memory>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <cmath>
 
 #define INT_BVH_ALIGNMENT 64
-#define INT_BVH_CLUSTER_length 36
+#define INT_BVH_CLUSTER_length 40
+// layout of the int_bvh_trigs entries (0 = vertices, 1 = precomputed transform), must match the
+// RayTracingInVulkan build
+#ifndef INT_BVH_TRIG_FORMAT
+#define INT_BVH_TRIG_FORMAT 0
+#endif
+#if INT_BVH_TRIG_FORMAT == 1
+#define INT_BVH_TRIG_length 48
+#else
 #define INT_BVH_TRIG_length 36
-#define INT_BVH_NODE_length 16
+#endif
+// number of children per quantized node, must match the RayTracingInVulkan build
+#ifndef INT_BVH_WIDTH
+#define INT_BVH_WIDTH 2
+#endif
+// bits per quantized child bound, must match the RayTracingInVulkan build
+#ifndef INT_BVH_QUANT_BITS
+#define INT_BVH_QUANT_BITS 8
+#endif
+#define INT_BVH_BOUNDS_length ((6 * INT_BVH_QUANT_BITS + 7) / 8)
+#define INT_BVH_NODE_length ((INT_BVH_BOUNDS_length + 2) * INT_BVH_WIDTH)
 #define INT_BVH_PRIMITIVE_INSTANCE_length 4
+// bits per quantized triangle coordinate (0 = off), must match the RayTracingInVulkan build
+#ifndef INT_BVH_TRIG_QUANT_BITS
+#define INT_BVH_TRIG_QUANT_BITS 0
+#endif
+#define INT_BVH_QTRIG_length ((9 * INT_BVH_TRIG_QUANT_BITS + 7) / 8)
+#define INT_BVH_BLAS_length 64
+#define INT_BVH_INSTANCE_length 112
 
 namespace bvh_quantize
 {
@@ -23,7 +52,7 @@ namespace bvh_quantize
     //   *: num_trigs
     //   -: trig_idx
     // for SWITCH:
-    //   -: child_cluster_idx
+    //   -: child_cluster_idx - int_cluster_t::child_cluster_offset of the current cluster
 
     // Constants
     constexpr int field_b_bits = 3;
@@ -34,15 +63,38 @@ namespace bvh_quantize
     constexpr int max_trig_in_cluster_size = max_node_in_cluster_size;
     constexpr int max_cluster_size = (1 << 15);
 
-    constexpr auto inv_sw = static_cast<float>(1 << 7);
-    constexpr int qx_max = (1 << 8) - 1;
+    // child bounds use quant_bits bits, the ray's inverse direction quant_bits - 1 mantissa bits
+    constexpr int quant_bits = INT_BVH_QUANT_BITS;
+    static_assert(4 <= quant_bits && quant_bits <= 12, "unsupported quantization bit width");
+    constexpr auto inv_sw = static_cast<float>(1 << (quant_bits - 1));
+    constexpr int qx_max = (1 << quant_bits) - 1;
+    // INTERNAL children never point to local node 0 (only SWITCH does), so this value is free
+    constexpr uint16_t empty_child_data = 0x8000;
+    // triangle vertices use trig_quant_bits per coordinate relative to the cluster's ref_bounds
+    constexpr int trig_quant_bits = INT_BVH_TRIG_QUANT_BITS;
+    static_assert(trig_quant_bits == 0 || (8 <= trig_quant_bits && trig_quant_bits <= 16),
+                  "unsupported triangle quantization bit width");
+    constexpr uint32_t qv_max = trig_quant_bits != 0 ? (1u << trig_quant_bits) - 1 : 1;
+    // VERTICES stores int_trig_t, XFORM int_trig_xform_t in the int_bvh_trigs buffer
+    enum class trig_format_t : uint8_t
+    {
+        VERTICES,
+        XFORM
+    };
+    static_assert(0 <= INT_BVH_TRIG_FORMAT && INT_BVH_TRIG_FORMAT <= 1, "unsupported triangle format");
+    constexpr trig_format_t trig_format = static_cast<trig_format_t>(INT_BVH_TRIG_FORMAT);
 
     // Type Definitions
+    // quantized ray distances (qb, qy_max) need a wider datapath for bounds wider than 8 bits
+    typedef std::conditional<(quant_bits <= 8), int32_t, int64_t>::type int_dist_t;
+    typedef std::conditional<(quant_bits <= 8), float, double>::type int_dist_float_t;
+
     enum class child_type_t
     {
         INTERNAL,
         LEAF,
-        SWITCH
+        SWITCH,
+        EMPTY
     };
 
     struct int_trig_t
@@ -50,20 +102,88 @@ namespace bvh_quantize
         float v[3][3];
     };
 
-    struct int_node_t
+    // row-major 3x4 affine map onto the triangle's frame, rows 0 and 1 give the barycentric u (weight of
+    // p1) and v (weight of p2), row 2 the offset along the normal, see the RayTracingInVulkan copy
+    struct int_trig_xform_t
+    {
+        float m[3][4];
+    };
+    static_assert((trig_format == trig_format_t::XFORM ? sizeof(int_trig_xform_t) : sizeof(int_trig_t)) == INT_BVH_TRIG_length,
+                  "INT_BVH_TRIG_length mismatch");
+
+    // bounds hold [qxmin, qxmax, qymin, qymax, qzmin, qzmax] packed back to back
+    // (quant_bits each, LSB first), see get_qx
+#pragma pack(push, 1)
+    struct int_child_t
+    {
+        uint8_t bounds[INT_BVH_BOUNDS_length];
+        uint16_t data;
+    };
+
+    // nine vertex coordinates packed like int_child_t::bounds, v = ref_bounds lo + q * qtrig_frame_t::scale.
+    // The int_trig_t with the same index is only fetched when may_hit_qtrig cannot rule out a hit.
+    struct int_qtrig_t
+    {
+        uint8_t v[trig_quant_bits != 0 ? INT_BVH_QTRIG_length : 1];
+    };
+#pragma pack(pop)
+
+    // N-wide node collapsed from the binary tree. Unused slots have data == empty_child_data.
+    // int_node_wide_t<2> is the original {left_bounds, left_child_data, right_bounds, right_child_data} layout.
+    template <int N>
+    struct int_node_wide_t
     {
-        uint8_t left_bounds[6];
-        uint16_t left_child_data;
-        uint8_t right_bounds[6];
-        uint16_t right_child_data;
+        static_assert(2 <= N && N <= 8, "unsupported int_bvh width");
+        int_child_t children[N];
     };
 
+    typedef int_node_wide_t<INT_BVH_WIDTH> int_node_t;
+    static_assert(sizeof(int_node_t) == INT_BVH_NODE_length, "INT_BVH_NODE_length mismatch");
+
     struct int_cluster_t
     {
         float ref_bounds[6];
         float inv_sx_inv_sw;
         uint32_t node_offset;
         uint32_t trig_offset;
+        uint32_t child_cluster_offset;
+    };
+    static_assert(sizeof(int_cluster_t) == INT_BVH_CLUSTER_length, "INT_BVH_CLUSTER_length mismatch");
+
+    // entry of the BLAS table, device addresses of one BLAS's int_bvh arrays
+    struct int_blas_t
+    {
+        uint64_t clusters_addr;
+        uint64_t trigs_addr;
+        uint64_t nodes_addr;
+        uint64_t primitive_indices_addr;
+        uint64_t qtrigs_addr;
+        uint32_t num_clusters;
+        uint32_t num_nodes;
+        uint32_t num_trigs;
+        uint32_t reserved[3];
+    };
+    static_assert(sizeof(int_blas_t) == INT_BVH_BLAS_length, "INT_BVH_BLAS_length mismatch");
+
+    // BLAS instance referenced by the LEAF children of the int TLAS, see the RayTracingInVulkan copy.
+    // Both transforms are row-major 3x4, custom_index_mask is custom index (24 bits) | cull mask << 24.
+    struct int_instance_t
+    {
+        float object_to_world[3][4];
+        float world_to_object[3][4];
+        uint32_t blas_idx;
+        uint32_t instance_idx;
+        uint32_t custom_index_mask;
+        uint32_t sbt_offset;
+    };
+    static_assert(sizeof(int_instance_t) == INT_BVH_INSTANCE_length, "INT_BVH_INSTANCE_length mismatch");
+
+    // dequantization of a cluster's int_qtrig_t, r bounds the distance to the original vertices
+    struct qtrig_frame_t
+    {
+        float lo[3];
+        float scale[3];
+        float r;
     };
 
     struct int_bvh_t
@@ -73,6 +193,30 @@ namespace bvh_quantize
         std::unique_ptr<int_trig_t[]> trigs;
         std::unique_ptr<int_node_t[]> nodes;
         std::unique_ptr<size_t[]> primitive_indices;
+        // nullptr unless trig_quant_bits != 0
+        std::unique_ptr<int_qtrig_t[]> qtrigs;
+        // the int_bvh_trigs buffer when trig_format == XFORM, trigs is nullptr then
+        std::unique_ptr<int_trig_xform_t[]> xforms;
+    };
+
+    // one BLAS of the registry, addrs are used for the memory transactions
+    struct int_blas_entry_t
+    {
+        int_blas_t addrs;
+        int_bvh_t int_bvh;
+    };
+
+    // single-cluster int TLAS: LEAF children index instances, INTERNAL children index nodes
+    struct int_tlas_t
+    {
+        int_cluster_t cluster;
+        size_t num_nodes = 0;
+        std::unique_ptr<int_node_t[]> nodes;
+        size_t num_instances = 0;
+        std::unique_ptr<int_instance_t[]> instances;
+        void *cluster_addr = nullptr;
+        void *nodes_addr = nullptr;
+        void *instances_addr = nullptr;
     };
 
     struct decoded_data_t
@@ -82,6 +226,124 @@ namespace bvh_quantize
         uint16_t idx;
     };
 
+    inline uint32_t get_packed(const uint8_t *bytes, int i, int bits)
+    {
+        uint32_t first_bit = i * bits;
+        uint32_t word = 0;
+        for (uint32_t byte = first_bit / 8; byte * 8 < first_bit + bits; byte++)
+            word |= static_cast<uint32_t>(bytes[byte]) << (8 * (byte - first_bit / 8));
+        return (word >> (first_bit % 8)) & ((1u << bits) - 1);
+    }
+
+    inline uint32_t get_qx(const uint8_t *bounds, int i)
+    {
+        if (quant_bits == 8)
+            return bounds[i];
+        return get_packed(bounds, i, quant_bits);
+    }
+
+    inline qtrig_frame_t get_qtrig_frame(const int_cluster_t &cluster)
+    {
+        qtrig_frame_t frame;
+        float r2 = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            float lo = cluster.ref_bounds[2 * i];
+            float hi = cluster.ref_bounds[2 * i + 1];
+            frame.lo[i] = lo;
+            frame.scale[i] = (hi - lo) / qv_max;
+            float err = 0.5f * frame.scale[i] + 1e-6f * (std::abs(lo) + std::abs(hi));
+            r2 += err * err;
+        }
+        frame.r = 1.001f * std::sqrt(r2);
+        return frame;
+    }
+
+    inline void get_qtrig_vertices(const int_qtrig_t &qtrig, const qtrig_frame_t &frame, float p[3][3])
+    {
+        for (int k = 0; k < 3; k++)
+            for (int i = 0; i < 3; i++)
+                p[k][i] = frame.lo[i] + static_cast<float>(get_packed(qtrig.v, 3 * k + i, trig_quant_bits)) * frame.scale[i];
+    }
+
+    // every coordinate at qv_max marks a triangle that sticks out of its cluster's reference node
+    // (a clipped spatial-split reference), may_hit_qtrig then always defers to the full-precision test
+    inline bool is_unbounded_qtrig(const int_qtrig_t &qtrig)
+    {
+        for (int i = 0; i < 9; i++)
+            if (get_packed(qtrig.v, i, trig_quant_bits) != qv_max)
+                return false;
+        return true;
+    }
+
+    // false only if the ray cannot hit the original triangle within [tmin, tmax], see the
+    // RayTracingInVulkan copy for the bounds
+    inline bool may_hit_qtrig(const int_qtrig_t &qtrig, const qtrig_frame_t &frame,
+                              const float o[3], const float d[3], float tmin, float tmax)
+    {
+        if (is_unbounded_qtrig(qtrig))
+            return true;
+
+        float p[3][3];
+        get_qtrig_vertices(qtrig, frame, p);
+
+        float a[3][3], len[3], s[3];
+        for (int k = 0; k < 3; k++)
+        {
+            for (int i = 0; i < 3; i++)
+                a[k][i] = p[k][i] - o[i];
+            len[k] = std::sqrt(a[k][0] * a[k][0] + a[k][1] * a[k][1] + a[k][2] * a[k][2]);
+            s[k] = d[0] * a[k][0] + d[1] * a[k][1] + d[2] * a[k][2];
+        }
+        float d_len2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        float d_len = std::sqrt(d_len2);
+
+        float t_slack = frame.r * d_len + 1e-5f * d_len * (len[0] + len[1] + len[2]);
+        float t_lo = (std::min({s[0], s[1], s[2]}) - t_slack) / d_len2;
+        float t_hi = (std::max({s[0], s[1], s[2]}) + t_slack) / d_len2;
+        if (t_hi < tmin || t_lo > tmax)
+            return false;
+
+        float sum = len[0] + len[1] + len[2];
+        bool may_be_positive = true;
+        bool may_be_negative = true;
+        for (int k = 0; k < 3; k++)
+        {
+            const float *a1 = a[(k + 1) % 3];
+            const float *a2 = a[(k + 2) % 3];
+            float e = d[0] * (a1[1] * a2[2] - a1[2] * a2[1]) +
+                      d[1] * (a1[2] * a2[0] - a1[0] * a2[2]) +
+                      d[2] * (a1[0] * a2[1] - a1[1] * a2[0]);
+            float bound = d_len * frame.r * (len[(k + 1) % 3] + len[(k + 2) % 3] + frame.r) + 1e-5f * d_len * sum * sum;
+            may_be_positive &= e >= -bound;
+            may_be_negative &= e <= bound;
+        }
+        return may_be_positive || may_be_negative;
+    }
+
+    // Baldwin-Weber test against an int_trig_xform_t, u and v are only computed for hits within [tmin, tmax]
+    inline bool intersect_trig_xform(const int_trig_xform_t &xform, const float o[3], const float d[3], float tmin,
+                                     float tmax, float &t, float &u, float &v)
+    {
+        const float *n = xform.m[2];
+        float dz = n[0] * d[0] + n[1] * d[1] + n[2] * d[2];
+        // parallel rays and degenerate triangles never hit
+        if (dz == 0.0f)
+            return false;
+        t = -(n[0] * o[0] + n[1] * o[1] + n[2] * o[2] + n[3]) / dz;
+        if (!(t >= tmin && t <= tmax))
+            return false;
+
+        float p[3];
+        for (int i = 0; i < 3; i++)
+            p[i] = o[i] + t * d[i];
+        const float *a = xform.m[0];
+        const float *b = xform.m[1];
+        u = a[0] * p[0] + a[1] * p[1] + a[2] * p[2] + a[3];
+        v = b[0] * p[0] + b[1] * p[1] + b[2] * p[2] + b[3];
+        return u >= 0.0f && v >= 0.0f && u + v <= 1.0f;
+    }
+
 } // namespace bvh_quantize
 
 #endif // INT_BVH_HPP
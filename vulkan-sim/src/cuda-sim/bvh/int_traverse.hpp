@@ -2,37 +2,147 @@
 #define INT_TRAVERSE_HPP
 
 #include <array>
+#include <cassert>
 #include <cstdint>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
 #include <algorithm>
 
 namespace bvh_quantize
 {
     struct cluster_data_t
     {
-        uint16_t cluster_idx;
+        uint32_t cluster_idx;
         int_node_t *local_nodes;
         int_trig_t *local_trigs;
 
         uint32_t node_offset;
         uint32_t trig_offset;
+        uint32_t child_cluster_offset;
 
         float inv_sx_inv_sw;
         float y_ref;
-        int32_t qb_l[3];
-        int32_t qb_h[3];
+        int_dist_t qb_l[3];
+        int_dist_t qb_h[3];
         uint8_t tmax_version;
-        int32_t qy_max;
+        int_dist_t qy_max;
         uint8_t num_nodes_in_stk_2;
+        qtrig_frame_t qtrig_frame;
     };
 
+    // What stk_1 keeps of a cluster left with nodes still on stk_2: the per-ray state only (qb_h is
+    // always qb_l + 1), the cluster's constants are read again from its int_cluster_t when it is popped.
+    struct cluster_stack_entry_t
+    {
+        uint32_t cluster_idx;
+        float y_ref;
+        int_dist_t qb_l[3];
+        int_dist_t qy_max;
+        uint8_t tmax_version;
+        uint8_t num_nodes_in_stk_2;
+    };
+
+    template <typename cluster_data_T>
+    cluster_stack_entry_t get_cluster_stack_entry(const cluster_data_T &cluster_data)
+    {
+        cluster_stack_entry_t entry;
+        entry.cluster_idx = cluster_data.cluster_idx;
+        entry.y_ref = cluster_data.y_ref;
+        for (int i = 0; i < 3; i++)
+            entry.qb_l[i] = cluster_data.qb_l[i];
+        entry.qy_max = cluster_data.qy_max;
+        entry.tmax_version = cluster_data.tmax_version;
+        entry.num_nodes_in_stk_2 = cluster_data.num_nodes_in_stk_2;
+        return entry;
+    }
+
+    // restores the per-ray state of entry, the cluster's constants must already be set
+    template <typename cluster_data_T>
+    void set_cluster_stack_entry(const cluster_stack_entry_t &entry, cluster_data_T &cluster_data)
+    {
+        assert(cluster_data.cluster_idx == entry.cluster_idx);
+        cluster_data.y_ref = entry.y_ref;
+        for (int i = 0; i < 3; i++)
+        {
+            cluster_data.qb_l[i] = entry.qb_l[i];
+            cluster_data.qb_h[i] = entry.qb_l[i] + 1;
+        }
+        cluster_data.qy_max = entry.qy_max;
+        cluster_data.tmax_version = entry.tmax_version;
+        cluster_data.num_nodes_in_stk_2 = entry.num_nodes_in_stk_2;
+    }
+
+    // LIFO for the traversal stacks whose first Capacity entries live inline, so tracing a ray allocates
+    // nothing and entries are only constructed when pushed. Overflow policy: pushes beyond Capacity spill
+    // to a heap buffer, traversals of degenerate trees stay exact and only they pay for the allocation.
+    template <typename T, size_t Capacity>
+    class fixed_stack_t
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "fixed_stack_t never destroys its entries");
+
+    public:
+        fixed_stack_t() {}
+
+        bool empty() const { return size == 0; }
+
+        T &top()
+        {
+            assert(size != 0);
+            return size <= Capacity ? items[size - 1] : spilled.back();
+        }
+
+        void push(const T &item)
+        {
+            if (size < Capacity)
+                new (&items[size]) T(item);
+            else
+                spilled.push_back(item);
+            size++;
+        }
+
+        template <typename... Args>
+        void emplace(Args &&...args) { push(T(std::forward<Args>(args)...)); }
+
+        void pop()
+        {
+            assert(size != 0);
+            if (size > Capacity)
+                spilled.pop_back();
+            size--;
+        }
+
+        void clear()
+        {
+            size = 0;
+            spilled.clear();
+        }
+
+    private:
+        union
+        {
+            T items[Capacity];
+        };
+        size_t size = 0;
+        std::vector<T> spilled;
+    };
+
+    // inline entries of stk_2 ([local_node_idx, cluster_idx], up to width - 1 per level) and of stk_1 (one
+    // per cluster on the path with nodes left on stk_2), see fixed_stack_t for deeper traversals
+    constexpr size_t node_stack_capacity = 128;
+    constexpr size_t cluster_stack_capacity = 16;
+
+    typedef fixed_stack_t<std::pair<uint16_t, uint32_t>, node_stack_capacity> node_stack_t;
+    typedef fixed_stack_t<cluster_stack_entry_t, cluster_stack_capacity> cluster_stack_t;
+
     struct int_w_t
     {
         bool iw[3];
         uint8_t rw_l[3];
-        uint8_t qw_l[3];
+        uint16_t qw_l[3];
         uint8_t rw_h[3];
-        uint8_t qw_h[3];
+        uint16_t qw_h[3];
     };
 
 }
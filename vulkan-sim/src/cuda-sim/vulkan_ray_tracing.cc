@@ -35,6 +35,7 @@
 #include <string>
 #include <fstream>
 #include <cmath>
+#include <limits>
 #define BOOST_FILESYSTEM_VERSION 3
 #define BOOST_FILESYSTEM_NO_DEPRECATED 
 #include <boost/filesystem.hpp>
@@ -115,13 +116,8 @@ std::map<void*, void*> VulkanRayTracing::blas_addr_map;
 
 void *VulkanRayTracing::tlas_addr;
 
-void *VulkanRayTracing::int_bvh_addr;
-void *VulkanRayTracing::int_bvh_clusters_addr;
-void *VulkanRayTracing::int_bvh_trigs_addr;
-void *VulkanRayTracing::int_bvh_nodes_addr;
-void *VulkanRayTracing::int_bvh_primitive_indices_addr;
-
-int_bvh_t VulkanRayTracing::int_bvh;
+std::vector<int_blas_entry_t> VulkanRayTracing::int_blases;
+int_tlas_t VulkanRayTracing::int_tlas;
 
 bool VulkanRayTracing::dumped = false;
 
@@ -444,6 +440,32 @@ int32_t VulkanRayTracing::ceil_to_int32(float x)
     return (int)ceilf(x);
 }
 
+int_dist_t VulkanRayTracing::floor_to_int_dist(int_dist_float_t x)
+{
+    if (quant_bits <= 8)
+        return floor_to_int32(x);
+
+    assert(!std::isnan(x));
+    if (x < static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::min()))
+        return std::numeric_limits<int_dist_t>::min();
+    if (x >= static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::max()))
+        return std::numeric_limits<int_dist_t>::max();
+    return static_cast<int_dist_t>(std::floor(x));
+}
+
+int_dist_t VulkanRayTracing::ceil_to_int_dist(int_dist_float_t x)
+{
+    if (quant_bits <= 8)
+        return ceil_to_int32(x);
+
+    assert(!std::isnan(x));
+    if (x < static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::min()))
+        return std::numeric_limits<int_dist_t>::min();
+    if (x >= static_cast<int_dist_float_t>(std::numeric_limits<int_dist_t>::max()))
+        return std::numeric_limits<int_dist_t>::max();
+    return static_cast<int_dist_t>(std::ceil(x));
+}
+
 int_w_t VulkanRayTracing::get_int_w(const std::array<float, 3> &w)
 {
     int_w_t int_w{};
@@ -456,17 +478,19 @@ int_w_t VulkanRayTracing::get_int_w(const std::array<float, 3> &w)
         uint32_t exponent = (wi >> 23) & 0xff;
         uint32_t mantissa = wi & 0x7fffff;
 
+        // keep quant_bits - 1 mantissa bits, matching inv_sw = 2^(quant_bits - 1)
+        constexpr uint32_t qw_bits = quant_bits - 1;
         uint32_t near_exponent = (exponent - 127) & 0b11111;
-        uint32_t near_mantissa = mantissa >> 16;
-        uint32_t near = (near_exponent << 7) | near_mantissa;
+        uint32_t near_mantissa = mantissa >> (23 - qw_bits);
+        uint32_t near = (near_exponent << qw_bits) | near_mantissa;
 
         uint32_t far = near + 1;
-        uint32_t far_exponent = far >> 7;
-        uint32_t far_mantissa = far & 0b1111111;
+        uint32_t far_exponent = far >> qw_bits;
+        uint32_t far_mantissa = far & ((1u << qw_bits) - 1);
 
         int_w.iw[i] = sign;
-        near_mantissa |= 0b10000000;
-        far_mantissa |= 0b10000000;
+        near_mantissa |= 1u << qw_bits;
+        far_mantissa |= 1u << qw_bits;
 
         if (sign)
         {
@@ -490,7 +514,11 @@ int_w_t VulkanRayTracing::get_int_w(const std::array<float, 3> &w)
 decoded_data_t VulkanRayTracing::decode_data(uint16_t data)
 {
     decoded_data_t decoded_data{};
-    if (data & 0x8000)
+    if (data == empty_child_data)
+    {
+        decoded_data.child_type = child_type_t::EMPTY;
+    }
+    else if (data & 0x8000)
     {
         int field_b = ((data & 0x7fff) >> field_c_bits);
         int field_c = (data & ((1 << field_c_bits) - 1));
@@ -536,49 +564,51 @@ std::pair<bool, float> VulkanRayTracing::intersect_bbox(const std::array<bool, 3
         return std::make_pair(false, 0);
 }
 
-std::pair<bool, int32_t> VulkanRayTracing::intersect_int_bbox(int32_t qy_max,
-                                                              const int_w_t &int_w,
-                                                              const uint8_t *qx,
-                                                              const int32_t *qb_l,
-                                                              const int32_t *qb_h)
+std::pair<bool, int_dist_t> VulkanRayTracing::intersect_int_bbox(int_dist_t qy_max,
+                                                                 const int_w_t &int_w,
+                                                                 const uint8_t *qx,
+                                                                 const int_dist_t *qb_l,
+                                                                 const int_dist_t *qb_h)
 {
+    // qx is packed, see get_qx
     const int32_t qx_a[3] = {
-        int_w.iw[0] ? qx[1] : qx[0],
-        int_w.iw[1] ? qx[3] : qx[2],
-        int_w.iw[2] ? qx[5] : qx[4]};
+        static_cast<int32_t>(get_qx(qx, int_w.iw[0] ? 1 : 0)),
+        static_cast<int32_t>(get_qx(qx, int_w.iw[1] ? 3 : 2)),
+        static_cast<int32_t>(get_qx(qx, int_w.iw[2] ? 5 : 4))};
 
     const int32_t qx_b[3] = {
-        int_w.iw[0] ? qx[0] : qx[1],
-        int_w.iw[1] ? qx[2] : qx[3],
-        int_w.iw[2] ? qx[4] : qx[5]};
+        static_cast<int32_t>(get_qx(qx, int_w.iw[0] ? 0 : 1)),
+        static_cast<int32_t>(get_qx(qx, int_w.iw[1] ? 2 : 3)),
+        static_cast<int32_t>(get_qx(qx, int_w.iw[2] ? 4 : 5))};
 
-    int32_t entry[3], exit[3];
+    // products reach 2 * quant_bits + 31 bits, so accumulate in 64 bits
+    int64_t entry[3], exit[3];
 
-    entry[0] = (int_w.qw_l[0] * qx_a[0]) << int_w.rw_l[0];
+    entry[0] = (static_cast<int64_t>(int_w.qw_l[0]) * qx_a[0]) << int_w.rw_l[0];
     entry[0] = (int_w.iw[0] ? -entry[0] : entry[0]) + qb_l[0];
 
-    entry[1] = (int_w.qw_l[1] * qx_a[1]) << int_w.rw_l[1];
+    entry[1] = (static_cast<int64_t>(int_w.qw_l[1]) * qx_a[1]) << int_w.rw_l[1];
     entry[1] = (int_w.iw[1] ? -entry[1] : entry[1]) + qb_l[1];
 
-    entry[2] = (int_w.qw_l[2] * qx_a[2]) << int_w.rw_l[2];
+    entry[2] = (static_cast<int64_t>(int_w.qw_l[2]) * qx_a[2]) << int_w.rw_l[2];
     entry[2] = (int_w.iw[2] ? -entry[2] : entry[2]) + qb_l[2];
 
-    exit[0] = (int_w.qw_h[0] * qx_b[0]) << int_w.rw_h[0];
+    exit[0] = (static_cast<int64_t>(int_w.qw_h[0]) * qx_b[0]) << int_w.rw_h[0];
     exit[0] = (int_w.iw[0] ? -exit[0] : exit[0]) + qb_h[0];
 
-    exit[1] = (int_w.qw_h[1] * qx_b[1]) << int_w.rw_h[1];
+    exit[1] = (static_cast<int64_t>(int_w.qw_h[1]) * qx_b[1]) << int_w.rw_h[1];
     exit[1] = (int_w.iw[1] ? -exit[1] : exit[1]) + qb_h[1];
 
-    exit[2] = (int_w.qw_h[2] * qx_b[2]) << int_w.rw_h[2];
+    exit[2] = (static_cast<int64_t>(int_w.qw_h[2]) * qx_b[2]) << int_w.rw_h[2];
     exit[2] = (int_w.iw[2] ? -exit[2] : exit[2]) + qb_h[2];
 
-    int32_t entry_ = std::max({entry[0], entry[1], entry[2], 0});
-    int32_t exit_ = std::min({exit[0], exit[1], exit[2], qy_max});
+    int64_t entry_ = std::max({entry[0], entry[1], entry[2], int64_t{0}});
+    int64_t exit_ = std::min({exit[0], exit[1], exit[2], static_cast<int64_t>(qy_max)});
 
     if (entry_ <= exit_)
-        return std::make_pair(true, entry_);
+        return std::make_pair(true, static_cast<int_dist_t>(entry_)); // 0 <= entry_ <= qy_max
     else
-        return std::make_pair(false, 0);
+        return std::make_pair(false, int_dist_t{0});
 }
 
 std::pair<bool, float> VulkanRayTracing::intersect_trig(int_trig_t *trigs, const Ray &ray)
@@ -720,25 +750,37 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
          {0.0000f, 0.0000f, 1.0000f, 0.0000f},
          {0.0000f, 0.0000f, 0.0000f, 1.0000f}}};
 
-    float worldToObject_tMultiplier;
-    Ray objectRay = make_transformed_ray(ray, worldToObjectMatrix, &worldToObject_tMultiplier);
+    // the object ray and its preprocessed form are set per instance, see set_instance
+    float worldToObject_tMultiplier = 1.0f;
+    Ray objectRay = ray;
     float original_tmax = objectRay.get_tmax();
+    std::array<bool, 3> octant;
+    std::array<float, 3> w;
+    std::array<float, 3> b;
+    int_w_t int_w;
+    uint8_t global_tmax_version = 0;
 
     // Preprocess ray
-    std::array<bool, 3> octant = {
-        std::signbit(objectRay.get_direction().x),
-        std::signbit(objectRay.get_direction().y),
-        std::signbit(objectRay.get_direction().z)};
-    std::array<float, 3> w = {
-        1.0f / objectRay.get_direction().x,
-        1.0f / objectRay.get_direction().y,
-        1.0f / objectRay.get_direction().z};
-    std::array<float, 3> b = {
-        -objectRay.get_origin().x * w[0],
-        -objectRay.get_origin().y * w[1],
-        -objectRay.get_origin().z * w[2]};
-    int_w_t int_w = get_int_w(w);
-    uint8_t global_tmax_version = 0;
+    auto preprocess_ray = [&](const Ray &r)
+    {
+        octant = {
+            std::signbit(r.get_direction().x),
+            std::signbit(r.get_direction().y),
+            std::signbit(r.get_direction().z)};
+        w = {
+            1.0f / r.get_direction().x,
+            1.0f / r.get_direction().y,
+            1.0f / r.get_direction().z};
+        b = {
+            -r.get_origin().x * w[0],
+            -r.get_origin().y * w[1],
+            -r.get_origin().z * w[2]};
+        int_w = get_int_w(w);
+    };
+
+    // BLAS and instance being traversed, the identity instance of BLAS 0 without a TLAS
+    int_blas_entry_t *curr_blas = nullptr;
+    int_instance_t curr_instance = {};
 
     // Set thit to max
     float min_thit = ray.dir_tmax.w;
@@ -747,6 +789,9 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     float4x4 closest_worldToObject, closest_objectToWorld;
     Ray closest_objectRay;
     float min_thit_object;
+    // barycentrics of the closest hit on a transformed triangle, which has no vertices for Barycentric
+    float3 closest_barycentric;
+    uint32_t closest_sbt_offset = 0;
 
     auto memory_dump = [&](uint64_t index, TransactionType type)
     {
@@ -772,6 +817,21 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             outfile << "IDX " << index << std::endl;
         }
 
+        if (type == TransactionType::INT_BVH_QTRIG)
+        {
+            outfile << "QTRIG " << index << std::endl;
+        }
+
+        if (type == TransactionType::INT_BVH_TLAS_NODE)
+        {
+            outfile << "TNODE " << index << std::endl;
+        }
+
+        if (type == TransactionType::INT_BVH_INSTANCE)
+        {
+            outfile << "INST " << index << std::endl;
+        }
+
         outfile.close();
     };
 
@@ -784,33 +844,52 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
 
         if (type == TransactionType::INT_BVH_CLUSTER)
         {
-            base_addr = int_bvh_clusters_addr;
+            base_addr = curr_blas->addrs.clusters_addr;
             length = INT_BVH_CLUSTER_length;
         }
 
         if (type == TransactionType::INT_BVH_TRIG)
         {
-            base_addr = int_bvh_trigs_addr;
+            base_addr = curr_blas->addrs.trigs_addr;
             length = INT_BVH_TRIG_length;
         }
 
         if (type == TransactionType::INT_BVH_NODE)
         {
-            base_addr = int_bvh_nodes_addr;
+            base_addr = curr_blas->addrs.nodes_addr;
             length = INT_BVH_NODE_length;
         }
 
         if (type == TransactionType::INT_BVH_PRIMITIVE_INSTANCE)
         {
-            base_addr = int_bvh_primitive_indices_addr;
+            base_addr = curr_blas->addrs.primitive_indices_addr;
             length = INT_BVH_PRIMITIVE_INSTANCE_length;
         }
 
+        if (type == TransactionType::INT_BVH_QTRIG)
+        {
+            base_addr = curr_blas->addrs.qtrigs_addr;
+            length = INT_BVH_QTRIG_length;
+        }
+
+        if (type == TransactionType::INT_BVH_TLAS_NODE)
+        {
+            base_addr = (uint64_t)int_tlas.nodes_addr;
+            length = INT_BVH_NODE_length;
+        }
+
+        if (type == TransactionType::INT_BVH_INSTANCE)
+        {
+            base_addr = (uint64_t)int_tlas.instances_addr;
+            length = INT_BVH_INSTANCE_length;
+        }
+
         uint64_t target_addr = base_addr + index * length;
         uint64_t align_addr = target_addr & ~(INT_BVH_ALIGNMENT - 1);
         uint64_t next_addr = align_addr + INT_BVH_ALIGNMENT;
 
-        if (next_addr - target_addr > length)
+        // an element ending exactly on the line boundary still fits in one transaction
+        if (next_addr - target_addr >= length)
         {
             transactions.push_back(MemoryTransactionRecord((uint8_t *)((uint64_t)align_addr),
                                                            INT_BVH_ALIGNMENT, type));
@@ -827,12 +906,27 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
     };
 
     cluster_data_t cluster_data = {.num_nodes_in_stk_2 = 0};
-    std::stack<cluster_data_t> stk_1;
-    std::stack<std::pair<uint16_t, uint16_t>> stk_2; // [local_node_idx, cluster_idx]
+    cluster_stack_t stk_1;
+    node_stack_t stk_2; // [local_node_idx, cluster_idx]
+
+    // constants of the cluster, set when entering it and when returning to it from stk_1
+    auto set_cluster = [&](uint32_t cluster_idx, const int_cluster_t &cluster)
+    {
+        cluster_data.cluster_idx = cluster_idx;
+        cluster_data.local_nodes = &curr_blas->int_bvh.nodes[cluster.node_offset];
+        cluster_data.local_trigs = curr_blas->int_bvh.trigs ? &curr_blas->int_bvh.trigs[cluster.trig_offset] : nullptr;
+        cluster_data.qtrig_frame = get_qtrig_frame(cluster);
+
+        cluster_data.node_offset = cluster.node_offset;
+        cluster_data.trig_offset = cluster.trig_offset;
+        cluster_data.child_cluster_offset = cluster.child_cluster_offset;
+
+        cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+    };
 
-    auto update_cluster_data = [&](uint16_t cluster_idx) -> bool
+    auto update_cluster_data = [&](uint32_t cluster_idx) -> bool
     {
-        int_cluster_t cluster = int_bvh.clusters[cluster_idx];
+        int_cluster_t cluster = curr_blas->int_bvh.clusters[cluster_idx];
         transaction_record(cluster_idx, TransactionType::INT_BVH_CLUSTER);
 
         // Get root cluster and set min/max
@@ -859,34 +953,26 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             return false;
 
         if (cluster_data.num_nodes_in_stk_2 != 0)
-            stk_1.push(cluster_data);
+            stk_1.push(get_cluster_stack_entry(cluster_data));
 
-        cluster_data.cluster_idx = cluster_idx;
-        cluster_data.local_nodes = &int_bvh.nodes[cluster.node_offset];
-        cluster_data.local_trigs = &int_bvh.trigs[cluster.trig_offset];
-
-        cluster_data.node_offset = cluster.node_offset;
-        cluster_data.trig_offset = cluster.trig_offset;
-
-        cluster_data.inv_sx_inv_sw = cluster.inv_sx_inv_sw;
+        set_cluster(cluster_idx, cluster);
         cluster_data.y_ref = y_ref_pair.second;
 
         for (int i = 0; i < 3; i++)
         {
-            cluster_data.qb_l[i] = floor_to_int32((b[i] - cluster_data.y_ref + cluster.ref_bounds[2 * i] * w[i]) *
-                                                  cluster_data.inv_sx_inv_sw);
+            cluster_data.qb_l[i] = floor_to_int_dist((static_cast<int_dist_float_t>(b[i]) - cluster_data.y_ref +
+                                                      cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[i])) *
+                                                     cluster_data.inv_sx_inv_sw);
             cluster_data.qb_h[i] = cluster_data.qb_l[i] + 1;
         }
 
         cluster_data.tmax_version = global_tmax_version;
-        cluster_data.qy_max = ceil_to_int32((objectRay.get_tmax() - cluster_data.y_ref) * cluster_data.inv_sx_inv_sw);
+        cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(objectRay.get_tmax()) - cluster_data.y_ref) *
+                                               cluster_data.inv_sx_inv_sw);
         cluster_data.num_nodes_in_stk_2 = 0;
         return true;
     };
 
-    // intersect root cluster
-    bool start_tracing = update_cluster_data(0);
-
     uint16_t curr_local_node_idx = 0;
     auto update_node_and_cluster = [&](const decoded_data_t &decoded_data) -> bool
     {
@@ -897,59 +983,48 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
             return true;
         case child_type_t::SWITCH:
             curr_local_node_idx = 0;
-            return update_cluster_data(decoded_data.idx);
+            return update_cluster_data(cluster_data.child_cluster_offset + decoded_data.idx);
         default:
             assert(false);
         }
     };
 
-    auto intersect_leaf = [&](const decoded_data_t &decoded_data, const cluster_data_t &curr_cluster, const Ray &ray) -> uint32_t
-    {
-        assert(decoded_data.child_type == child_type_t::LEAF);
-        uint32_t best_trig_offset = -1;
-
-        for (int i = 0; i < decoded_data.num_trigs; i++)
-        {
-            total_nodes_accessed++;
-
-            uint32_t trig_offset = curr_cluster.trig_offset + decoded_data.idx + i;
-            int_trig_t *tmp_trigs = &int_bvh.trigs[trig_offset];
-            transaction_record(trig_offset, TransactionType::INT_BVH_TRIG);
-
-            auto hit = intersect_trig(tmp_trigs, ray);
-
-            if (hit.first)
-            {
-                ray.set_tmax(hit.second);
-                best_trig_offset = trig_offset;
-            }
-        }
-
-        return best_trig_offset;
-    };
-
     auto intersect_ray = [&](uint32_t &trig_offset)
     {
-        int_trig_t *tmp_trigs = &int_bvh.trigs[trig_offset];
         transaction_record(trig_offset, TransactionType::INT_BVH_TRIG);
 
-        float3 p[3]; // Extract vertices from leaf
-        for (int i = 0; i < 3; i++)
+        // Perform triangle intersection test, transformed triangles also give the barycentrics
+        float thit;
+        bool hit;
+        float3 barycentric = {0.0f, 0.0f, 0.0f};
+        int_trig_t *tmp_trigs = nullptr;
+        if (curr_blas->int_bvh.xforms)
         {
-            p[i].x = tmp_trigs->v[i][0];
-            p[i].y = tmp_trigs->v[i][1];
-            p[i].z = tmp_trigs->v[i][2];
+            const float o[3] = {objectRay.get_origin().x, objectRay.get_origin().y, objectRay.get_origin().z};
+            const float d[3] = {objectRay.get_direction().x, objectRay.get_direction().y, objectRay.get_direction().z};
+            float u, v;
+            hit = intersect_trig_xform(curr_blas->int_bvh.xforms[trig_offset], o, d, -std::numeric_limits<float>::infinity(),
+                                       std::numeric_limits<float>::infinity(), thit, u, v);
+            barycentric = {u, v, 1.0f - u - v};
+        }
+        else
+        {
+            tmp_trigs = &curr_blas->int_bvh.trigs[trig_offset];
+            float3 p[3]; // Extract vertices from leaf
+            for (int i = 0; i < 3; i++)
+            {
+                p[i].x = tmp_trigs->v[i][0];
+                p[i].y = tmp_trigs->v[i][1];
+                p[i].z = tmp_trigs->v[i][2];
+            }
+            hit = VulkanRayTracing::mt_ray_triangle_test(p[0], p[1], p[2], objectRay, &thit);
         }
-
-        // Perform triangle intersection test
-        float thit;
-        bool hit = VulkanRayTracing::mt_ray_triangle_test(p[0], p[1], p[2], objectRay, &thit);
 
         float world_thit = thit / worldToObject_tMultiplier;
 
         if (hit && Tmin <= world_thit && world_thit <= Tmax)
         {
-            uint32_t prim_id = (uint32_t)int_bvh.primitive_indices[trig_offset];
+            uint32_t prim_id = (uint32_t)curr_blas->int_bvh.primitive_indices[trig_offset];
             transaction_record(trig_offset, TransactionType::INT_BVH_PRIMITIVE_INSTANCE);
 
             if (skipAnyHitShader && world_thit < min_thit)
@@ -958,156 +1033,373 @@ void VulkanRayTracing::traceRay(VkAccelerationStructureKHR _topLevelAS,
                 min_thit_object = thit;
                 closest_leaf.LeafDescriptor.GeometryIndex = 0;
                 closest_leaf.PrimitiveIndex0 = prim_id;
-                closest_instanceLeaf.InstanceID = 0;
+                closest_instanceLeaf.InstanceID = curr_instance.custom_index_mask & 0xffffff;
+                closest_sbt_offset = curr_instance.sbt_offset;
 
                 closest_worldToObject = worldToObjectMatrix;
                 closest_objectToWorld = objectToWorldMatrix;
                 closest_objectRay = objectRay;
 
-                for (int i = 0; i < 3; i++)
+                if (tmp_trigs)
                 {
-                    closest_leaf.QuadVertex[i].X = tmp_trigs->v[i][0];
-                    closest_leaf.QuadVertex[i].Y = tmp_trigs->v[i][1];
-                    closest_leaf.QuadVertex[i].Z = tmp_trigs->v[i][2];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        closest_leaf.QuadVertex[i].X = tmp_trigs->v[i][0];
+                        closest_leaf.QuadVertex[i].Y = tmp_trigs->v[i][1];
+                        closest_leaf.QuadVertex[i].Z = tmp_trigs->v[i][2];
+                    }
                 }
+                closest_barycentric = barycentric;
 
                 thread->add_ray_intersect();
             }
         }
     };
 
-    uint64_t buffer_addr = 0; // 64 byte buffer
+    // An occlusion ray (terminateOnFirstHit) is done with its first committed hit: trig_offset is reported
+    // right away through intersect_ray and the rest of the traversal, with its memory transactions, is
+    // skipped. Returns false if intersect_ray rejects the hit, the traversal then goes on.
+    bool terminated = false;
+    auto commit_first_hit = [&](uint32_t trig_offset) -> bool
+    {
+        float traversal_tmax = objectRay.get_tmax();
+        float prev_min_thit = min_thit;
+        objectRay.set_tmax(original_tmax);
+        intersect_ray(trig_offset);
+        terminated = min_thit < prev_min_thit;
+        if (!terminated)
+            objectRay.set_tmax(traversal_tmax);
+        return terminated;
+    };
 
-    while (start_tracing)
+    auto intersect_leaf = [&](const decoded_data_t &decoded_data, const cluster_data_t &curr_cluster, const Ray &ray) -> uint32_t
     {
-        total_nodes_accessed++;
-        total_traverse_steps++;
+        assert(decoded_data.child_type == child_type_t::LEAF);
+        uint32_t best_trig_offset = -1;
 
-        int_node_t *curr_node = &cluster_data.local_nodes[curr_local_node_idx];
-        transaction_record(curr_local_node_idx, TransactionType::INT_BVH_NODE);
+        for (int i = 0; i < decoded_data.num_trigs; i++)
+        {
+            total_nodes_accessed++;
 
-        decoded_data_t left_decoded_data = decode_data(curr_node->left_child_data);
-        decoded_data_t right_decoded_data = decode_data(curr_node->right_child_data);
+            uint32_t trig_offset = curr_cluster.trig_offset + decoded_data.idx + i;
 
-        // optional, but can reduce traversal steps
-        if (cluster_data.tmax_version != global_tmax_version)
-        {
-            cluster_data.tmax_version = global_tmax_version;
-            cluster_data.qy_max = ceil_to_int32((objectRay.get_tmax() - cluster_data.y_ref) * cluster_data.inv_sx_inv_sw);
+            // the full-precision triangle is only fetched when the quantized one may be hit
+            if (curr_blas->int_bvh.qtrigs)
+            {
+                transaction_record(trig_offset, TransactionType::INT_BVH_QTRIG);
+                const float o[3] = {ray.get_origin().x, ray.get_origin().y, ray.get_origin().z};
+                const float d[3] = {ray.get_direction().x, ray.get_direction().y, ray.get_direction().z};
+                if (!may_hit_qtrig(curr_blas->int_bvh.qtrigs[trig_offset], curr_cluster.qtrig_frame, o, d, ray.get_tmin(), ray.get_tmax()))
+                    continue;
+            }
+
+            transaction_record(trig_offset, TransactionType::INT_BVH_TRIG);
+
+            std::pair<bool, float> hit;
+            if (curr_blas->int_bvh.xforms)
+            {
+                const float o[3] = {ray.get_origin().x, ray.get_origin().y, ray.get_origin().z};
+                const float d[3] = {ray.get_direction().x, ray.get_direction().y, ray.get_direction().z};
+                float u, v;
+                hit.first = intersect_trig_xform(curr_blas->int_bvh.xforms[trig_offset], o, d, ray.get_tmin(), ray.get_tmax(),
+                                                 hit.second, u, v);
+            }
+            else
+                hit = intersect_trig(&curr_blas->int_bvh.trigs[trig_offset], ray);
+
+            if (hit.first)
+            {
+                ray.set_tmax(hit.second);
+                best_trig_offset = trig_offset;
+                if (terminateOnFirstHit && commit_first_hit(trig_offset))
+                    break;
+            }
         }
 
-        auto distance_left = intersect_int_bbox(cluster_data.qy_max, int_w, curr_node->left_bounds,
-                                                cluster_data.qb_l, cluster_data.qb_h);
-        auto distance_right = intersect_int_bbox(cluster_data.qy_max, int_w, curr_node->right_bounds,
-                                                 cluster_data.qb_l, cluster_data.qb_h);
+        return best_trig_offset;
+    };
+
+    // traverses curr_blas with objectRay, best_trig_offset ends up at its closest triangle
+    auto traverse_blas = [&]()
+    {
+        best_trig_offset = -1;
+        cluster_data.num_nodes_in_stk_2 = 0;
+        curr_local_node_idx = 0;
 
-        bool left_hit = false;
-        bool right_hit = false;
+        // intersect root cluster
+        bool start_tracing = update_cluster_data(0);
 
-        if (distance_left.first)
+        while (start_tracing)
         {
-            if (left_decoded_data.child_type == child_type_t::LEAF)
+            total_nodes_accessed++;
+            total_traverse_steps++;
+
+            int_node_t *curr_node = &cluster_data.local_nodes[curr_local_node_idx];
+            transaction_record(cluster_data.node_offset + curr_local_node_idx, TransactionType::INT_BVH_NODE);
+
+            // optional, but can reduce traversal steps
+            if (cluster_data.tmax_version != global_tmax_version)
             {
-                uint32_t trig_offset = intersect_leaf(left_decoded_data, cluster_data, objectRay);
+                cluster_data.tmax_version = global_tmax_version;
+                cluster_data.qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(objectRay.get_tmax()) - cluster_data.y_ref) *
+                                                       cluster_data.inv_sx_inv_sw);
+            }
 
-                if (trig_offset != -1)
-                {
-                    best_trig_offset = trig_offset;
-                    global_tmax_version++;
-                }
+            // intersect every child against the same qy_max before visiting any leaf
+            std::array<decoded_data_t, INT_BVH_WIDTH> decoded_data;
+            std::array<std::pair<bool, int_dist_t>, INT_BVH_WIDTH> distance;
+            for (int i = 0; i < INT_BVH_WIDTH; i++)
+            {
+                decoded_data[i] = decode_data(curr_node->children[i].data);
+                distance[i] = std::make_pair(false, int_dist_t{0});
+                if (decoded_data[i].child_type != child_type_t::EMPTY)
+                    distance[i] = intersect_int_bbox(cluster_data.qy_max, int_w, curr_node->children[i].bounds,
+                                                     cluster_data.qb_l, cluster_data.qb_h);
             }
-            else
+
+            // [distance, decoded_data] of every intersected INTERNAL or SWITCH child
+            std::array<std::pair<int_dist_t, decoded_data_t>, INT_BVH_WIDTH> hits;
+            int num_hits = 0;
+            for (int i = 0; i < INT_BVH_WIDTH; i++)
             {
-                left_hit = true;
+                if (!distance[i].first)
+                    continue;
+
+                if (decoded_data[i].child_type == child_type_t::LEAF)
+                {
+                    uint32_t trig_offset = intersect_leaf(decoded_data[i], cluster_data, objectRay);
+
+                    if (trig_offset != -1)
+                    {
+                        best_trig_offset = trig_offset;
+                        global_tmax_version++;
+                    }
+                    if (terminated)
+                    {
+                        stk_1.clear();
+                        stk_2.clear();
+                        return;
+                    }
+                }
+                else
+                {
+                    hits[num_hits++] = std::make_pair(distance[i].second, decoded_data[i]);
+                }
             }
-        }
 
-        if (distance_right.first)
-        {
-            if (right_decoded_data.child_type == child_type_t::LEAF)
+            if (num_hits > 1)
             {
-                uint32_t trig_offset = intersect_leaf(right_decoded_data, cluster_data, objectRay);
+                // closest child first, ties keep the child order
+                std::stable_sort(hits.begin(), hits.begin() + num_hits,
+                                 [](const std::pair<int_dist_t, decoded_data_t> &a, const std::pair<int_dist_t, decoded_data_t> &c)
+                                 { return a.first < c.first; });
 
-                if (trig_offset != -1)
+                // push to stk_2, farthest first
+                for (int i = num_hits - 1; i > 0; i--)
                 {
-                    best_trig_offset = trig_offset;
-                    global_tmax_version++;
+                    const decoded_data_t &far_decoded_data = hits[i].second;
+                    switch (far_decoded_data.child_type)
+                    {
+                    case child_type_t::INTERNAL:
+                        cluster_data.num_nodes_in_stk_2++;
+                        stk_2.emplace(far_decoded_data.idx, cluster_data.cluster_idx);
+                        break;
+                    case child_type_t::SWITCH:
+                        stk_2.emplace(0, cluster_data.child_cluster_offset + far_decoded_data.idx);
+                        break;
+                    default:
+                        assert(false);
+                    }
                 }
             }
-            else
+
+            if (num_hits > 0)
             {
-                right_hit = true;
+                if (update_node_and_cluster(hits[0].second))
+                    continue;
             }
-        }
 
-        if (left_hit)
-        {
-            if (right_hit)
+            // pop from stk_2 until we found a valid node
+            while (true)
             {
-                // ensure left_decoded_data is closer
-                if (distance_left.second > distance_right.second)
-                    std::swap(left_decoded_data, right_decoded_data);
+                if (stk_2.empty())
+                    return;
+
+                curr_local_node_idx = stk_2.top().first;
+                uint32_t cluster_idx = stk_2.top().second;
+                stk_2.pop();
 
-                // push to stk_2
-                switch (right_decoded_data.child_type)
+                if (cluster_data.cluster_idx == cluster_idx)
                 {
-                case child_type_t::INTERNAL:
-                    cluster_data.num_nodes_in_stk_2++;
-                    stk_2.emplace(right_decoded_data.idx, cluster_data.cluster_idx);
+                    cluster_data.num_nodes_in_stk_2--;
                     break;
-                case child_type_t::SWITCH:
-                    stk_2.emplace(0, right_decoded_data.idx);
+                }
+
+                if ((!stk_1.empty() && stk_1.top().cluster_idx == cluster_idx))
+                {
+                    // the cluster record was fetched when the cluster was entered, no transaction
+                    set_cluster(cluster_idx, curr_blas->int_bvh.clusters[cluster_idx]);
+                    set_cluster_stack_entry(stk_1.top(), cluster_data);
+                    stk_1.pop();
+                    cluster_data.num_nodes_in_stk_2--;
                     break;
-                default:
-                    assert(false);
                 }
-            }
 
-            if (update_node_and_cluster(left_decoded_data))
-                continue;
+                if (update_cluster_data(cluster_idx))
+                    break;
+            }
         }
-        else if (right_hit)
+    };
+
+    // reports the closest triangle of curr_blas to intersect_ray
+    auto traverse_instance = [&]()
+    {
+        traverse_blas();
+        assert(stk_1.empty());
+
+        // a terminated occlusion ray has already reported its hit
+        if (best_trig_offset != -1 && !terminated)
         {
-            if (update_node_and_cluster(right_decoded_data))
-                continue;
+            objectRay.set_tmax(original_tmax);
+            intersect_ray(best_trig_offset);
         }
+    };
+
+    // moves the ray into the instance's object space, clipped to the closest hit so far
+    auto set_instance = [&](const int_instance_t &instance)
+    {
+        curr_instance = instance;
+        curr_blas = &int_blases[instance.blas_idx];
 
-        // pop from stk_2 until we found a valid node
-        while (true)
+        // row-major 3x4 to the column-major float4x4
+        for (int row = 0; row < 3; row++)
         {
-            if (stk_2.empty())
-                goto end;
+            for (int col = 0; col < 4; col++)
+            {
+                worldToObjectMatrix.m[col][row] = instance.world_to_object[row][col];
+                objectToWorldMatrix.m[col][row] = instance.object_to_world[row][col];
+            }
+        }
 
-            curr_local_node_idx = stk_2.top().first;
-            int cluster_idx = stk_2.top().second;
-            stk_2.pop();
+        Ray clipped_ray = ray;
+        clipped_ray.set_tmax(min_thit);
+        objectRay = make_transformed_ray(clipped_ray, worldToObjectMatrix, &worldToObject_tMultiplier);
+        original_tmax = objectRay.get_tmax();
+        preprocess_ray(objectRay);
+    };
 
-            if (cluster_data.cluster_idx == cluster_idx)
+    if (int_tlas.num_nodes == 0)
+    {
+        // no TLAS bound, trace the first BLAS untransformed
+        if (!int_blases.empty() && int_blases[0].addrs.num_trigs != 0)
+        {
+            int_instance_t identity_instance = {};
+            for (int i = 0; i < 3; i++)
             {
-                cluster_data.num_nodes_in_stk_2--;
-                break;
+                identity_instance.object_to_world[i][i] = 1.0f;
+                identity_instance.world_to_object[i][i] = 1.0f;
             }
+            identity_instance.custom_index_mask = 0xffu << 24;
+            set_instance(identity_instance);
+            traverse_instance();
+        }
+    }
+    else
+    {
+        // single cluster TLAS, traversed with the world ray
+        const int_cluster_t &tlas_cluster = int_tlas.cluster;
+        transactions.push_back(MemoryTransactionRecord((uint8_t *)((uint64_t)int_tlas.cluster_addr & ~(INT_BVH_ALIGNMENT - 1)),
+                                                       INT_BVH_ALIGNMENT, TransactionType::INT_BVH_CLUSTER));
+        ctx->func_sim->g_rt_mem_access_type[static_cast<int>(TransactionType::INT_BVH_CLUSTER)] += 1;
+
+        if (!ctx->func_sim->g_rt_world_set)
+        {
+            ctx->func_sim->g_rt_world_min = make_float3(tlas_cluster.ref_bounds[0], tlas_cluster.ref_bounds[2], tlas_cluster.ref_bounds[4]);
+            ctx->func_sim->g_rt_world_max = make_float3(tlas_cluster.ref_bounds[1], tlas_cluster.ref_bounds[3], tlas_cluster.ref_bounds[5]);
+            ctx->func_sim->g_rt_world_set = true;
+        }
+
+        preprocess_ray(ray);
+        std::pair<bool, float> y_ref_pair = intersect_bbox(octant, w, tlas_cluster.ref_bounds, b, ray.get_tmax());
+
+        float tlas_y_ref = y_ref_pair.second;
+        int_dist_t tlas_qb_l[3], tlas_qb_h[3];
+        for (int i = 0; i < 3; i++)
+        {
+            tlas_qb_l[i] = floor_to_int_dist((static_cast<int_dist_float_t>(b[i]) - tlas_y_ref +
+                                              tlas_cluster.ref_bounds[2 * i] * static_cast<int_dist_float_t>(w[i])) *
+                                             tlas_cluster.inv_sx_inv_sw);
+            tlas_qb_h[i] = tlas_qb_l[i] + 1;
+        }
+        // the BLAS traversals overwrite the preprocessed ray
+        int_w_t tlas_int_w = int_w;
+
+        fixed_stack_t<uint16_t, node_stack_capacity> tlas_stk;
+        if (y_ref_pair.first)
+            tlas_stk.push(0);
 
-            if ((!stk_1.empty() && stk_1.top().cluster_idx == cluster_idx))
+        while (!tlas_stk.empty() && !terminated)
+        {
+            uint16_t tlas_node_idx = tlas_stk.top();
+            tlas_stk.pop();
+
+            total_nodes_accessed++;
+            total_traverse_steps++;
+
+            const int_node_t &tlas_node = int_tlas.nodes[tlas_node_idx];
+            transaction_record(tlas_node_idx, TransactionType::INT_BVH_TLAS_NODE);
+
+            // min_thit shrinks with every instance hit
+            int_dist_t tlas_qy_max = ceil_to_int_dist((static_cast<int_dist_float_t>(min_thit) - tlas_y_ref) *
+                                                      tlas_cluster.inv_sx_inv_sw);
+
+            std::array<decoded_data_t, INT_BVH_WIDTH> decoded_data;
+            std::array<std::pair<bool, int_dist_t>, INT_BVH_WIDTH> distance;
+            for (int i = 0; i < INT_BVH_WIDTH; i++)
             {
-                cluster_data = stk_1.top();
-                stk_1.pop();
-                cluster_data.num_nodes_in_stk_2--;
-                break;
+                decoded_data[i] = decode_data(tlas_node.children[i].data);
+                distance[i] = std::make_pair(false, int_dist_t{0});
+                if (decoded_data[i].child_type != child_type_t::EMPTY)
+                    distance[i] = intersect_int_bbox(tlas_qy_max, tlas_int_w, tlas_node.children[i].bounds,
+                                                     tlas_qb_l, tlas_qb_h);
             }
 
-            if (update_cluster_data(cluster_idx))
-                break;
-        }
-    }
+            // [distance, node_idx] of every intersected INTERNAL child
+            std::array<std::pair<int_dist_t, uint16_t>, INT_BVH_WIDTH> hits;
+            int num_hits = 0;
+            for (int i = 0; i < INT_BVH_WIDTH; i++)
+            {
+                if (!distance[i].first)
+                    continue;
 
-end:
-    assert(stk_1.empty());
+                if (decoded_data[i].child_type == child_type_t::LEAF)
+                {
+                    for (int j = 0; j < decoded_data[i].num_trigs && !terminated; j++)
+                    {
+                        uint32_t instance_idx = decoded_data[i].idx + j;
+                        transaction_record(instance_idx, TransactionType::INT_BVH_INSTANCE);
+
+                        const int_instance_t &instance = int_tlas.instances[instance_idx];
+                        if (((instance.custom_index_mask >> 24) & cullMask) == 0)
+                            continue;
+
+                        set_instance(instance);
+                        traverse_instance();
+                    }
+                }
+                else
+                {
+                    hits[num_hits++] = std::make_pair(distance[i].second, decoded_data[i].idx);
+                }
+            }
 
-    if (best_trig_offset != -1)
-    {
-        objectRay.set_tmax(original_tmax);
-        intersect_ray(best_trig_offset);
+            // closest child on top, ties keep the child order
+            std::stable_sort(hits.begin(), hits.begin() + num_hits,
+                             [](const std::pair<int_dist_t, uint16_t> &a, const std::pair<int_dist_t, uint16_t> &c)
+                             { return a.first < c.first; });
+            for (int i = num_hits - 1; i >= 0; i--)
+                tlas_stk.push(hits[i].second);
+        }
     }
 
     if (min_thit < ray.dir_tmax.w)
@@ -1118,6 +1410,7 @@ end:
         traversal_data.closest_hit.geometry_index = closest_leaf.LeafDescriptor.GeometryIndex;
         traversal_data.closest_hit.primitive_index = closest_leaf.PrimitiveIndex0;
         traversal_data.closest_hit.instance_index = closest_instanceLeaf.InstanceID;
+        traversal_data.closest_hit.hitGroupIndex = sbtRecordOffset + closest_sbt_offset;
 
         float3 intersection_point = ray.get_origin() + make_float3(ray.get_direction().x * min_thit, ray.get_direction().y * min_thit, ray.get_direction().z * min_thit);
         float3 rayatinter = ray.at(min_thit);
@@ -1147,7 +1440,8 @@ end:
 
         float3 object_intersection_point = closest_objectRay.get_origin() + make_float3(closest_objectRay.get_direction().x * min_thit_object, closest_objectRay.get_direction().y * min_thit_object, closest_objectRay.get_direction().z * min_thit_object);
         // closest_objectRay.at(min_thit_object);
-        float3 barycentric = Barycentric(object_intersection_point, p[0], p[1], p[2]);
+        float3 barycentric = trig_format == trig_format_t::XFORM ? closest_barycentric
+                                                                  : Barycentric(object_intersection_point, p[0], p[1], p[2]);
         traversal_data.closest_hit.barycentric_coordinates = barycentric;
         thread->RT_thread_data->set_hitAttribute(barycentric, pI, thread);
         // store_transactions.push_back(MemoryStoreTransactionRecord(&traversal_data, sizeof(traversal_data), StoreTransactionType::Traversal_Results));
@@ -1305,6 +1599,66 @@ void VulkanRayTracing::setDescriptorSet(struct DESCRIPTOR_SET_STRUCT *set)
 
 // clang-format on
 
+// copies one BLAS's int_bvh arrays out of device memory, a BLAS without triangles stays empty
+static void load_int_blas(memory_space *mem, const int_blas_t &addrs, int_blas_entry_t &entry)
+{
+    entry.addrs = addrs;
+    int_bvh_t &int_bvh = entry.int_bvh;
+    if (addrs.num_trigs == 0)
+        return;
+
+    int_bvh.num_clusters = addrs.num_clusters;
+    int_bvh.clusters = std::make_unique<int_cluster_t[]>(addrs.num_clusters);
+    for (size_t i = 0; i < addrs.num_clusters; ++i)
+    {
+        mem->read((mem_addr_t)(addrs.clusters_addr + i * INT_BVH_CLUSTER_length),
+                  INT_BVH_CLUSTER_length, (void *)&int_bvh.clusters[i]);
+    }
+
+    if (trig_format == trig_format_t::XFORM)
+    {
+        int_bvh.xforms = std::make_unique<int_trig_xform_t[]>(addrs.num_trigs);
+        for (size_t i = 0; i < addrs.num_trigs; ++i)
+        {
+            mem->read((mem_addr_t)(addrs.trigs_addr + i * INT_BVH_TRIG_length),
+                      INT_BVH_TRIG_length, (void *)&int_bvh.xforms[i]);
+        }
+    }
+    else
+    {
+        int_bvh.trigs = std::make_unique<int_trig_t[]>(addrs.num_trigs);
+        for (size_t i = 0; i < addrs.num_trigs; ++i)
+        {
+            mem->read((mem_addr_t)(addrs.trigs_addr + i * INT_BVH_TRIG_length),
+                      INT_BVH_TRIG_length, (void *)&int_bvh.trigs[i]);
+        }
+    }
+
+    int_bvh.nodes = std::make_unique<int_node_t[]>(addrs.num_nodes);
+    for (size_t i = 0; i < addrs.num_nodes; ++i)
+    {
+        mem->read((mem_addr_t)(addrs.nodes_addr + i * INT_BVH_NODE_length),
+                  INT_BVH_NODE_length, (void *)&int_bvh.nodes[i]);
+    }
+
+    int_bvh.primitive_indices = std::make_unique<size_t[]>(addrs.num_trigs);
+    for (size_t i = 0; i < addrs.num_trigs; ++i)
+    {
+        mem->read((mem_addr_t)(addrs.primitive_indices_addr + i * INT_BVH_PRIMITIVE_INSTANCE_length),
+                  INT_BVH_PRIMITIVE_INSTANCE_length, (void *)&int_bvh.primitive_indices[i]);
+    }
+
+    if (trig_quant_bits != 0 && addrs.qtrigs_addr != 0)
+    {
+        int_bvh.qtrigs = std::make_unique<int_qtrig_t[]>(addrs.num_trigs);
+        for (size_t i = 0; i < addrs.num_trigs; ++i)
+        {
+            mem->read((mem_addr_t)(addrs.qtrigs_addr + i * INT_BVH_QTRIG_length),
+                      INT_BVH_QTRIG_length, (void *)&int_bvh.qtrigs[i]);
+        }
+    }
+}
+
 void VulkanRayTracing::iterateDescriptorSet(struct DESCRIPTOR_SET_STRUCT *set)
 {
     uint32_t descriptorCount = set->layout->binding_count;
@@ -1316,6 +1670,10 @@ void VulkanRayTracing::iterateDescriptorSet(struct DESCRIPTOR_SET_STRUCT *set)
     CUctx_st *context = GPGPUSim_Context(ctx);
     memory_space *mem = context->get_device()->get_gpgpu()->get_global_memory();
 
+    int_blas_t legacy_int_blas = {};
+    std::vector<int_blas_t> blas_table;
+    int_tlas = int_tlas_t();
+
     // Iterate all descriptors
     for (uint32_t i = 0; i < descriptorCount; i++)
     {
@@ -1323,71 +1681,82 @@ void VulkanRayTracing::iterateDescriptorSet(struct DESCRIPTOR_SET_STRUCT *set)
 
         printf("Descriptor %d: \n", i);
 
+        // legacy single BLAS, used when there is no BLAS table
         if (i == 12)
         {
-            int_bvh_clusters_addr = desc->info.ubo.pmem;
-            size_t num_clusters = desc->info.ubo.buffer_size / INT_BVH_CLUSTER_length;
-
-            printf("  (ycpin) Address of int_bvh_clusters: 0x%lx\n", int_bvh_clusters_addr);
-            printf("  (ycpin) Size of int_bvh_clusters: %zu\n", num_clusters);
-
-            int_bvh.num_clusters = num_clusters;
-            int_bvh.clusters = std::make_unique<int_cluster_t[]>(num_clusters);
-
-            for (size_t i = 0; i < num_clusters; ++i)
-            {
-                mem->read((mem_addr_t)(int_bvh_clusters_addr + i * INT_BVH_CLUSTER_length),
-                          INT_BVH_CLUSTER_length, (void *)&int_bvh.clusters[i]);
-            }
+            legacy_int_blas.clusters_addr = (uint64_t)desc->info.ubo.pmem;
+            legacy_int_blas.num_clusters = desc->info.ubo.buffer_size / INT_BVH_CLUSTER_length;
         }
         else if (i == 13)
         {
-            int_bvh_trigs_addr = desc->info.ubo.pmem;
-            size_t num_trigs = desc->info.ubo.buffer_size / INT_BVH_TRIG_length;
-
-            printf("  (ycpin) Address of int_bvh_trigs: 0x%lx\n", int_bvh_trigs_addr);
-            printf("  (ycpin) Size of int_bvh_trigs: %zu\n", num_trigs);
+            legacy_int_blas.trigs_addr = (uint64_t)desc->info.ubo.pmem;
+            legacy_int_blas.num_trigs = desc->info.ubo.buffer_size / INT_BVH_TRIG_length;
+        }
+        else if (i == 14)
+        {
+            legacy_int_blas.nodes_addr = (uint64_t)desc->info.ubo.pmem;
+            legacy_int_blas.num_nodes = desc->info.ubo.buffer_size / INT_BVH_NODE_length;
+        }
+        else if (i == 15)
+        {
+            legacy_int_blas.primitive_indices_addr = (uint64_t)desc->info.ubo.pmem;
+        }
+        else if (i == 16)
+        {
+            size_t num_blases = desc->info.ubo.buffer_size / INT_BVH_BLAS_length;
 
-            int_bvh.trigs = std::make_unique<int_trig_t[]>(num_trigs);
+            printf("  (ycpin) Address of int_bvh_blas_table: 0x%lx\n", desc->info.ubo.pmem);
+            printf("  (ycpin) Size of int_bvh_blas_table: %zu\n", num_blases);
 
-            for (size_t i = 0; i < num_trigs; ++i)
+            blas_table.resize(num_blases);
+            for (size_t i = 0; i < num_blases; ++i)
             {
-                mem->read((mem_addr_t)(int_bvh_trigs_addr + i * INT_BVH_TRIG_length),
-                          INT_BVH_TRIG_length, (void *)&int_bvh.trigs[i]);
+                mem->read((mem_addr_t)((uint64_t)desc->info.ubo.pmem + i * INT_BVH_BLAS_length),
+                          INT_BVH_BLAS_length, (void *)&blas_table[i]);
             }
         }
-        else if (i == 14)
+        else if (i == 17)
         {
-            int_bvh_nodes_addr = desc->info.ubo.pmem;
-            size_t node_count = desc->info.ubo.buffer_size / INT_BVH_NODE_length;
+            int_tlas.cluster_addr = desc->info.ubo.pmem;
 
-            printf("  (ycpin) Address of int_bvh_nodes: 0x%lx\n", int_bvh_nodes_addr);
-            printf("  (ycpin) Size of int_bvh_nodes: %zu\n", node_count);
+            printf("  (ycpin) Address of int_tlas_cluster: 0x%lx\n", int_tlas.cluster_addr);
+
+            mem->read((mem_addr_t)int_tlas.cluster_addr, INT_BVH_CLUSTER_length, (void *)&int_tlas.cluster);
+        }
+        else if (i == 18)
+        {
+            int_tlas.nodes_addr = desc->info.ubo.pmem;
+            int_tlas.num_nodes = desc->info.ubo.buffer_size / INT_BVH_NODE_length;
 
-            int_bvh.nodes = std::make_unique<int_node_t[]>(node_count);
+            printf("  (ycpin) Address of int_tlas_nodes: 0x%lx\n", int_tlas.nodes_addr);
+            printf("  (ycpin) Size of int_tlas_nodes: %zu\n", int_tlas.num_nodes);
 
-            for (size_t i = 0; i < node_count; ++i)
+            int_tlas.nodes = std::make_unique<int_node_t[]>(int_tlas.num_nodes);
+            for (size_t i = 0; i < int_tlas.num_nodes; ++i)
             {
-                mem->read((mem_addr_t)(int_bvh_nodes_addr + i * INT_BVH_NODE_length),
-                          INT_BVH_NODE_length, (void *)&int_bvh.nodes[i]);
+                mem->read((mem_addr_t)((uint64_t)int_tlas.nodes_addr + i * INT_BVH_NODE_length),
+                          INT_BVH_NODE_length, (void *)&int_tlas.nodes[i]);
             }
         }
-        else if (i == 15)
+        else if (i == 19)
         {
-            int_bvh_primitive_indices_addr = desc->info.ubo.pmem;
-            size_t num_primitive_indices = desc->info.ubo.buffer_size / INT_BVH_PRIMITIVE_INSTANCE_length;
+            int_tlas.instances_addr = desc->info.ubo.pmem;
+            int_tlas.num_instances = desc->info.ubo.buffer_size / INT_BVH_INSTANCE_length;
 
-            printf("  (ycpin) Address of int_bvh_primitive_indices: 0x%lx\n", int_bvh_primitive_indices_addr);
-            printf("  (ycpin) Size of int_bvh_primitive_indices: %zu\n", num_primitive_indices);
+            printf("  (ycpin) Address of int_tlas_instances: 0x%lx\n", int_tlas.instances_addr);
+            printf("  (ycpin) Size of int_tlas_instances: %zu\n", int_tlas.num_instances);
 
-            int_bvh.primitive_indices = std::make_unique<size_t[]>(num_primitive_indices);
-
-            for (size_t i = 0; i < num_primitive_indices; ++i)
+            int_tlas.instances = std::make_unique<int_instance_t[]>(int_tlas.num_instances);
+            for (size_t i = 0; i < int_tlas.num_instances; ++i)
             {
-                mem->read((mem_addr_t)(int_bvh_primitive_indices_addr + i * INT_BVH_PRIMITIVE_INSTANCE_length),
-                          INT_BVH_PRIMITIVE_INSTANCE_length, (void *)&int_bvh.primitive_indices[i]);
+                mem->read((mem_addr_t)((uint64_t)int_tlas.instances_addr + i * INT_BVH_INSTANCE_length),
+                          INT_BVH_INSTANCE_length, (void *)&int_tlas.instances[i]);
             }
         }
+        else if (i == 20 && trig_quant_bits != 0)
+        {
+            legacy_int_blas.qtrigs_addr = (uint64_t)desc->info.ubo.pmem;
+        }
 
         // Process according to different descriptor types
         switch (desc->type)
@@ -1431,6 +1800,18 @@ void VulkanRayTracing::iterateDescriptorSet(struct DESCRIPTOR_SET_STRUCT *set)
             break;
         }
     }
+
+    if (blas_table.empty())
+        blas_table.push_back(legacy_int_blas);
+
+    int_blases.clear();
+    int_blases.resize(blas_table.size());
+    for (size_t i = 0; i < blas_table.size(); i++)
+    {
+        printf("  (ycpin) BLAS %zu: %u clusters, %u nodes, %u trigs\n", i,
+               blas_table[i].num_clusters, blas_table[i].num_nodes, blas_table[i].num_trigs);
+        load_int_blas(mem, blas_table[i], int_blases[i]);
+    }
 }
 
 // clang-format off
@@ -1800,13 +2181,16 @@ void VulkanRayTracing::vkCmdTraceRaysKHR(
 
     printf("gpgpusim: tlas address %p\n", tlas_addr);
 
-    printf("(ycpin) gpgpusim: clusters address %p\n", int_bvh_clusters_addr);
+    for (size_t i = 0; i < int_blases.size(); i++) {
+        printf("(ycpin) gpgpusim: BLAS %zu clusters address %p\n", i, (void *)int_blases[i].addrs.clusters_addr);
+        printf("(ycpin) gpgpusim: BLAS %zu trigs address %p\n", i, (void *)int_blases[i].addrs.trigs_addr);
+        printf("(ycpin) gpgpusim: BLAS %zu nodes address %p\n", i, (void *)int_blases[i].addrs.nodes_addr);
+        printf("(ycpin) gpgpusim: BLAS %zu primitive indices address %p\n", i, (void *)int_blases[i].addrs.primitive_indices_addr);
+    }
 
-    printf("(ycpin) gpgpusim: trigs address %p\n", int_bvh_trigs_addr);
-    
-    printf("(ycpin) gpgpusim: nodes address %p\n", int_bvh_nodes_addr);
+    printf("(ycpin) gpgpusim: TLAS nodes address %p\n", int_tlas.nodes_addr);
 
-    printf("(ycpin) gpgpusim: primitive indices address %p\n", int_bvh_primitive_indices_addr);
+    printf("(ycpin) gpgpusim: TLAS instances address %p\n", int_tlas.instances_addr);
             
     struct CUstream_st *stream = 0;
     stream_operation op(grid, ctx->func_sim->g_ptx_sim_mode, stream);
@@ -269,13 +269,10 @@ private:
 
     static void *tlas_addr;
 
-    static void *int_bvh_addr;
-    static void *int_bvh_clusters_addr;
-    static void *int_bvh_trigs_addr;
-    static void *int_bvh_nodes_addr;
-    static void *int_bvh_primitive_indices_addr;
-
-    static int_bvh_t int_bvh;
+    // BLAS registry indexed by int_instance_t::blas_idx, loaded from the BLAS table (binding 16)
+    // or, without one, from the legacy single BLAS bindings (12-15 and 20)
+    static std::vector<int_blas_entry_t> int_blases;
+    static int_tlas_t int_tlas;
 
     static bool dumped;
     static bool _init_;
@@ -297,6 +294,8 @@ private:
 public:
     static int32_t floor_to_int32(float x);
     static int32_t ceil_to_int32(float x);
+    static int_dist_t floor_to_int_dist(int_dist_float_t x);
+    static int_dist_t ceil_to_int_dist(int_dist_float_t x);
     static int_w_t get_int_w(const std::array<float, 3> &w);
     static decoded_data_t decode_data(uint16_t data);
 
@@ -305,11 +304,11 @@ public:
                                                  const float *x,
                                                  const std::array<float, 3> &b,
                                                  float tmax);
-    static std::pair<bool, int32_t> intersect_int_bbox(int32_t qy_max,
-                                                       const int_w_t &int_w,
-                                                       const uint8_t *qx,
-                                                       const int32_t *qb_l,
-                                                       const int32_t *qb_h);
+    static std::pair<bool, int_dist_t> intersect_int_bbox(int_dist_t qy_max,
+                                                          const int_w_t &int_w,
+                                                          const uint8_t *qx,
+                                                          const int_dist_t *qb_l,
+                                                          const int_dist_t *qb_h);
     static std::pair<bool, float> intersect_trig(int_trig_t *trigs, const Ray &ray);
 
     static void traceRay( // called by raygen shader
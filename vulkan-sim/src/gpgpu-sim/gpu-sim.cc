@@ -292,8 +292,8 @@ void shader_core_config::reg_options(class OptionParser *opp)
       "0");
   option_parser_register(
       opp, "-gpgpu_rt_intersection_latency", OPT_CSTR, &m_rt_intersection_latency_str,
-      "latency of pipelined intersection tests (11 types)",
-      "0,0,0,0,0,0,0,0,0,0,0");
+      "latency of pipelined intersection tests (14 types)",
+      "0,0,0,0,0,0,0,0,0,0,0,0,0,0");
   option_parser_register(
       opp, "-gpgpu_rt_intersection_table_type", OPT_UINT32, &m_rt_intersection_table_type,
       "type of intersection table",